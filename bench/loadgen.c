@@ -0,0 +1,672 @@
+/*
+   Copyright (c) 2018-2019, Seznam.cz, a.s.
+
+   Author: Daniel Bilik (daniel.bilik@firma.seznam.cz)
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+   PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+   BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+   POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <event.h>
+#include <event2/util.h>
+#include <event2/bufferevent.h>
+#include <event2/bufferevent_ssl.h>
+#include <event2/listener.h>
+
+#include "log.h"
+#include "resp.h"
+#include "stats.h"
+
+/* NOTE: closed loop load generator, each connection keeps pipeline commands in flight
+         and measures latency of each of them from the moment it's been written to the
+         moment its reply has been parsed; optional stub backend answers commands in
+         process, so that redis itself is left out of the measurement */
+
+#define LOADGEN_MIX_MAX 16
+#define LOADGEN_TARGET_MAX 16
+
+typedef struct {
+	char name[32];
+	int weight, args;
+} loadgen_command_t;
+
+typedef struct {
+	int connections, threads, pipeline, duration, keys;
+	int value_min, value_max;
+	int stub_port, stub_value;
+	const char *auth, *cert, *key;
+	int tls;
+	SSL_CTX *ssl_ctx;
+	loadgen_command_t mix[LOADGEN_MIX_MAX];
+	int mixes, weight;
+	char *value;
+} loadgen_config_t;
+
+typedef struct loadgen_thread_s loadgen_thread_t;
+
+typedef struct {
+	loadgen_thread_t *thread;
+	struct bufferevent *be;
+	resp_reply_t rr;
+	uint64_t *sent;
+	int head, inflight;
+	int authenticating, closed;
+	unsigned int seed;
+} loadgen_connection_t;
+
+struct loadgen_thread_s {
+	pthread_t id;
+	struct event_base *eb;
+	struct event *timer;
+	struct sockaddr_storage target;
+	int targetlen;
+	SSL_CTX *ssl_ctx;
+	loadgen_connection_t *connection;
+	int connections, stopping;
+	stats_histogram_t histogram;
+	uint64_t requests, errors, failures;
+};
+
+typedef struct {
+	uint64_t requests, errors, failures;
+	double rps;
+	uint64_t percentile[4], max, avg;
+} loadgen_result_t;
+
+typedef struct {
+	pthread_t id;
+	struct event_base *eb;
+	struct evconnlistener *ecl;
+} loadgen_stub_t;
+
+typedef struct {
+	struct bufferevent *be;
+	resp_buffer_t rs;
+} loadgen_stub_session_t;
+
+static loadgen_config_t config = { 50, 1, 1, 10, 10000, 16, 16, 0, 16, NULL, NULL, NULL, 0, NULL };
+
+static void usage(char *command)
+{
+	printf("Usage: %s [options] [address:port ...]\n\n", command);
+	printf("Options:\n");
+	printf("  -h --help                 Print this help\n");
+	printf("  -c --connections count    Number of connections (default 50)\n");
+	printf("  -t --threads count        Number of threads to spread connections over (default 1)\n");
+	printf("  -P --pipeline count       Commands in flight per connection (default 1)\n");
+	printf("  -d --duration seconds     Time spent on each target (default 10)\n");
+	printf("  -m --mix cmd:weight,...   Commands to send and their weights (default get:1)\n");
+	printf("  -k --keys count           Number of distinct keys (default 10000)\n");
+	printf("  -v --value bytes[-bytes]  Size (or range of sizes) of values set (default 16)\n");
+	printf("  -a --auth password        Authenticate each connection with 'auth' first\n");
+	printf("  -s --tls                  Connect to all targets using TLS\n");
+	printf("     --cert file            Client certificate (implies --tls)\n");
+	printf("     --key file             Client certificate key\n");
+	printf("  -S --stub port            Run stub backend on 127.0.0.1:port\n");
+	printf("     --stub-value bytes     Size of values returned by stub backend (default 16)\n");
+	printf("\n");
+	printf("Targets are measured one after another with the same load, each of them compared\n");
+	printf("to the first one, prefix 'tls://' makes a single target use TLS. With no target\n");
+	printf("given, stub backend just serves until killed.\n");
+	printf("Commands 'set', 'append', 'rpush', 'lpush' and 'sadd' are sent with a key and\n");
+	printf("a value, 'ping' with no argument, others with a key.\n");
+	printf("\n");
+	exit(1);
+}
+
+static uint64_t loadgen_clock(void)
+{
+	return(stats_clock());
+}
+
+static int loadgen_mix(const char *mix)
+{
+	char *copy = strdup(mix), *item, *save = NULL, *colon;
+	loadgen_command_t *c;
+
+	config.mixes = config.weight = 0;
+
+	for (item = strtok_r(copy, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+		if (config.mixes == LOADGEN_MIX_MAX)
+			return(-1);
+		c = &config.mix[config.mixes++];
+		c->weight = 1;
+		if ((colon = strchr(item, ':')) != NULL) {
+			*colon = '\0';
+			if ((c->weight = atoi(colon + 1)) <= 0)
+				return(-1);
+		}
+		snprintf(c->name, sizeof(c->name), "%s", item);
+		if (strcasecmp(c->name, "ping") == 0)
+			c->args = 0;
+		else if (!strcasecmp(c->name, "set") || !strcasecmp(c->name, "append") || !strcasecmp(c->name, "rpush") || !strcasecmp(c->name, "lpush") || !strcasecmp(c->name, "sadd"))
+			c->args = 2;
+		else
+			c->args = 1;
+		config.weight += c->weight;
+	}
+
+	free(copy);
+
+	return((config.mixes > 0) ? 0:-1);
+}
+
+static void loadgen_request(loadgen_connection_t *c, struct evbuffer *eb)
+{
+	loadgen_command_t *cmd = config.mix;
+	char key[32];
+	int w, len, size;
+
+	if (config.mixes > 1)
+		for (w = rand_r(&c->seed) % config.weight; w >= cmd->weight; cmd++)
+			w -= cmd->weight;
+
+	len = snprintf(key, sizeof(key), "key:%d", rand_r(&c->seed) % config.keys);
+
+	evbuffer_add_printf(eb, "*%d\r\n$%d\r\n%s\r\n", cmd->args + 1, (int)strlen(cmd->name), cmd->name);
+
+	if (cmd->args > 0)
+		evbuffer_add_printf(eb, "$%d\r\n%s\r\n", len, key);
+
+	if (cmd->args > 1) {
+		size = config.value_min;
+		if (config.value_max > config.value_min)
+			size += rand_r(&c->seed) % (config.value_max - config.value_min + 1);
+		evbuffer_add_printf(eb, "$%d\r\n", size);
+		evbuffer_add(eb, config.value, size);
+		evbuffer_add(eb, "\r\n", 2);
+	}
+}
+
+/* NOTE: connection is refilled up to pipeline commands in flight by a single write */
+static void loadgen_fill(loadgen_connection_t *c)
+{
+	struct evbuffer *eb = bufferevent_get_output(c->be);
+	uint64_t now;
+
+	if (c->thread->stopping || (c->inflight == config.pipeline))
+		return;
+
+	now = loadgen_clock();
+
+	while (c->inflight < config.pipeline) {
+		loadgen_request(c, eb);
+		c->sent[(c->head + c->inflight) % config.pipeline] = now;
+		c->inflight++;
+	}
+}
+
+static void loadgen_close(loadgen_connection_t *c, const char *why)
+{
+	if (c->closed)
+		return;
+
+	if (!c->thread->stopping) {
+		fprintf(stderr, "connection closed, %s\n", why);
+		c->thread->failures++;
+	}
+
+	c->closed = 1;
+	bufferevent_free(c->be);
+	c->be = NULL;
+}
+
+static void loadgen_read(struct bufferevent *be, void *arg)
+{
+	loadgen_connection_t *c = (loadgen_connection_t *)arg;
+	loadgen_thread_t *t = c->thread;
+	struct evbuffer *src = bufferevent_get_input(be);
+	uint64_t now = loadgen_clock();
+	int i;
+
+	while ((i = resp_parse_reply(&c->rr, src)) > 0) {
+		if (c->authenticating) {
+			if (c->rr.type != '+') {
+				loadgen_close(c, "authentication failed");
+				return;
+			}
+			c->authenticating = 0;
+			continue;
+		}
+		if (c->inflight == 0) {
+			loadgen_close(c, "unexpected reply");
+			return;
+		}
+		stats_histogram_record(&t->histogram, now - c->sent[c->head]);
+		c->head = (c->head + 1) % config.pipeline;
+		c->inflight--;
+		t->requests++;
+		if (c->rr.type == '-')
+			t->errors++;
+	}
+
+	if (i == -1) {
+		loadgen_close(c, "failed to parse a reply");
+		return;
+	}
+
+	evbuffer_drain(src, c->rr.parsed);
+	c->rr.parsed = 0;
+
+	if (!c->authenticating)
+		loadgen_fill(c);
+}
+
+static void loadgen_event(struct bufferevent *be, short events, void *arg)
+{
+	loadgen_connection_t *c = (loadgen_connection_t *)arg;
+
+	if (events & BEV_EVENT_CONNECTED) {
+		if (config.auth) {
+			evbuffer_add_printf(bufferevent_get_output(be), "*2\r\n$4\r\nauth\r\n$%d\r\n%s\r\n", (int)strlen(config.auth), config.auth);
+			c->authenticating = 1;
+		} else {
+			loadgen_fill(c);
+		}
+	} else if (events & (BEV_EVENT_ERROR | BEV_EVENT_EOF | BEV_EVENT_TIMEOUT)) {
+		loadgen_close(c, (events & BEV_EVENT_EOF) ? "server has closed connection":evutil_socket_error_to_string(EVUTIL_SOCKET_ERROR()));
+	}
+}
+
+static void loadgen_stop(evutil_socket_t fd, short events, void *arg)
+{
+	loadgen_thread_t *t = (loadgen_thread_t *)arg;
+
+	t->stopping = 1;
+	event_base_loopbreak(t->eb);
+}
+
+static void *loadgen_thread(void *arg)
+{
+	loadgen_thread_t *t = (loadgen_thread_t *)arg;
+	loadgen_connection_t *c;
+	struct timeval tv = { config.duration, 0 };
+	SSL *ssl;
+	int i;
+
+	for (i = 0; i < t->connections; i++) {
+		c = &t->connection[i];
+		c->thread = t;
+		c->seed = (unsigned int)(uintptr_t)c ^ (unsigned int)time(NULL);
+		if ((c->sent = (uint64_t *)malloc(config.pipeline * sizeof(uint64_t))) == NULL) {
+			c->closed = 1;
+			t->failures++;
+			continue;
+		}
+		if (t->ssl_ctx) {
+			if ((ssl = SSL_new(t->ssl_ctx)) == NULL) {
+				c->closed = 1;
+				t->failures++;
+				continue;
+			}
+			c->be = bufferevent_openssl_socket_new(t->eb, -1, ssl, BUFFEREVENT_SSL_CONNECTING, BEV_OPT_CLOSE_ON_FREE);
+		} else
+			c->be = bufferevent_socket_new(t->eb, -1, BEV_OPT_CLOSE_ON_FREE);
+		if (c->be == NULL) {
+			c->closed = 1;
+			t->failures++;
+			continue;
+		}
+		bufferevent_setcb(c->be, loadgen_read, NULL, loadgen_event, c);
+		bufferevent_enable(c->be, EV_READ | EV_WRITE);
+		if (bufferevent_socket_connect(c->be, (struct sockaddr *)&t->target, t->targetlen) == -1)
+			loadgen_close(c, "failed to connect");
+	}
+
+	evtimer_add(t->timer, &tv);
+	event_base_dispatch(t->eb);
+
+	for (i = 0; i < t->connections; i++) {
+		loadgen_close(&t->connection[i], "stopped");
+		free(t->connection[i].sent);
+	}
+
+	return(NULL);
+}
+
+static void loadgen_run(const char *target, loadgen_result_t *r)
+{
+	loadgen_thread_t *t = (loadgen_thread_t *)malloc(config.threads * sizeof(loadgen_thread_t));
+	double percentile[4] = { 50.0, 90.0, 99.0, 99.9 };
+	stats_histogram_t *h;
+	uint64_t start, elapsed;
+	struct sockaddr_storage sa;
+	int salen = sizeof(sa), i, j, tls = (config.tls == 1);
+
+	memset(&sa, 0, sizeof(sa));
+	memset(r, 0, sizeof(loadgen_result_t));
+
+	if (strncmp(target, "tls://", 6) == 0) {
+		target += 6;
+		tls = 1;
+	}
+
+	if ((t == NULL) || (evutil_parse_sockaddr_port(target, (struct sockaddr *)&sa, &salen) == -1)) {
+		fprintf(stderr, "invalid target '%s'\n", target);
+		exit(1);
+	}
+
+	memset(t, 0, config.threads * sizeof(loadgen_thread_t));
+
+	for (i = 0; i < config.threads; i++) {
+		t[i].target = sa;
+		t[i].targetlen = salen;
+		t[i].ssl_ctx = (tls) ? config.ssl_ctx:NULL;
+		t[i].connections = config.connections / config.threads + ((i < config.connections % config.threads) ? 1:0);
+		t[i].connection = (loadgen_connection_t *)calloc(t[i].connections + 1, sizeof(loadgen_connection_t));
+		t[i].eb = event_base_new();
+		t[i].timer = (t[i].eb) ? evtimer_new(t[i].eb, loadgen_stop, &t[i]):NULL;
+		if ((t[i].connection == NULL) || (t[i].timer == NULL)) {
+			fprintf(stderr, "failed to initialize thread\n");
+			exit(1);
+		}
+	}
+
+	start = loadgen_clock();
+
+	for (i = 0; i < config.threads; i++)
+		pthread_create(&t[i].id, NULL, loadgen_thread, &t[i]);
+
+	for (i = 0; i < config.threads; i++)
+		pthread_join(t[i].id, NULL);
+
+	elapsed = loadgen_clock() - start;
+
+	/* NOTE: histograms of all threads are merged into the one of the first thread */
+	h = &t[0].histogram;
+
+	for (i = 0; i < config.threads; i++) {
+		r->requests += t[i].requests;
+		r->errors += t[i].errors;
+		r->failures += t[i].failures;
+		if (i > 0) {
+			for (j = 0; j < STATS_HISTOGRAM_BUCKETS; j++)
+				h->bucket[j] += t[i].histogram.bucket[j];
+			h->count += t[i].histogram.count;
+			h->sum += t[i].histogram.sum;
+			if (t[i].histogram.max > h->max)
+				h->max = t[i].histogram.max;
+		}
+	}
+
+	r->rps = (elapsed) ? r->requests * 1000000.0 / elapsed:0;
+	r->max = h->max;
+	r->avg = (h->count) ? h->sum / h->count:0;
+
+	for (i = 0; i < 4; i++)
+		r->percentile[i] = stats_histogram_percentile(h, percentile[i]);
+
+	for (i = 0; i < config.threads; i++) {
+		free(t[i].connection);
+		event_free(t[i].timer);
+		event_base_free(t[i].eb);
+	}
+
+	free(t);
+}
+
+/* stub backend, answers 'ping', 'get' (with a value of stub_value bytes) and anything
+   else with '+OK', so that it's never the bottleneck */
+
+static void loadgen_stub_read(struct bufferevent *be, void *arg)
+{
+	loadgen_stub_session_t *s = (loadgen_stub_session_t *)arg;
+	struct evbuffer *dst = bufferevent_get_output(be);
+	int i;
+
+	while ((i = resp_parse_buffer(&s->rs)) > 0) {
+		if (s->rs.pending_parts > 0)
+			continue;
+		if ((s->rs.cmdlen == 4) && (strncasecmp(s->rs.cmd, "ping", 4) == 0)) {
+			evbuffer_add(dst, "+PONG\r\n", 7);
+		} else if ((s->rs.cmdlen == 3) && (strncasecmp(s->rs.cmd, "get", 3) == 0)) {
+			evbuffer_add_printf(dst, "$%d\r\n", config.stub_value);
+			evbuffer_add(dst, config.value, config.stub_value);
+			evbuffer_add(dst, "\r\n", 2);
+		} else {
+			evbuffer_add(dst, "+OK\r\n", 5);
+		}
+	}
+
+	if (i == -1) {
+		bufferevent_free(be);
+		free(s);
+		return;
+	}
+
+	evbuffer_drain(s->rs.eb, s->rs.parsed);
+	s->rs.start -= s->rs.parsed;
+	s->rs.parsed = 0;
+}
+
+static void loadgen_stub_event(struct bufferevent *be, short events, void *arg)
+{
+	if (events & (BEV_EVENT_ERROR | BEV_EVENT_EOF)) {
+		bufferevent_free(be);
+		free(arg);
+	}
+}
+
+static void loadgen_stub_accept(struct evconnlistener *ecl, evutil_socket_t fd, struct sockaddr *address, int socklen, void *arg)
+{
+	loadgen_stub_t *stub = (loadgen_stub_t *)arg;
+	loadgen_stub_session_t *s = (loadgen_stub_session_t *)calloc(1, sizeof(loadgen_stub_session_t));
+
+	if ((s == NULL) || ((s->be = bufferevent_socket_new(stub->eb, fd, BEV_OPT_CLOSE_ON_FREE)) == NULL)) {
+		evutil_closesocket(fd);
+		free(s);
+		return;
+	}
+
+	s->rs.eb = bufferevent_get_input(s->be);
+	bufferevent_setcb(s->be, loadgen_stub_read, NULL, loadgen_stub_event, s);
+	bufferevent_enable(s->be, EV_READ | EV_WRITE);
+}
+
+static void *loadgen_stub_thread(void *arg)
+{
+	loadgen_stub_t *stub = (loadgen_stub_t *)arg;
+
+	event_base_dispatch(stub->eb);
+
+	return(NULL);
+}
+
+/* NOTE: each stub thread listens on the same port, kernel spreads connections among them */
+static void loadgen_stub_start(int threads)
+{
+	loadgen_stub_t *stub = (loadgen_stub_t *)calloc(threads, sizeof(loadgen_stub_t));
+	struct sockaddr_in sin;
+	int i;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(config.stub_port);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	for (i = 0; i < threads; i++) {
+		if ((stub == NULL) || ((stub[i].eb = event_base_new()) == NULL)) {
+			fprintf(stderr, "failed to initialize stub backend\n");
+			exit(1);
+		}
+		stub[i].ecl = evconnlistener_new_bind(stub[i].eb, loadgen_stub_accept, &stub[i], LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE | LEV_OPT_REUSEABLE_PORT, -1, (struct sockaddr *)&sin, sizeof(sin));
+		if (stub[i].ecl == NULL) {
+			fprintf(stderr, "failed to listen on 127.0.0.1:%d, %s\n", config.stub_port, strerror(errno));
+			exit(1);
+		}
+		pthread_create(&stub[i].id, NULL, loadgen_stub_thread, &stub[i]);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	loadgen_result_t result[LOADGEN_TARGET_MAX];
+	int a, i = 0, n;
+
+	struct option long_options[] = {
+		{"help", no_argument, 0, 'h'},
+		{"connections", required_argument, 0, 'c'},
+		{"threads", required_argument, 0, 't'},
+		{"pipeline", required_argument, 0, 'P'},
+		{"duration", required_argument, 0, 'd'},
+		{"mix", required_argument, 0, 'm'},
+		{"keys", required_argument, 0, 'k'},
+		{"value", required_argument, 0, 'v'},
+		{"auth", required_argument, 0, 'a'},
+		{"tls", no_argument, 0, 's'},
+		{"cert", required_argument, 0, 'C'},
+		{"key", required_argument, 0, 'K'},
+		{"stub", required_argument, 0, 'S'},
+		{"stub-value", required_argument, 0, 'V'},
+		{NULL, 0, 0, 0}
+	};
+
+	loadgen_mix("get:1");
+
+	while ((a = getopt_long(argc, argv, "hc:t:P:d:m:k:v:a:sC:K:S:V:", long_options, &i)) != -1)
+		switch (a) {
+		case 'c':
+			config.connections = atoi(optarg);
+			break;
+		case 't':
+			config.threads = atoi(optarg);
+			break;
+		case 'P':
+			config.pipeline = atoi(optarg);
+			break;
+		case 'd':
+			config.duration = atoi(optarg);
+			break;
+		case 'm':
+			if (loadgen_mix(optarg) == -1)
+				usage(argv[0]);
+			break;
+		case 'k':
+			config.keys = atoi(optarg);
+			break;
+		case 'v':
+			n = sscanf(optarg, "%d-%d", &config.value_min, &config.value_max);
+			if (n == 1)
+				config.value_max = config.value_min;
+			else if (n != 2)
+				usage(argv[0]);
+			break;
+		case 'a':
+			config.auth = optarg;
+			break;
+		case 's':
+			config.tls = 1;
+			break;
+		case 'C':
+			config.cert = optarg;
+			config.tls = 1;
+			break;
+		case 'K':
+			config.key = optarg;
+			break;
+		case 'S':
+			config.stub_port = atoi(optarg);
+			break;
+		case 'V':
+			config.stub_value = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			break;
+		}
+
+	if ((config.connections <= 0) || (config.threads <= 0) || (config.pipeline <= 0) || (config.duration <= 0) || (config.keys <= 0) ||
+	    (config.value_min < 0) || (config.value_max < config.value_min) || (config.stub_value < 0) || (argc - optind > LOADGEN_TARGET_MAX))
+		usage(argv[0]);
+
+	if ((optind == argc) && (config.stub_port == 0))
+		usage(argv[0]);
+
+	log_open(NULL, NULL);
+
+	n = (config.value_max > config.stub_value) ? config.value_max:config.stub_value;
+
+	if ((config.value = (char *)malloc(n + 1)) == NULL)
+		return(1);
+
+	memset(config.value, 'x', n);
+
+	for (i = optind; i < argc; i++)
+		if ((config.tls == 0) && (strncmp(argv[i], "tls://", 6) == 0))
+			config.tls = 2; // NOTE: TLS context is needed, but not for all targets
+
+	if (config.tls) {
+		SSL_library_init();
+		SSL_load_error_strings();
+		if ((config.ssl_ctx = SSL_CTX_new(SSLv23_client_method())) == NULL) {
+			fprintf(stderr, "failed to initialize TLS\n");
+			return(1);
+		}
+		if (config.cert && ((SSL_CTX_use_certificate_chain_file(config.ssl_ctx, config.cert) != 1) ||
+		    (SSL_CTX_use_PrivateKey_file(config.ssl_ctx, (config.key) ? config.key:config.cert, SSL_FILETYPE_PEM) != 1))) {
+			fprintf(stderr, "failed to load client certificate '%s'\n", config.cert);
+			return(1);
+		}
+	}
+
+	if (config.stub_port)
+		loadgen_stub_start(config.threads);
+
+	if (optind == argc) {
+		printf("stub backend listening on 127.0.0.1:%d\n", config.stub_port);
+		pause();
+		return(0);
+	}
+
+	printf("%d connections, %d threads, pipeline %d, %d s per target%s%s\n", config.connections, config.threads, config.pipeline, config.duration,
+		(config.tls == 1) ? ", TLS":"", (config.auth) ? ", auth":"");
+	printf("%-24s %12s %12s %8s %8s %8s %8s %8s %8s %8s %8s\n", "target", "requests", "req/s", "errors", "failed", "p50 us", "p90 us", "p99 us", "p99.9 us", "max us", "avg us");
+
+	for (n = 0; optind + n < argc; n++) {
+		loadgen_run(argv[optind + n], &result[n]);
+		printf("%-24s %12llu %12.0f %8llu %8llu %8llu %8llu %8llu %8llu %8llu %8llu\n", argv[optind + n],
+			(unsigned long long)result[n].requests, result[n].rps, (unsigned long long)result[n].errors, (unsigned long long)result[n].failures,
+			(unsigned long long)result[n].percentile[0], (unsigned long long)result[n].percentile[1],
+			(unsigned long long)result[n].percentile[2], (unsigned long long)result[n].percentile[3],
+			(unsigned long long)result[n].max, (unsigned long long)result[n].avg);
+		if ((n > 0) && (result[0].rps > 0))
+			printf("%-24s %12s %11.1f%% %8s %8s %+8lld %+8lld %+8lld %+8lld %8s %+8lld\n", "  vs first", "", 100.0 * result[n].rps / result[0].rps, "", "",
+				(long long)(result[n].percentile[0] - result[0].percentile[0]), (long long)(result[n].percentile[1] - result[0].percentile[1]),
+				(long long)(result[n].percentile[2] - result[0].percentile[2]), (long long)(result[n].percentile[3] - result[0].percentile[3]),
+				"", (long long)(result[n].avg - result[0].avg));
+	}
+
+	return(0);
+}
@@ -0,0 +1,662 @@
+/*
+   Copyright (c) 2018-2019, Seznam.cz, a.s.
+
+   Author: Daniel Bilik (daniel.bilik@firma.seznam.cz)
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+   PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+   BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+   POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <event.h>
+
+#include "log.h"
+#include "acl.h"
+#include "resp.h"
+#include "audit.h"
+#include "hotkeys.h"
+#include "pool.h"
+
+#define CHUNK 16384
+#define MB (1024.0 * 1024.0)
+
+typedef struct bench_s {
+	const char *name;
+	int ops;
+	long bytes;
+	void *(*setup)(struct bench_s *bench);
+	void (*run)(struct bench_s *bench, void *arg);
+	void (*teardown)(void *arg);
+	long param;
+} bench_t;
+
+typedef struct {
+	char *data;
+	long len;
+	struct evbuffer *src, *dst;
+	resp_buffer_t rs;
+} bench_resp_t;
+
+typedef struct {
+	hotkeys_t *hotkeys;
+	config_t config;
+	char **key;
+	int keys, next;
+} bench_hotkeys_t;
+
+typedef struct {
+	acl_t **acl;
+	char **needle;
+	int needles, next;
+} bench_acl_t;
+
+static unsigned long allocs;
+
+#ifdef __GLIBC__
+/* NOTE: interpose glibc allocator to count allocations done by code under test,
+         including those done inside libevent and libc itself (strndup etc.) */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+	allocs++;
+	return(__libc_malloc(size));
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	allocs++;
+	return(__libc_calloc(nmemb, size));
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	allocs++;
+	return(__libc_realloc(ptr, size));
+}
+#endif
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static void *xmalloc(size_t size)
+{
+	void *p = malloc(size);
+
+	if (p == NULL) {
+		fprintf(stderr, "malloc() failed, %s\n", strerror(errno));
+		exit(1);
+	}
+
+	return(p);
+}
+
+/* resp_parse_buffer() benchmarks, driven the same way session_client_read() does */
+
+static void *bench_resp_setup(bench_t *bench, int commands, long value)
+{
+	bench_resp_t *b = (bench_resp_t *)xmalloc(sizeof(bench_resp_t));
+	char *v = (char *)xmalloc(value + 1);
+	long i, len;
+
+	memset(v, 'x', value);
+	v[value] = '\0';
+
+	b->len = 0;
+	b->data = (char *)xmalloc(commands * (value + 64));
+
+	for (i = 0; i < commands; i++) {
+		len = sprintf(b->data + b->len, "*3\r\n$3\r\nSET\r\n$%d\r\nkey:%06ld\r\n$%ld\r\n", 10, i % 1000000, value);
+		b->len += len;
+		memcpy(b->data + b->len, v, value);
+		b->len += value;
+		memcpy(b->data + b->len, "\r\n", 2);
+		b->len += 2;
+	}
+
+	free(v);
+
+	b->src = evbuffer_new();
+	b->dst = evbuffer_new();
+
+	bench->ops = commands;
+	bench->bytes = b->len;
+
+	return(b);
+}
+
+static void *bench_resp_pipeline_setup(bench_t *bench)
+{
+	return(bench_resp_setup(bench, bench->param, 8));
+}
+
+static void *bench_resp_bulk_setup(bench_t *bench)
+{
+	return(bench_resp_setup(bench, 1, bench->param));
+}
+
+static void bench_resp_run(bench_t *bench, void *arg)
+{
+	bench_resp_t *b = (bench_resp_t *)arg;
+	long offset, len;
+	int i = 0;
+
+	memset(&b->rs, 0, sizeof(resp_buffer_t));
+	b->rs.eb = b->src;
+
+	for (offset = 0; offset < b->len; offset += len) {
+		len = (b->len - offset > CHUNK) ? CHUNK:(b->len - offset);
+		evbuffer_add(b->src, b->data + offset, len);
+		while ((i = resp_parse_buffer(&b->rs)) > 0)
+			;
+		if (i == -1) {
+			fprintf(stderr, "%s: resp_parse_buffer() failed\n", bench->name);
+			exit(1);
+		}
+		/* NOTE: like session_forward(), all commands parsed within a read are moved at once */
+		b->rs.parsed -= evbuffer_remove_buffer(b->src, b->dst, b->rs.parsed);
+		b->rs.start = 0;
+		evbuffer_drain(b->dst, evbuffer_get_length(b->dst));
+	}
+}
+
+static void *bench_reply_setup(bench_t *bench, int replies, long value)
+{
+	bench_resp_t *b = (bench_resp_t *)xmalloc(sizeof(bench_resp_t));
+	long i;
+
+	b->len = 0;
+	b->data = (char *)xmalloc(replies * (value + 64));
+
+	/* NOTE: mix of status, bulk and array replies, like a GET/SET/MGET heavy pipeline */
+	for (i = 0; i < replies; i++) {
+		switch (i % 3) {
+		case 0:
+			b->len += sprintf(b->data + b->len, "+OK\r\n");
+			break;
+		case 1:
+			b->len += sprintf(b->data + b->len, "$%ld\r\n", value);
+			memset(b->data + b->len, 'x', value);
+			b->len += value;
+			b->len += sprintf(b->data + b->len, "\r\n");
+			break;
+		case 2:
+			b->len += sprintf(b->data + b->len, "*2\r\n$-1\r\n:%ld\r\n", i);
+			break;
+		}
+	}
+
+	b->src = evbuffer_new();
+	b->dst = evbuffer_new();
+
+	bench->ops = replies;
+	bench->bytes = b->len;
+
+	return(b);
+}
+
+static void *bench_reply_pipeline_setup(bench_t *bench)
+{
+	return(bench_reply_setup(bench, bench->param, 8));
+}
+
+static void *bench_reply_bulk_setup(bench_t *bench)
+{
+	bench_resp_t *b = (bench_resp_t *)bench_reply_setup(bench, 2, bench->param);
+
+	bench->ops = 1;
+
+	return(b);
+}
+
+static void bench_reply_run(bench_t *bench, void *arg)
+{
+	bench_resp_t *b = (bench_resp_t *)arg;
+	resp_reply_t rr;
+	long offset, len;
+	int i = 0;
+
+	memset(&rr, 0, sizeof(resp_reply_t));
+
+	for (offset = 0; offset < b->len; offset += len) {
+		len = (b->len - offset > CHUNK) ? CHUNK:(b->len - offset);
+		evbuffer_add(b->src, b->data + offset, len);
+		while ((i = resp_parse_reply(&rr, b->src)) > 0);
+		if (i == -1) {
+			fprintf(stderr, "%s: resp_parse_reply() failed\n", bench->name);
+			exit(1);
+		}
+		evbuffer_remove_buffer(b->src, b->dst, rr.parsed);
+		rr.parsed = 0;
+		evbuffer_drain(b->dst, evbuffer_get_length(b->dst));
+	}
+}
+
+static void bench_resp_teardown(void *arg)
+{
+	bench_resp_t *b = (bench_resp_t *)arg;
+
+	evbuffer_free(b->src);
+	evbuffer_free(b->dst);
+	free(b->data);
+	free(b);
+}
+
+/* acl_match_*() benchmarks, needles alternate between the last entry (worst case hit) and a miss */
+
+static void *bench_acl_setup(bench_t *bench)
+{
+	bench_acl_t *b = (bench_acl_t *)xmalloc(sizeof(bench_acl_t));
+	char buf[64];
+	long i;
+
+	b->acl = (acl_t **)xmalloc((bench->param + 1) * sizeof(acl_t *));
+
+	for (i = 0; i < bench->param; i++) {
+		b->acl[i] = (acl_t *)xmalloc(sizeof(acl_t));
+		memset(b->acl[i], 0, sizeof(acl_t));
+		sprintf(buf, "acl-%ld", i);
+		b->acl[i]->id = strdup(buf);
+		sprintf(buf, "secret-%ld", i);
+		b->acl[i]->auth = strdup(buf);
+		sprintf(buf, "client-%ld.example.com", i);
+		b->acl[i]->cert = strdup(buf);
+		b->acl[i]->net = (acl_net_t *)xmalloc(2 * sizeof(acl_net_t));
+		memset(b->acl[i]->net, 0, 2 * sizeof(acl_net_t));
+		sprintf(buf, "10.%ld.%ld.0/24", (i >> 8) & 0xff, i & 0xff);
+		if (i & 1)
+			sprintf(buf, "fd00:%lx:%lx::/48", (i >> 16) & 0xffff, i & 0xffff);
+		if (acl_net_init(buf, b->acl[i]->net) == -1) {
+			fprintf(stderr, "%s: acl_net_init() failed for '%s'\n", bench->name, buf);
+			exit(1);
+		}
+	}
+
+	b->acl[bench->param] = NULL;
+
+	b->needles = 2;
+	b->next = 0;
+	b->needle = (char **)xmalloc(b->needles * sizeof(char *));
+
+	i = bench->param - 1;
+
+	if (strstr(bench->name, "/net/")) {
+		sprintf(buf, (i & 1) ? "fd00:%lx:%lx::1":"10.%ld.%ld.1", (i & 1) ? (i >> 16) & 0xffff:(i >> 8) & 0xff, (i & 1) ? i & 0xffff:i & 0xff);
+		b->needle[0] = strdup(buf);
+		b->needle[1] = strdup("192.168.1.1");
+	} else if (strstr(bench->name, "/auth/")) {
+		sprintf(buf, "secret-%ld", i);
+		b->needle[0] = strdup(buf);
+		b->needle[1] = strdup("secret-none");
+	} else {
+		sprintf(buf, "client-%ld.example.com", i);
+		b->needle[0] = strdup(buf);
+		b->needle[1] = strdup("client-none.example.com");
+	}
+
+	bench->ops = 1;
+	bench->bytes = 0;
+
+	return(b);
+}
+
+static void bench_acl_net_run(bench_t *bench, void *arg)
+{
+	bench_acl_t *b = (bench_acl_t *)arg;
+
+	acl_match_net(b->acl, b->needle[b->next++ % b->needles]);
+}
+
+static void bench_acl_auth_run(bench_t *bench, void *arg)
+{
+	bench_acl_t *b = (bench_acl_t *)arg;
+
+	acl_match_auth(b->acl, b->needle[b->next++ % b->needles]);
+}
+
+static void bench_acl_cert_run(bench_t *bench, void *arg)
+{
+	bench_acl_t *b = (bench_acl_t *)arg;
+
+	acl_match_cert(b->acl, b->needle[b->next++ % b->needles]);
+}
+
+static void bench_acl_teardown(void *arg)
+{
+	bench_acl_t *b = (bench_acl_t *)arg;
+	acl_t **a;
+	int i;
+
+	for (a = b->acl; *a; a++) {
+		free((char *)(*a)->id);
+		free((char *)(*a)->auth);
+		free((char *)(*a)->cert);
+		free((*a)->net);
+		free(*a);
+	}
+
+	for (i = 0; i < b->needles; i++)
+		free(b->needle[i]);
+
+	free(b->needle);
+	free(b->acl);
+	free(b);
+}
+
+/* log_write() benchmarks, an enabled debug message like the per-command one and a masked one */
+
+static void *bench_log_setup(bench_t *bench)
+{
+	if (log_open("/dev/null", bench->param ? "ALL":"E9W4I2D0F9") == -1) {
+		fprintf(stderr, "%s: log_open() failed, %s\n", bench->name, strerror(errno));
+		exit(1);
+	}
+
+	bench->ops = 1;
+	bench->bytes = 0;
+
+	return(NULL);
+}
+
+static void bench_log_run(bench_t *bench, void *arg)
+{
+	LOG(D1, "command '%s' from client %s %s using acl '%s'", "set", "10.0.0.1", "allowed", "incoming");
+}
+
+static void bench_log_teardown(void *arg)
+{
+	log_close();
+}
+
+/* audit_record() benchmark, a command recorded into segments in /tmp (rotated over and over) */
+
+static void *bench_audit_setup(bench_t *bench)
+{
+	char path[64];
+	audit_t *audit;
+
+	snprintf(path, sizeof(path), "/tmp/proxis-microbench-audit.%d", (int)getpid());
+
+	if ((audit = audit_create(path, 1048576, 2, NULL)) == NULL) {
+		fprintf(stderr, "%s: audit_create() failed\n", bench->name);
+		exit(1);
+	}
+
+	bench->ops = 1;
+	bench->bytes = 0;
+
+	return(audit);
+}
+
+static void bench_audit_run(bench_t *bench, void *arg)
+{
+	audit_record((audit_t *)arg, 1, NULL, 1, AUDIT_ALLOWED, "user:1000", 9, 31);
+}
+
+static void bench_audit_teardown(void *arg)
+{
+	audit_t *audit = (audit_t *)arg;
+	char path[64];
+	int i;
+
+	for (i = 0; i < audit->segments; i++) {
+		snprintf(path, sizeof(path), "/tmp/proxis-microbench-audit.%d.%d", (int)getpid(), i);
+		unlink(path);
+	}
+
+	audit_destroy(audit);
+}
+
+/* hotkeys_sample() benchmarks, keys are skewed (half of commands hit 1% of them), one
+   of param commands is sampled */
+
+#define BENCH_HOTKEYS_KEYS 4096
+
+static void *bench_hotkeys_setup(bench_t *bench)
+{
+	bench_hotkeys_t *b = (bench_hotkeys_t *)xmalloc(sizeof(bench_hotkeys_t));
+	config_setting_t *s;
+	char buf[64];
+	int i;
+
+	config_init(&b->config);
+	s = config_setting_add(config_root_setting(&b->config), "hotkeys", CONFIG_TYPE_GROUP);
+	config_setting_set_int(config_setting_add(s, "sample", CONFIG_TYPE_INT), bench->param);
+
+	if ((b->hotkeys = hotkeys_create(s, 0)) == NULL) {
+		fprintf(stderr, "%s: hotkeys_create() failed\n", bench->name);
+		exit(1);
+	}
+
+	b->keys = BENCH_HOTKEYS_KEYS;
+	b->next = 0;
+	b->key = (char **)xmalloc(b->keys * sizeof(char *));
+
+	for (i = 0; i < b->keys; i++) {
+		sprintf(buf, "user:%d:profile", (i & 1) ? i % (BENCH_HOTKEYS_KEYS / 100):i);
+		b->key[i] = strdup(buf);
+	}
+
+	bench->ops = 1;
+	bench->bytes = 0;
+
+	return(b);
+}
+
+static void bench_hotkeys_run(bench_t *bench, void *arg)
+{
+	bench_hotkeys_t *b = (bench_hotkeys_t *)arg;
+	const char *key = b->key[b->next++ % b->keys];
+
+	hotkeys_sample(b->hotkeys, key, strlen(key), NULL);
+}
+
+static void bench_hotkeys_teardown(void *arg)
+{
+	bench_hotkeys_t *b = (bench_hotkeys_t *)arg;
+	int i;
+
+	for (i = 0; i < b->keys; i++)
+		free(b->key[i]);
+	free(b->key);
+
+	hotkeys_destroy(b->hotkeys);
+	config_destroy(&b->config);
+	free(b);
+}
+
+/* session allocation benchmarks, malloc()+free() of a session sized object compared to a pool */
+
+#define BENCH_SESSION_SIZE 1024
+
+static void *bench_alloc_setup(bench_t *bench)
+{
+	pool_t *pool = NULL;
+
+	if (bench->param && ((pool = pool_create(BENCH_SESSION_SIZE)) == NULL)) {
+		fprintf(stderr, "%s: pool_create() failed\n", bench->name);
+		exit(1);
+	}
+
+	bench->ops = 1;
+	bench->bytes = 0;
+
+	return(pool);
+}
+
+static void bench_alloc_malloc_run(bench_t *bench, void *arg)
+{
+	free(xmalloc(BENCH_SESSION_SIZE));
+}
+
+static void bench_alloc_pool_run(bench_t *bench, void *arg)
+{
+	pool_put((pool_t *)arg, pool_get((pool_t *)arg));
+}
+
+static void bench_alloc_teardown(void *arg)
+{
+	pool_destroy((pool_t *)arg, NULL);
+}
+
+#define BENCH_RESP_PIPELINE(n) { "resp_parse/pipeline/" #n, 0, 0, bench_resp_pipeline_setup, bench_resp_run, bench_resp_teardown, n }
+#define BENCH_RESP_BULK(name, n) { "resp_parse/bulk/" name, 0, 0, bench_resp_bulk_setup, bench_resp_run, bench_resp_teardown, n }
+#define BENCH_REPLY_PIPELINE(n) { "resp_reply/pipeline/" #n, 0, 0, bench_reply_pipeline_setup, bench_reply_run, bench_resp_teardown, n }
+#define BENCH_REPLY_BULK(name, n) { "resp_reply/bulk/" name, 0, 0, bench_reply_bulk_setup, bench_reply_run, bench_resp_teardown, n }
+#define BENCH_ACL(what, n) { "acl_match/" #what "/" #n, 0, 0, bench_acl_setup, bench_acl_##what##_run, bench_acl_teardown, n }
+
+bench_t benchmarks[] = {
+	BENCH_RESP_PIPELINE(1),
+	BENCH_RESP_PIPELINE(10),
+	BENCH_RESP_PIPELINE(100),
+	BENCH_RESP_PIPELINE(1000),
+	BENCH_RESP_PIPELINE(10000),
+	BENCH_RESP_BULK("1B", 1),
+	BENCH_RESP_BULK("1KB", 1024),
+	BENCH_RESP_BULK("64KB", 65536),
+	BENCH_RESP_BULK("1MB", 1048576),
+	BENCH_RESP_BULK("16MB", 16777216),
+	BENCH_REPLY_PIPELINE(1),
+	BENCH_REPLY_PIPELINE(100),
+	BENCH_REPLY_PIPELINE(10000),
+	BENCH_REPLY_BULK("1KB", 1024),
+	BENCH_REPLY_BULK("1MB", 1048576),
+	BENCH_REPLY_BULK("16MB", 16777216),
+	BENCH_ACL(net, 10),
+	BENCH_ACL(net, 1000),
+	BENCH_ACL(net, 10000),
+	BENCH_ACL(net, 100000),
+	BENCH_ACL(auth, 10),
+	BENCH_ACL(auth, 1000),
+	BENCH_ACL(auth, 10000),
+	BENCH_ACL(auth, 100000),
+	BENCH_ACL(cert, 10),
+	BENCH_ACL(cert, 1000),
+	BENCH_ACL(cert, 10000),
+	BENCH_ACL(cert, 100000),
+	{ "log_write/enabled", 0, 0, bench_log_setup, bench_log_run, bench_log_teardown, 1 },
+	{ "log_write/masked", 0, 0, bench_log_setup, bench_log_run, bench_log_teardown, 0 },
+	{ "audit_record", 0, 0, bench_audit_setup, bench_audit_run, bench_audit_teardown, 0 },
+	{ "hotkeys_sample/1", 0, 0, bench_hotkeys_setup, bench_hotkeys_run, bench_hotkeys_teardown, 1 },
+	{ "hotkeys_sample/16", 0, 0, bench_hotkeys_setup, bench_hotkeys_run, bench_hotkeys_teardown, 16 },
+	{ "session_alloc/malloc", 0, 0, bench_alloc_setup, bench_alloc_malloc_run, bench_alloc_teardown, 0 },
+	{ "session_alloc/pool", 0, 0, bench_alloc_setup, bench_alloc_pool_run, bench_alloc_teardown, 1 },
+	{ NULL, 0, 0, NULL, NULL, NULL, 0 }
+};
+
+void usage(char *command)
+{
+	printf("Usage: %s [options] [filter]\n\n", command);
+	printf("Options:\n");
+	printf("  -h --help           Print this help\n");
+	printf("  -l --list           List available benchmarks\n");
+	printf("  -t --time seconds   Minimal time spent in each benchmark (default 1)\n");
+	printf("\n");
+	printf("Only benchmarks containing filter in their name are run, when given.\n");
+	printf("\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int a, i = 0, list = 0;
+	long iterations, n;
+	unsigned long allocated;
+	double t, elapsed, min_time = 1.0;
+	void *arg;
+	bench_t *b;
+
+	struct option long_options[] = {
+		{"help", no_argument, 0, 'h'},
+		{"list", no_argument, 0, 'l'},
+		{"time", required_argument, 0, 't'},
+		{NULL, 0, 0, 0}
+	};
+
+	while ((a = getopt_long(argc, argv, "hlt:", long_options, &i)) != -1)
+		switch (a) {
+		case 'l':
+			list = 1;
+			break;
+		case 't':
+			if (sscanf(optarg, "%lf", &min_time) != 1)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+			break;
+		}
+
+	if (!list)
+		printf("%-28s %10s %14s %12s %12s %14s\n", "benchmark", "iterations", "ns/op", "allocs/op", "MB/s", "ops/s");
+
+	for (b = benchmarks; b->name; b++) {
+		if ((optind < argc) && (strstr(b->name, argv[optind]) == NULL))
+			continue;
+		if (list) {
+			printf("%s\n", b->name);
+			continue;
+		}
+		arg = b->setup(b);
+		b->run(b, arg);
+		iterations = 0;
+		allocated = allocs;
+		elapsed = 0;
+		/* NOTE: grow batches geometrically, so that timer overhead doesn't skew fast benchmarks */
+		for (n = 1; elapsed < min_time; n = (n < (1 << 20)) ? n * 2:n) {
+			t = now();
+			for (i = 0; i < n; i++)
+				b->run(b, arg);
+			elapsed += now() - t;
+			iterations += n;
+		}
+		allocated = allocs - allocated;
+		printf("%-28s %10ld %14.1f %12.2f ", b->name, iterations,
+			elapsed * 1e9 / (iterations * b->ops),
+			(double)allocated / (iterations * b->ops));
+		if (b->bytes > 0)
+			printf("%12.1f ", b->bytes * iterations / elapsed / MB);
+		else
+			printf("%12s ", "-");
+		printf("%14.0f\n", iterations * b->ops / elapsed);
+		fflush(stdout);
+		b->teardown(arg);
+	}
+
+	return(0);
+}
@@ -108,6 +108,24 @@ acl_t *acl_create(config_setting_t *config)
 
 	config_setting_lookup_string(config, "cert", &acl->cert);
 
+	/* NOTE: see 'read_quantum' of a proxy */
+	acl->weight = 1;
+
+	config_setting_lookup_int(config, "weight", &acl->weight);
+
+	if ((acl->weight < 1) || (acl->weight > ACL_WEIGHT_MAX)) {
+		LOG(E1, "invalid 'weight' for acl '%s'", acl->id);
+		return(NULL);
+	}
+
+	/* NOTE: 0 means replies of any size are passed */
+	config_setting_lookup_int64(config, "max_reply_bytes", &acl->max_reply_bytes);
+
+	if (acl->max_reply_bytes < 0) {
+		LOG(E1, "invalid 'max_reply_bytes' for acl '%s'", acl->id);
+		return(NULL);
+	}
+
 	s = config_setting_get_member(config, "net");
 
 	a = ((s != NULL) && (config_setting_is_array(s) == CONFIG_TRUE)) ? config_setting_length(s):0;
@@ -169,6 +187,7 @@ void acl_destroy(acl_t *acl)
 	free(acl->net);
 	free(acl->allow);
 	free(acl->deny);
+	stats_histogram_destroy(acl->latency);
 	free(acl);
 }
 
@@ -4,6 +4,10 @@
 #include <netinet/in.h>
 #include <libconfig.h>
 
+#include "stats.h"
+
+#define ACL_WEIGHT_MAX 1000
+
 typedef uint32_t acl_network_t[4];
 
 typedef struct {
@@ -19,8 +23,13 @@ typedef struct {
 	acl_net_t *net;
 	const char **allow;
 	const char **deny;
+	stats_histogram_t *latency;
+	int index;
+	int weight;
+	long long max_reply_bytes;
 } acl_t;
 
+int acl_net_init(const char *cidr, acl_net_t *dst);
 acl_t *acl_create(config_setting_t *config);
 void acl_destroy(acl_t *acl);
 acl_t *acl_match_net(acl_t **acl, char *address);
@@ -0,0 +1,585 @@
+/*
+   Copyright (c) 2018-2019, Seznam.cz, a.s.
+
+   Author: Daniel Bilik (daniel.bilik@firma.seznam.cz)
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+   PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+   BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+   POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <openssl/ssl.h>
+#include <event.h>
+#include <event2/util.h>
+#include <event2/bufferevent.h>
+#include <event2/listener.h>
+
+#include "log.h"
+#include "acl.h"
+#include "proxy.h"
+#include "resp.h"
+#include "worker.h"
+#include "cmd.h"
+#include "stats.h"
+#include "cache.h"
+#include "slowlog.h"
+#include "hotkeys.h"
+#include "admin.h"
+#include "upgrade.h"
+
+#define ADMIN_SLOWLOG_GET 10 // default number of entries returned by 'slowlog get'
+#define ADMIN_HOTKEYS 10 // default number of entries returned by 'hotkeys'
+
+#define ADMIN_IS(s, name) (((s)->rs.cmdlen == strlen(name)) && (strncasecmp((s)->rs.cmd, (name), (s)->rs.cmdlen) == 0))
+
+void admin_session_destroy(admin_session_t *session)
+{
+	bufferevent_free(session->be);
+	free(session);
+}
+
+/* NOTE: counters of ACLs are kept by each proxy separately, they're summed up here */
+void admin_info_acl(admin_t *admin, struct evbuffer *eb)
+{
+	uint64_t sessions, allowed, blocked, yields, oversized;
+	proxy_t **p;
+	int i;
+
+	evbuffer_add_printf(eb, "# Acl\r\n");
+
+	for (i = 0; admin->acl[i]; i++) {
+		sessions = allowed = blocked = yields = oversized = 0;
+		for (p = admin->proxy; *p; p++) {
+			sessions += STATS_GET((*p)->counters->acl[i].sessions);
+			allowed += STATS_GET((*p)->counters->acl[i].allowed);
+			blocked += STATS_GET((*p)->counters->acl[i].blocked);
+			yields += STATS_GET((*p)->counters->acl[i].yields);
+			oversized += STATS_GET((*p)->counters->acl[i].oversized);
+		}
+		evbuffer_add_printf(eb, "acl_%s:sessions=%llu,allowed=%llu,blocked=%llu,yields=%llu,oversized=%llu\r\n", admin->acl[i]->id,
+			(unsigned long long)sessions, (unsigned long long)allowed, (unsigned long long)blocked, (unsigned long long)yields, (unsigned long long)oversized);
+	}
+}
+
+void admin_info_proxy(proxy_t *proxy, acl_t **acl, struct evbuffer *eb)
+{
+	stats_counters_t *c = proxy->counters;
+	uint64_t allowed, blocked;
+	int i;
+
+	evbuffer_add_printf(eb, "# Proxy %s\r\n", proxy->name);
+	evbuffer_add_printf(eb, "event_method:%s\r\n", event_base_get_method(proxy->eb));
+	evbuffer_add_printf(eb, "sessions:%llu\r\n", (unsigned long long)STATS_GET(c->sessions));
+	evbuffer_add_printf(eb, "sessions_total:%llu\r\n", (unsigned long long)STATS_GET(c->sessions_total));
+	evbuffer_add_printf(eb, "client_bytes_in:%llu\r\n", (unsigned long long)STATS_GET(c->client_in));
+	evbuffer_add_printf(eb, "client_bytes_out:%llu\r\n", (unsigned long long)STATS_GET(c->client_out));
+	evbuffer_add_printf(eb, "server_bytes_in:%llu\r\n", (unsigned long long)STATS_GET(c->server_in));
+	evbuffer_add_printf(eb, "server_bytes_out:%llu\r\n", (unsigned long long)STATS_GET(c->server_out));
+	evbuffer_add_printf(eb, "server_connect_failures:%llu\r\n", (unsigned long long)STATS_GET(c->connect_failures));
+	evbuffer_add_printf(eb, "server_auth_failures:%llu\r\n", (unsigned long long)STATS_GET(c->server_auth_failures));
+	evbuffer_add_printf(eb, "client_auth_ok:%llu\r\n", (unsigned long long)STATS_GET(c->auth_ok));
+	evbuffer_add_printf(eb, "client_auth_failed:%llu\r\n", (unsigned long long)STATS_GET(c->auth_failed));
+	evbuffer_add_printf(eb, "client_idle_timeouts:%llu\r\n", (unsigned long long)STATS_GET(c->idle_timeouts));
+	evbuffer_add_printf(eb, "session_lifetime_expirations:%llu\r\n", (unsigned long long)STATS_GET(c->lifetime_expirations));
+	evbuffer_add_printf(eb, "server_connecting:%llu\r\n", (unsigned long long)STATS_GET(c->connecting));
+	evbuffer_add_printf(eb, "server_connect_queue:%llu\r\n", (unsigned long long)STATS_GET(c->connect_queued));
+	evbuffer_add_printf(eb, "rejected_connections:%llu\r\n", (unsigned long long)STATS_GET(c->rejected));
+	evbuffer_add_printf(eb, "accept_pauses:%llu\r\n", (unsigned long long)STATS_GET(c->accept_pauses));
+	evbuffer_add_printf(eb, "read_yields:%llu\r\n", (unsigned long long)STATS_GET(c->read_yields));
+	evbuffer_add_printf(eb, "accept_paused:%d\r\n", (__atomic_load_n(&proxy->paused, __ATOMIC_RELAXED) != 0));
+	evbuffer_add_printf(eb, "session_pool:slabs=%llu,used=%llu,free=%llu,gets=%llu\r\n",
+		(unsigned long long)STATS_GET(proxy->pool->slabs),
+		(unsigned long long)STATS_GET(proxy->pool->used),
+		(unsigned long long)STATS_GET(proxy->pool->available),
+		(unsigned long long)STATS_GET(proxy->pool->gets));
+
+	if (proxy->cache) {
+		evbuffer_add_printf(eb, "cache_hits:%llu\r\n", (unsigned long long)STATS_GET(proxy->cache->hits));
+		evbuffer_add_printf(eb, "cache_misses:%llu\r\n", (unsigned long long)STATS_GET(proxy->cache->misses));
+		evbuffer_add_printf(eb, "cache_merges:%llu\r\n", (unsigned long long)STATS_GET(proxy->cache->merges));
+		evbuffer_add_printf(eb, "cache_fills:%llu\r\n", (unsigned long long)STATS_GET(proxy->cache->fills));
+		evbuffer_add_printf(eb, "cache_invalidations:%llu\r\n", (unsigned long long)STATS_GET(proxy->cache->invalidations));
+	}
+
+	if (proxy->pubsub) {
+		evbuffer_add_printf(eb, "pubsub_channels:%llu\r\n", (unsigned long long)STATS_GET(proxy->pubsub->channels));
+		evbuffer_add_printf(eb, "pubsub_messages:%llu\r\n", (unsigned long long)STATS_GET(proxy->pubsub->messages));
+		evbuffer_add_printf(eb, "pubsub_deliveries:%llu\r\n", (unsigned long long)STATS_GET(proxy->pubsub->deliveries));
+	}
+
+	if (proxy->shadow) {
+		evbuffer_add_printf(eb, "shadow_mirrored:%llu\r\n", (unsigned long long)STATS_GET(proxy->shadow->mirrored));
+		evbuffer_add_printf(eb, "shadow_dropped:%llu\r\n", (unsigned long long)STATS_GET(proxy->shadow->dropped));
+		evbuffer_add_printf(eb, "shadow_bytes:%llu\r\n", (unsigned long long)STATS_GET(proxy->shadow->bytes));
+		evbuffer_add_printf(eb, "shadow_errors:%llu\r\n", (unsigned long long)STATS_GET(proxy->shadow->errors));
+		evbuffer_add_printf(eb, "shadow_connected:%d\r\n", __atomic_load_n(&proxy->shadow->ready, __ATOMIC_RELAXED));
+	}
+
+	if (proxy->hotkeys)
+		evbuffer_add_printf(eb, "hotkeys_sampled:%llu\r\n", (unsigned long long)STATS_GET(proxy->hotkeys->sampled));
+
+	for (i = 0; i < cmd_count; i++) {
+		allowed = STATS_GET(c->command[i].allowed);
+		blocked = STATS_GET(c->command[i].blocked);
+		if (allowed || blocked)
+			evbuffer_add_printf(eb, "cmdstat_%s:allowed=%llu,blocked=%llu\r\n", cmd_table[i].name, (unsigned long long)allowed, (unsigned long long)blocked);
+	}
+
+	for (i = 0; acl[i]; i++) {
+		if (STATS_GET(c->acl[i].sessions) == 0)
+			continue;
+		evbuffer_add_printf(eb, "acl_%s:sessions=%llu,allowed=%llu,blocked=%llu,yields=%llu,oversized=%llu\r\n", acl[i]->id,
+			(unsigned long long)STATS_GET(c->acl[i].sessions),
+			(unsigned long long)STATS_GET(c->acl[i].allowed),
+			(unsigned long long)STATS_GET(c->acl[i].blocked),
+			(unsigned long long)STATS_GET(c->acl[i].yields),
+			(unsigned long long)STATS_GET(c->acl[i].oversized));
+	}
+}
+
+/* NOTE: 'info' replies with a bulk string of 'name:value' lines grouped into sections,
+         like redis does, optional argument picks sections ('proxy', 'log' or 'acl') */
+int admin_info(admin_session_t *session)
+{
+	admin_t *admin = session->admin;
+	struct evbuffer *eb = evbuffer_new(), *dst = bufferevent_get_output(session->be);
+	const char *section = (session->rs.arglen > 0) ? session->rs.arg:NULL;
+	proxy_t **p;
+	int rc;
+
+	if (eb == NULL)
+		return(-1);
+
+	for (p = admin->proxy; *p; p++) {
+		if (section && strcasecmp(section, "proxy"))
+			break;
+		admin_info_proxy(*p, admin->acl, eb);
+		evbuffer_add_printf(eb, "\r\n");
+	}
+
+	if ((section == NULL) || (strcasecmp(section, "log") == 0))
+		evbuffer_add_printf(eb, "# Log\r\nlog_dropped:%llu\r\n\r\n", (unsigned long long)log_dropped());
+
+	if ((section == NULL) || (strcasecmp(section, "acl") == 0))
+		admin_info_acl(admin, eb);
+
+	rc = evbuffer_add_printf(dst, "$%lu\r\n", (unsigned long)evbuffer_get_length(eb));
+
+	if ((rc != -1) && ((rc = evbuffer_add_buffer(dst, eb)) == 0))
+		rc = evbuffer_add(dst, "\r\n", 2);
+
+	evbuffer_free(eb);
+
+	return(rc);
+}
+
+int admin_slowlog_compare(const void *a, const void *b)
+{
+	const admin_slowlog_t *x = (const admin_slowlog_t *)a, *y = (const admin_slowlog_t *)b;
+
+	return((x->entry.received < y->entry.received) ? 1:((x->entry.received > y->entry.received) ? -1:0));
+}
+
+/* NOTE: entries of all proxies are merged, the most recent first, each one is
+         [id, sent, received, duration, [command, argument], client, acl, proxy, backend]
+         with timestamps in microseconds */
+int admin_slowlog_get(admin_session_t *session, int count)
+{
+	struct evbuffer *dst = bufferevent_get_output(session->be);
+	slowlog_entry_t *entry = NULL, *e;
+	admin_slowlog_t *log;
+	proxy_t **p;
+	int i, n = 0, len, total = 0, rc = 0;
+
+	for (p = session->admin->proxy; *p; p++)
+		if ((*p)->slowlog)
+			total += (*p)->slowlog->size;
+
+	if (((log = (admin_slowlog_t *)malloc((total + 1) * sizeof(admin_slowlog_t))) == NULL) || ((entry = (slowlog_entry_t *)malloc((total + 1) * sizeof(slowlog_entry_t))) == NULL)) {
+		free(log);
+		return(-1);
+	}
+
+	for (p = session->admin->proxy; *p; p++) {
+		if ((*p)->slowlog == NULL)
+			continue;
+		len = slowlog_read((*p)->slowlog, entry, (*p)->slowlog->size);
+		for (i = 0; i < len; i++, n++) {
+			log[n].entry = entry[i];
+			log[n].proxy = *p;
+		}
+	}
+
+	qsort(log, n, sizeof(admin_slowlog_t), admin_slowlog_compare);
+
+	if ((count < 0) || (count > n))
+		count = n;
+
+	evbuffer_add_printf(dst, "*%d\r\n", count);
+
+	for (i = 0; (i < count) && (rc != -1); i++) {
+		e = &log[i].entry;
+		len = (e->arglen < SLOWLOG_ARG_MAX) ? e->arglen:SLOWLOG_ARG_MAX;
+		evbuffer_add_printf(dst, "*9\r\n:%llu\r\n:%llu\r\n:%llu\r\n:%llu\r\n", (unsigned long long)e->id,
+			(unsigned long long)e->sent, (unsigned long long)e->received, (unsigned long long)(e->received - e->sent));
+		/* NOTE: like redis does, truncated argument is marked and the rest of them counted,
+		         argument is binary, it may contain NUL */
+		evbuffer_add_printf(dst, "*%d\r\n$%d\r\n%s\r\n", (e->args > 1) ? 3:e->args + 1, (int)strlen(cmd_table[e->cmd].name), cmd_table[e->cmd].name);
+		if (e->args > 0) {
+			evbuffer_add_printf(dst, "$%d\r\n", len + ((e->arglen > len) ? 3:0));
+			evbuffer_add(dst, e->arg, len);
+			evbuffer_add_printf(dst, "%s\r\n", (e->arglen > len) ? "...":"");
+		}
+		if (e->args > 1)
+			evbuffer_add_printf(dst, "+... (%d more arguments)\r\n", e->args - 1);
+		evbuffer_add_printf(dst, "$%d\r\n%s\r\n", (int)strlen(e->client), e->client);
+		evbuffer_add_printf(dst, "$%d\r\n%s\r\n", (e->acl) ? (int)strlen(e->acl):0, (e->acl) ? e->acl:"");
+		evbuffer_add_printf(dst, "$%d\r\n%s\r\n", (int)strlen(log[i].proxy->name), log[i].proxy->name);
+		rc = evbuffer_add_printf(dst, "$%d\r\n%s\r\n", (int)strlen(log[i].proxy->backend.remote.address), log[i].proxy->backend.remote.address);
+	}
+
+	free(entry);
+	free(log);
+
+	return((rc == -1) ? -1:0);
+}
+
+/* NOTE: 'slowlog get [count]', 'slowlog len' and 'slowlog reset', as in redis */
+int admin_slowlog(admin_session_t *session)
+{
+	struct evbuffer *dst = bufferevent_get_output(session->be);
+	const char *sub = session->rs.arg;
+	char *count, value[32];
+	proxy_t **p;
+	int n = 0;
+
+	if (session->rs.arglen <= 0)
+		return(evbuffer_add_printf(dst, "-ERR wrong number of arguments for 'slowlog' command\r\n"));
+
+	if (strcasecmp(sub, "get") == 0) {
+		n = ADMIN_SLOWLOG_GET;
+		if ((session->rs.parts == 3) && ((count = resp_get_last_value(&session->rs, value, sizeof(value))) != NULL)) {
+			n = atoi(count);
+			if (count != value)
+				free(count);
+		}
+		return(admin_slowlog_get(session, n));
+	}
+
+	if (strcasecmp(sub, "len") == 0) {
+		for (p = session->admin->proxy; *p; p++)
+			if ((*p)->slowlog)
+				n += slowlog_length((*p)->slowlog);
+		return(evbuffer_add_printf(dst, ":%d\r\n", n));
+	}
+
+	if (strcasecmp(sub, "reset") == 0) {
+		for (p = session->admin->proxy; *p; p++)
+			if ((*p)->slowlog)
+				slowlog_reset((*p)->slowlog);
+		return(evbuffer_add(dst, "+OK\r\n", 5));
+	}
+
+	return(evbuffer_add_printf(dst, "-ERR unknown subcommand '%s'\r\n", sub));
+}
+
+int admin_hotkeys_compare(const void *a, const void *b)
+{
+	const admin_hotkeys_t *x = (const admin_hotkeys_t *)a, *y = (const admin_hotkeys_t *)b;
+
+	return((x->entry.count < y->entry.count) ? 1:((x->entry.count > y->entry.count) ? -1:0));
+}
+
+/* NOTE: 'hotkeys [count]', entries of all proxies are merged, the hottest first, each one
+         is [key, commands, [acl, commands, ...], proxy] with number of commands estimated
+         over the last window (samples taken times 'sample'), acl is empty for sessions
+         not using any */
+int admin_hotkeys(admin_session_t *session)
+{
+	struct evbuffer *dst = bufferevent_get_output(session->be);
+	hotkeys_entry_t *entry = NULL, *e;
+	admin_hotkeys_t *hot;
+	uint32_t *hits = NULL, *h;
+	proxy_t **p;
+	char *count, value[32];
+	const char *name;
+	int i, j, k, n = 0, len, acls = 0, total = 0, rc = 0;
+
+	count = (session->rs.parts == 2) ? resp_get_last_value(&session->rs, value, sizeof(value)):NULL;
+	k = (count) ? atoi(count):ADMIN_HOTKEYS;
+	if (count && (count != value))
+		free(count);
+
+	for (p = session->admin->proxy; *p; p++) {
+		if ((*p)->hotkeys) {
+			total += (*p)->hotkeys->top;
+			acls = (*p)->hotkeys->acls + 1;
+		}
+	}
+
+	if (((hot = (admin_hotkeys_t *)malloc((total + 1) * sizeof(admin_hotkeys_t))) == NULL) ||
+		((entry = (hotkeys_entry_t *)malloc((total + 1) * sizeof(hotkeys_entry_t))) == NULL) ||
+		((hits = (uint32_t *)malloc((total + 1) * (acls + 1) * sizeof(uint32_t))) == NULL)) {
+		free(entry);
+		free(hot);
+		return(-1);
+	}
+
+	for (p = session->admin->proxy; *p; p++) {
+		if ((*p)->hotkeys == NULL)
+			continue;
+		len = hotkeys_read((*p)->hotkeys, &entry[n], &hits[n * acls]);
+		for (i = 0; i < len; i++, n++) {
+			hot[n].entry = entry[n];
+			hot[n].hits = &hits[n * acls];
+			hot[n].proxy = *p;
+		}
+	}
+
+	qsort(hot, n, sizeof(admin_hotkeys_t), admin_hotkeys_compare);
+
+	if ((k < 0) || (k > n))
+		k = n;
+
+	evbuffer_add_printf(dst, "*%d\r\n", k);
+
+	for (i = 0; (i < k) && (rc != -1); i++) {
+		e = &hot[i].entry;
+		h = hot[i].hits;
+		len = (e->keylen < HOTKEYS_KEY_MAX) ? e->keylen:HOTKEYS_KEY_MAX;
+		/* NOTE: like 'slowlog get' does, truncated key is marked; key is binary, it may
+		         contain NUL */
+		evbuffer_add_printf(dst, "*4\r\n$%d\r\n", len + ((e->keylen > len) ? 3:0));
+		evbuffer_add(dst, e->key, len);
+		evbuffer_add_printf(dst, "%s\r\n", (e->keylen > len) ? "...":"");
+		evbuffer_add_printf(dst, ":%llu\r\n", (unsigned long long)e->count * hot[i].proxy->hotkeys->sample);
+		for (j = 0, len = 0; j < acls; j++)
+			len += (h[j] > 0);
+		evbuffer_add_printf(dst, "*%d\r\n", 2 * len);
+		for (j = 0; j < acls; j++) {
+			if (h[j] == 0)
+				continue;
+			name = (j > 0) ? session->admin->acl[j - 1]->id:"";
+			evbuffer_add_printf(dst, "$%d\r\n%s\r\n:%llu\r\n", (int)strlen(name), name, (unsigned long long)h[j] * hot[i].proxy->hotkeys->sample);
+		}
+		rc = evbuffer_add_printf(dst, "$%d\r\n%s\r\n", (int)strlen(hot[i].proxy->name), hot[i].proxy->name);
+	}
+
+	free(hits);
+	free(entry);
+	free(hot);
+
+	return((rc == -1) ? -1:0);
+}
+
+int admin_command(admin_session_t *session)
+{
+	struct evbuffer *dst = bufferevent_get_output(session->be);
+
+	if (session->rs.cmdlen == 0)
+		return(0);
+
+	if (ADMIN_IS(session, "info"))
+		return(admin_info(session));
+
+	if (ADMIN_IS(session, "slowlog"))
+		return(admin_slowlog(session));
+
+	if (ADMIN_IS(session, "hotkeys"))
+		return(admin_hotkeys(session));
+
+	if (ADMIN_IS(session, "ping"))
+		return(evbuffer_add(dst, "+PONG\r\n", 7));
+
+	if (ADMIN_IS(session, "quit")) {
+		session->closing = 1;
+		return(evbuffer_add(dst, "+OK\r\n", 5));
+	}
+
+	return(evbuffer_add_printf(dst, "-ERR unknown command '%.*s'\r\n", session->rs.cmdlen, session->rs.cmd));
+}
+
+void admin_read(struct bufferevent *be, void *arg)
+{
+	admin_session_t *session = (admin_session_t *)arg;
+	struct evbuffer *src = bufferevent_get_input(be);
+	int i = 0;
+
+	while (!session->closing && ((i = resp_parse_buffer(&session->rs)) > 0)) {
+		if (session->rs.pending_parts > 0)
+			continue;
+		if ((admin_command(session) == -1) || (evbuffer_drain(src, session->rs.parsed) != 0)) {
+			LOG(E1, "failed to reply to admin client");
+			admin_session_destroy(session);
+			return;
+		}
+		session->rs.parsed = session->rs.start = 0;
+	}
+
+	if (i == -1) {
+		LOG(W1, "invalid command from admin client");
+		evbuffer_add_printf(bufferevent_get_output(be), "-ERR protocol error\r\n");
+		session->closing = 1;
+	}
+
+	if (session->closing)
+		bufferevent_disable(be, EV_READ);
+}
+
+void admin_write(struct bufferevent *be, void *arg)
+{
+	admin_session_t *session = (admin_session_t *)arg;
+
+	if (session->closing)
+		admin_session_destroy(session);
+}
+
+void admin_event(struct bufferevent *be, short events, void *arg)
+{
+	if (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR))
+		admin_session_destroy((admin_session_t *)arg);
+}
+
+void admin_accept(struct evconnlistener *ecl, evutil_socket_t fd, struct sockaddr *address, int socklen, void *arg)
+{
+	admin_t *admin = (admin_t *)arg;
+	admin_session_t *session = (admin_session_t *)malloc(sizeof(admin_session_t));
+
+	if (session == NULL) {
+		LOG(E1, "malloc() failed, %s", strerror(errno));
+		evutil_closesocket(fd);
+		return;
+	}
+
+	memset(session, 0, sizeof(admin_session_t));
+
+	session->admin = admin;
+
+	if ((session->be = bufferevent_socket_new(admin->eb, fd, BEV_OPT_CLOSE_ON_FREE)) == NULL) {
+		LOG(E1, "failed to initialize admin client bufferevent, %s", strerror(errno));
+		evutil_closesocket(fd);
+		free(session);
+		return;
+	}
+
+	session->rs.eb = bufferevent_get_input(session->be);
+
+	bufferevent_setcb(session->be, admin_read, admin_write, admin_event, session);
+	bufferevent_enable(session->be, EV_READ | EV_WRITE);
+
+	LOG(D1, "accepted admin connection");
+}
+
+void admin_worker(void *i)
+{
+	admin_t *admin = (admin_t *)i;
+
+	event_base_loop(admin->eb, 0);
+}
+
+admin_t *admin_create(const char *listen, proxy_t **proxy, acl_t **acl)
+{
+	admin_t *admin = (admin_t *)malloc(sizeof(admin_t));
+	int n = sizeof(admin->sa), fd;
+
+	if (admin == NULL) {
+		LOG(E1, "malloc() failed, %s", strerror(errno));
+		return(NULL);
+	}
+
+	memset(admin, 0, sizeof(admin_t));
+
+	admin->name = listen;
+	admin->proxy = proxy;
+	admin->acl = acl;
+
+	if (evutil_parse_sockaddr_port(listen, &admin->sa, &n) == -1) {
+		LOG(E1, "failed to parse 'admin' '%s'", listen);
+		return(NULL);
+	}
+
+	if ((admin->eb = event_base_new()) == NULL) {
+		LOG(E1, "failed to initialize event base");
+		return(NULL);
+	}
+
+	if ((fd = upgrade_listener(listen)) != -1)
+		admin->ecl = evconnlistener_new(admin->eb, NULL, NULL, LEV_OPT_CLOSE_ON_FREE | LEV_OPT_CLOSE_ON_EXEC | LEV_OPT_REUSEABLE, -1, fd);
+	else
+		admin->ecl = evconnlistener_new_bind(admin->eb, NULL, NULL, LEV_OPT_CLOSE_ON_FREE | LEV_OPT_CLOSE_ON_EXEC | LEV_OPT_REUSEABLE, -1, &admin->sa, n);
+
+	if (admin->ecl == NULL) {
+		LOG(E1, "evconnlistener_new_bind() failed, %s", strerror(errno));
+		return(NULL);
+	}
+
+	if ((admin->worker = worker_create("admin", admin_worker, (void *)admin)) == NULL) {
+		LOG(E1, "failed to initialize worker");
+		return(NULL);
+	}
+
+	return(admin);
+}
+
+void admin_destroy(admin_t *admin)
+{
+	if (admin == NULL)
+		return;
+
+	admin_stop(admin);
+
+	worker_destroy(admin->worker);
+
+	evconnlistener_free(admin->ecl);
+	event_base_free(admin->eb);
+
+	free(admin);
+}
+
+void admin_start(admin_t *admin)
+{
+	if (admin == NULL)
+		return;
+
+	evconnlistener_set_cb(admin->ecl, admin_accept, admin);
+
+	worker_instruct(admin->worker, RUN);
+
+	LOG(I1, "admin listening on %s", admin->name);
+}
+
+void admin_stop(admin_t *admin)
+{
+	if (admin == NULL)
+		return;
+
+	evconnlistener_disable(admin->ecl);
+
+	event_base_loopbreak(admin->eb);
+
+	worker_instruct(admin->worker, SLEEP);
+}
@@ -0,0 +1,49 @@
+#ifndef ADMIN_H
+#define ADMIN_H
+
+#include <event.h>
+#include <event2/listener.h>
+
+#include "acl.h"
+#include "proxy.h"
+#include "resp.h"
+#include "slowlog.h"
+#include "hotkeys.h"
+#include "worker.h"
+
+/* NOTE: admin listener runs in a thread of its own, it only ever reads counters
+         written by proxy threads */
+typedef struct {
+	const char *name;
+	worker_t *worker;
+	struct event_base *eb;
+	struct evconnlistener *ecl;
+	struct sockaddr sa;
+	proxy_t **proxy;
+	acl_t **acl;
+} admin_t;
+
+typedef struct {
+	admin_t *admin;
+	struct bufferevent *be;
+	resp_buffer_t rs;
+	int closing;
+} admin_session_t;
+
+typedef struct {
+	slowlog_entry_t entry;
+	proxy_t *proxy;
+} admin_slowlog_t;
+
+typedef struct {
+	hotkeys_entry_t entry;
+	uint32_t *hits;
+	proxy_t *proxy;
+} admin_hotkeys_t;
+
+admin_t *admin_create(const char *listen, proxy_t **proxy, acl_t **acl);
+void admin_destroy(admin_t *admin);
+void admin_start(admin_t *admin);
+void admin_stop(admin_t *admin);
+
+#endif
@@ -0,0 +1,226 @@
+/*
+   Copyright (c) 2018-2019, Seznam.cz, a.s.
+
+   Author: Daniel Bilik (daniel.bilik@firma.seznam.cz)
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+   PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+   BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+   POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/mman.h>
+
+#include "log.h"
+#include "cmd.h"
+#include "audit.h"
+
+uint32_t audit_hash(const char *key, int keylen)
+{
+	uint32_t h = 2166136261u;
+
+	while (keylen-- > 0)
+		h = (h ^ (unsigned char)*key++) * 16777619u;
+
+	return(h);
+}
+
+void audit_begin(audit_t *audit, int segment)
+{
+	audit_header_t *h = (audit_header_t *)audit->segment[segment];
+	struct timespec ts;
+	char *names = h->names;
+	int i;
+
+	audit->header = h;
+	audit->record = (audit_record_t *)(audit->segment[segment] + audit->header_size);
+	audit->current = segment;
+	audit->next = 0;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	/* NOTE: count is zeroed first, so that decoder never takes records of a previous
+	         round for those belonging to the new one */
+	__atomic_store_n(&h->count, 0, __ATOMIC_RELEASE);
+
+	memcpy(h->magic, AUDIT_MAGIC, sizeof(h->magic));
+	h->version = AUDIT_VERSION;
+	h->header_size = audit->header_size;
+	h->capacity = audit->capacity;
+	h->sequence = ++audit->sequence;
+	h->created = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	h->commands = cmd_count;
+
+	for (i = 0; i < cmd_count; i++)
+		names = stpcpy(names, cmd_table[i].name) + 1;
+
+	for (i = 0; audit->acl && audit->acl[i]; i++)
+		names = stpcpy(names, audit->acl[i]->id) + 1;
+
+	h->acls = i;
+}
+
+audit_t *audit_create(const char *path, long long size, int segments, acl_t **acl)
+{
+	audit_t *audit;
+	audit_header_t *h;
+	char file[PATH_MAX];
+	size_t header = sizeof(audit_header_t);
+	int fd, i, last = -1;
+
+	if ((segments <= 0) || (size <= 0)) {
+		LOG(E1, "invalid audit segments");
+		return(NULL);
+	}
+
+	for (i = 0; i < cmd_count; i++)
+		header += strlen(cmd_table[i].name) + 1;
+
+	for (i = 0; acl && acl[i]; i++)
+		header += strlen(acl[i]->id) + 1;
+
+	header = (header + 4095) & ~4095;
+
+	if (size < header + sizeof(audit_record_t)) {
+		LOG(E1, "audit segment size %d too small, %d bytes needed at least", (int)size, (int)(header + sizeof(audit_record_t)));
+		return(NULL);
+	}
+
+	if ((audit = (audit_t *)malloc(sizeof(audit_t))) == NULL) {
+		LOG(E1, "malloc() failed, %s", strerror(errno));
+		return(NULL);
+	}
+
+	memset(audit, 0, sizeof(audit_t));
+
+	audit->segments = segments;
+	audit->size = size;
+	audit->header_size = header;
+	audit->acl = acl;
+	audit->capacity = (size - header) / sizeof(audit_record_t);
+
+	if ((audit->segment = (char **)malloc(segments * sizeof(char *))) == NULL) {
+		LOG(E1, "malloc() failed, %s", strerror(errno));
+		free(audit);
+		return(NULL);
+	}
+
+	for (i = 0; i < segments; i++)
+		audit->segment[i] = MAP_FAILED;
+
+	for (i = 0; i < segments; i++) {
+		snprintf(file, sizeof(file), "%s.%d", path, i);
+		if ((fd = open(file, O_RDWR | O_CREAT, 0640)) == -1) {
+			LOG(E1, "can't open audit segment '%s', %s", file, strerror(errno));
+			audit_destroy(audit);
+			return(NULL);
+		}
+		if (ftruncate(fd, size) == -1) {
+			LOG(E1, "can't resize audit segment '%s', %s", file, strerror(errno));
+			close(fd);
+			audit_destroy(audit);
+			return(NULL);
+		}
+		audit->segment[i] = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (audit->segment[i] == MAP_FAILED) {
+			LOG(E1, "can't map audit segment '%s', %s", file, strerror(errno));
+			audit_destroy(audit);
+			return(NULL);
+		}
+		/* NOTE: records of previous runs are kept, writing continues after the most recent segment */
+		h = (audit_header_t *)audit->segment[i];
+		if ((memcmp(h->magic, AUDIT_MAGIC, sizeof(h->magic)) == 0) && (h->sequence > audit->sequence)) {
+			audit->sequence = h->sequence;
+			last = i;
+		}
+	}
+
+	audit_begin(audit, (last + 1) % segments);
+
+	LOG(D1, "audit '%s' using %d segments of %d records", path, segments, (int)audit->capacity);
+
+	return(audit);
+}
+
+void audit_destroy(audit_t *audit)
+{
+	int i;
+
+	if (audit == NULL)
+		return;
+
+	for (i = 0; i < audit->segments; i++)
+		if (audit->segment[i] != MAP_FAILED)
+			munmap(audit->segment[i], audit->size);
+
+	free(audit->segment);
+	free(audit);
+}
+
+/* NOTE: record is written right into a shared mapping, kernel takes care of getting it
+         to disk (even if proxis crashes), there's no system call on this path */
+void audit_record(audit_t *audit, uint64_t session, acl_t *acl, int cmd, int verdict, const char *key, int keylen, int bytes)
+{
+	audit_record_t *r;
+	audit_header_t *h;
+	struct timespec ts;
+	int next;
+
+	if (audit->header == NULL)
+		return;
+
+	/* NOTE: a newer process (see hot upgrade) begins with the segment following the most
+	         recent one, ie. the one this process would rotate to; once it's there (with
+	         a higher sequence), this one stops auditing instead of overwriting its records */
+	if (audit->next == audit->capacity) {
+		next = (audit->current + 1) % audit->segments;
+		h = (audit_header_t *)audit->segment[next];
+		if ((memcmp(h->magic, AUDIT_MAGIC, sizeof(h->magic)) == 0) && (__atomic_load_n(&h->sequence, __ATOMIC_RELAXED) > audit->sequence)) {
+			LOG(W1, "audit segment %d has been taken over by a newer process, not auditing anymore", next);
+			audit->header = NULL;
+			return;
+		}
+		audit_begin(audit, next);
+	}
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	r = &audit->record[audit->next++];
+	r->time = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	r->session = session;
+	r->key = (keylen > 0) ? audit_hash(key, keylen):0;
+	r->bytes = bytes;
+	r->acl = (acl) ? acl->index + 1:0;
+	r->cmd = cmd;
+	r->verdict = verdict;
+
+	__atomic_store_n(&audit->header->count, audit->next, __ATOMIC_RELEASE);
+}
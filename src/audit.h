@@ -0,0 +1,64 @@
+#ifndef AUDIT_H
+#define AUDIT_H
+
+#include <stdint.h>
+
+#include "acl.h"
+
+#define AUDIT_MAGIC "PRXAUDIT"
+#define AUDIT_VERSION 1
+#define AUDIT_SEGMENT_SIZE 67108864 // default size of a single segment file
+#define AUDIT_SEGMENTS 4 // default number of segment files to rotate
+
+#define AUDIT_ALLOWED 1
+#define AUDIT_BLOCKED 2
+#define AUDIT_AUTH_OK 3
+#define AUDIT_AUTH_FAILED 4
+
+/* NOTE: fixed size record of a single command, key is FNV-1a hash of (prefix of) its
+         first argument (0 when there's none), bytes is size of the command as sent
+         by a client, acl is index of an entry plus one (0 when none is used) */
+typedef struct {
+	uint64_t time;
+	uint64_t session;
+	uint32_t key;
+	uint32_t bytes;
+	uint16_t acl;
+	uint16_t cmd;
+	uint8_t verdict;
+	uint8_t reserved[3];
+} audit_record_t;
+
+/* NOTE: each segment file starts with this header followed by NUL separated names of
+         commands and acl entries (so that a segment can be decoded by itself, with no
+         configuration at hand), records start at header_size; count is stored (with
+         release semantics) after each record, sequence grows with every segment begun */
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint64_t capacity;
+	uint64_t sequence;
+	uint64_t created;
+	uint64_t count;
+	uint32_t commands, acls;
+	char names[];
+} audit_header_t;
+
+/* NOTE: segments of a single proxy are written by its thread only, they're all mapped
+         upfront, so that switching to the next one never touches a file */
+typedef struct {
+	char **segment;
+	int segments, current;
+	size_t size, header_size;
+	acl_t **acl;
+	audit_header_t *header;
+	audit_record_t *record;
+	uint64_t capacity, next, sequence;
+} audit_t;
+
+audit_t *audit_create(const char *path, long long size, int segments, acl_t **acl);
+void audit_destroy(audit_t *audit);
+void audit_record(audit_t *audit, uint64_t session, acl_t *acl, int cmd, int verdict, const char *key, int keylen, int bytes);
+
+#endif
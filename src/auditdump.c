@@ -0,0 +1,206 @@
+/*
+   Copyright (c) 2018-2019, Seznam.cz, a.s.
+
+   Author: Daniel Bilik (daniel.bilik@firma.seznam.cz)
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+   PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+   BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+   POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "audit.h"
+
+/* NOTE: offline decoder of audit segments, it needs nothing but the segment files,
+         names of commands and acl entries are read from their headers */
+
+typedef struct {
+	const char *path;
+	char *map;
+	size_t size;
+	audit_header_t *header;
+	const char **command, **acl;
+} auditdump_segment_t;
+
+const char *auditdump_verdict[] = { "-", "allowed", "blocked", "auth-ok", "auth-failed" };
+
+void usage(char *command)
+{
+	printf("Usage: %s [options] segment...\n\n", command);
+	printf("Options:\n");
+	printf("  -h --help           Print this help\n");
+	printf("  -s --session id     Print records of given session only\n");
+	printf("\n");
+	printf("Records of all segments given are printed ordered by segment sequence.\n");
+	printf("\n");
+	exit(1);
+}
+
+int auditdump_open(auditdump_segment_t *s, const char *path)
+{
+	struct stat st;
+	char *names;
+	uint32_t i;
+	int fd;
+
+	memset(s, 0, sizeof(auditdump_segment_t));
+	s->path = path;
+
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		fprintf(stderr, "can't open '%s', %s\n", path, strerror(errno));
+		return(-1);
+	}
+
+	if ((fstat(fd, &st) == -1) || (st.st_size < sizeof(audit_header_t))) {
+		fprintf(stderr, "'%s' isn't an audit segment\n", path);
+		close(fd);
+		return(-1);
+	}
+
+	s->size = st.st_size;
+	s->map = (char *)mmap(NULL, s->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (s->map == MAP_FAILED) {
+		fprintf(stderr, "can't map '%s', %s\n", path, strerror(errno));
+		return(-1);
+	}
+
+	s->header = (audit_header_t *)s->map;
+
+	/* NOTE: segment created but not written to yet */
+	if (s->header->magic[0] == '\0')
+		return(1);
+
+	if (memcmp(s->header->magic, AUDIT_MAGIC, sizeof(s->header->magic)) || (s->header->version != AUDIT_VERSION) || (s->header->header_size > s->size)) {
+		fprintf(stderr, "'%s' isn't an audit segment\n", path);
+		return(-1);
+	}
+
+	s->command = (const char **)malloc((s->header->commands + s->header->acls) * sizeof(char *));
+	if (s->command == NULL)
+		return(-1);
+	s->acl = s->command + s->header->commands;
+
+	names = s->header->names;
+	for (i = 0; i < s->header->commands + s->header->acls; i++) {
+		s->command[i] = names;
+		names += strnlen(names, s->map + s->header->header_size - names) + 1;
+		if (names > s->map + s->header->header_size) {
+			fprintf(stderr, "'%s' has corrupted header\n", path);
+			return(-1);
+		}
+	}
+
+	return(0);
+}
+
+int auditdump_compare(const void *a, const void *b)
+{
+	const auditdump_segment_t *x = (const auditdump_segment_t *)a, *y = (const auditdump_segment_t *)b;
+
+	return((x->header->sequence > y->header->sequence) - (x->header->sequence < y->header->sequence));
+}
+
+void auditdump_print(auditdump_segment_t *s, long long session)
+{
+	audit_record_t *r = (audit_record_t *)(s->map + s->header->header_size);
+	uint64_t i, count = __atomic_load_n(&s->header->count, __ATOMIC_ACQUIRE);
+	char when[32];
+	time_t t;
+	struct tm tm;
+
+	/* NOTE: segment might have been shrunk by a restart with smaller segment size */
+	if (count > (s->size - s->header->header_size) / sizeof(audit_record_t))
+		count = (s->size - s->header->header_size) / sizeof(audit_record_t);
+
+	for (i = 0; i < count; i++, r++) {
+		if ((session >= 0) && (r->session != session))
+			continue;
+		t = r->time / 1000000;
+		localtime_r(&t, &tm);
+		strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+		printf("%s.%06u session=%llu acl=%s cmd=%s %s key=%08x bytes=%u\n", when, (unsigned int)(r->time % 1000000),
+			(unsigned long long)r->session,
+			(r->acl && (r->acl <= s->header->acls)) ? s->acl[r->acl - 1]:"-",
+			(r->cmd < s->header->commands) ? s->command[r->cmd]:"?",
+			(r->verdict <= AUDIT_AUTH_FAILED) ? auditdump_verdict[r->verdict]:"?",
+			r->key, r->bytes);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	auditdump_segment_t *segment;
+	long long session = -1;
+	int a, i = 0, n = 0, rc = 0;
+
+	struct option long_options[] = {
+		{"help", no_argument, 0, 'h'},
+		{"session", required_argument, 0, 's'},
+		{NULL, 0, 0, 0}
+	};
+
+	while ((a = getopt_long(argc, argv, "hs:", long_options, &i)) != -1)
+		switch (a) {
+		case 's':
+			session = atoll(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			break;
+		}
+
+	if (optind == argc)
+		usage(argv[0]);
+
+	if ((segment = (auditdump_segment_t *)malloc((argc - optind) * sizeof(auditdump_segment_t))) == NULL)
+		return(1);
+
+	for (i = optind; i < argc; i++)
+		switch (auditdump_open(&segment[n], argv[i])) {
+		case 0:
+			n++;
+			break;
+		case -1:
+			rc = 1;
+			break;
+		}
+
+	qsort(segment, n, sizeof(auditdump_segment_t), auditdump_compare);
+
+	for (i = 0; i < n; i++)
+		auditdump_print(&segment[i], session);
+
+	return(rc);
+}
@@ -0,0 +1,703 @@
+/*
+   Copyright (c) 2018-2019, Seznam.cz, a.s.
+
+   Author: Daniel Bilik (daniel.bilik@firma.seznam.cz)
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+   PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+   BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+   POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <libconfig.h>
+#include <event.h>
+#include <event2/bufferevent.h>
+
+#include "log.h"
+#include "cmd.h"
+#include "resp.h"
+#include "cache.h"
+
+/* NOTE: cache is owned by a single proxy, thus used by a single thread (its event loop),
+         only statistics counters are read from elsewhere (hence atomics) */
+
+#define CACHE_ENTRY_SIZE(e) (sizeof(cache_entry_t) + (e)->reqlen + (e)->keylen + (e)->replen)
+
+void cache_connect(evutil_socket_t fd, short events, void *arg);
+
+unsigned int cache_hash(const char *key, int keylen)
+{
+	unsigned int h = 2166136261u;
+
+	while (keylen-- > 0)
+		h = (h ^ (unsigned char)*(key++)) * 16777619u;
+
+	return(h);
+}
+
+void cache_entry_free(cache_entry_t *entry)
+{
+	free(entry->request);
+	free(entry->key);
+	free(entry->reply);
+	free(entry);
+}
+
+/* NOTE: takes entry out of its bucket and ring (or flight list), it stays allocated
+         as long as anyone refers to it */
+void cache_detach(cache_t *cache, cache_entry_t *entry)
+{
+	cache_entry_t **e = &cache->bucket[cache_hash(entry->key, entry->keylen) & (cache->buckets - 1)];
+
+	if (!entry->linked)
+		return;
+
+	while (*e && (*e != entry))
+		e = &(*e)->next;
+
+	if (*e)
+		*e = entry->next;
+
+	if (entry->pending) {
+		if (entry->clock_prev)
+			entry->clock_prev->clock_next = entry->clock_next;
+		else
+			cache->flight = entry->clock_next;
+		if (entry->clock_next)
+			entry->clock_next->clock_prev = entry->clock_prev;
+	} else {
+		if (entry->clock_next == entry) {
+			cache->hand = NULL;
+		} else {
+			if (cache->hand == entry)
+				cache->hand = entry->clock_next;
+			entry->clock_prev->clock_next = entry->clock_next;
+			entry->clock_next->clock_prev = entry->clock_prev;
+		}
+		cache->used -= CACHE_ENTRY_SIZE(entry);
+	}
+
+	entry->linked = 0;
+}
+
+void cache_unlink(cache_t *cache, cache_entry_t *entry)
+{
+	cache_detach(cache, entry);
+
+	if (entry->refs == 0)
+		cache_entry_free(entry);
+}
+
+void cache_release(cache_t *cache, cache_entry_t *entry)
+{
+	if (entry == NULL)
+		return;
+
+	if ((--entry->refs == 0) && !entry->linked)
+		cache_entry_free(entry);
+}
+
+/* NOTE: pending entries are dropped too, so that no one joins a request sent before
+         the change, reply to it still gets to those already waiting, but isn't stored */
+void cache_clear(cache_t *cache)
+{
+	while (cache->hand)
+		cache_unlink(cache, cache->hand);
+
+	while (cache->flight)
+		cache_unlink(cache, cache->flight);
+}
+
+void cache_invalidate(cache_t *cache, const char *key, int keylen)
+{
+	cache_entry_t *e = cache->bucket[cache_hash(key, keylen) & (cache->buckets - 1)], *next;
+
+	/* NOTE: invalidation doesn't tell a database, key is dropped from all of them */
+	while (e) {
+		next = e->next;
+		if ((e->keylen == keylen) && (memcmp(e->key, key, keylen) == 0))
+			cache_unlink(cache, e);
+		e = next;
+	}
+
+	__atomic_fetch_add(&cache->invalidations, 1, __ATOMIC_RELAXED);
+}
+
+int cache_match(cache_t *cache, const char *key, int keylen)
+{
+	const char **k;
+
+	if ((keylen < 0) || (keylen > RESP_ARG_MAX))
+		return(0);
+
+	if (cache->keys == NULL)
+		return(1);
+
+	for (k = cache->keys; *k; k++)
+		if (fnmatch(*k, key, 0) == 0)
+			return(1);
+
+	return(0);
+}
+
+/* NOTE: identical commands are coalesced even while tracking connection is down,
+         their replies just aren't stored then */
+int cache_cacheable(cache_t *cache, int cmd, const char *key, int keylen)
+{
+	return(cache && cache->commands[cmd] && cache_match(cache, key, keylen));
+}
+
+/* NOTE: invalidation push travels over another connection than a reply to a write does, so
+         any other command on a cached key drops it right away (read-your-writes for clients) */
+void cache_touch(cache_t *cache, int cmd, const char *key, int keylen)
+{
+	if ((cache == NULL) || cache->commands[cmd] || !cache_match(cache, key, keylen))
+		return;
+
+	cache_invalidate(cache, key, keylen);
+}
+
+cache_entry_t *cache_find(cache_t *cache, int db, const char *request, int reqlen, const char *key, int keylen)
+{
+	cache_entry_t *e = cache->bucket[cache_hash(key, keylen) & (cache->buckets - 1)];
+
+	while (e && ((e->db != db) || (e->reqlen != reqlen) || memcmp(e->request, request, reqlen)))
+		e = e->next;
+
+	return(e);
+}
+
+/* NOTE: returns cached entry, or pending one to wait for (merging identical commands) */
+cache_entry_t *cache_get(cache_t *cache, int db, const char *request, int reqlen, const char *key, int keylen)
+{
+	cache_entry_t *e = cache_find(cache, db, request, reqlen, key, keylen);
+	struct timeval now;
+
+	if (e && !e->pending && cache->ttl) {
+		event_base_gettimeofday_cached(cache->eb, &now);
+		if (e->expire <= now.tv_sec) {
+			cache_unlink(cache, e);
+			e = NULL;
+		}
+	}
+
+	if (e == NULL) {
+		__atomic_fetch_add(&cache->misses, 1, __ATOMIC_RELAXED);
+		return(NULL);
+	}
+
+	if (e->pending) {
+		__atomic_fetch_add(&cache->merges, 1, __ATOMIC_RELAXED);
+	} else {
+		__atomic_fetch_add(&cache->hits, 1, __ATOMIC_RELAXED);
+		e->referenced = 1;
+	}
+
+	e->refs++;
+
+	return(e);
+}
+
+cache_entry_t *cache_reserve(cache_t *cache, int db, const char *request, int reqlen, const char *key, int keylen)
+{
+	cache_entry_t *e = (cache_entry_t *)malloc(sizeof(cache_entry_t));
+	unsigned int h = cache_hash(key, keylen) & (cache->buckets - 1);
+
+	if (e == NULL)
+		return(NULL);
+
+	memset(e, 0, sizeof(cache_entry_t));
+
+	if (((e->request = (char *)malloc(reqlen)) == NULL) || ((e->key = (char *)malloc(keylen)) == NULL)) {
+		cache_entry_free(e);
+		return(NULL);
+	}
+
+	memcpy(e->request, request, reqlen);
+	memcpy(e->key, key, keylen);
+	e->reqlen = reqlen;
+	e->keylen = keylen;
+	e->db = db;
+	e->refs = 1;
+
+	/* NOTE: any invalidation arriving before the reply does unlinks the entry, making its reply
+	         possibly stale, thus not to be stored */
+	e->pending = 1;
+	e->linked = 1;
+	e->next = cache->bucket[h];
+	cache->bucket[h] = e;
+	e->clock_next = cache->flight;
+	if (cache->flight)
+		cache->flight->clock_prev = e;
+	cache->flight = e;
+
+	return(e);
+}
+
+void cache_wait(cache_entry_t *entry, cache_waiter_t *waiter)
+{
+	waiter->entry = entry;
+	waiter->next = entry->waiters;
+	entry->waiters = waiter;
+}
+
+void cache_unwait(cache_waiter_t *waiter)
+{
+	cache_waiter_t **w;
+
+	if (waiter->entry == NULL)
+		return;
+
+	for (w = &waiter->entry->waiters; *w && (*w != waiter); w = &(*w)->next);
+
+	if (*w)
+		*w = waiter->next;
+
+	waiter->entry = NULL;
+}
+
+void cache_wake(cache_entry_t *entry)
+{
+	cache_waiter_t *w;
+
+	while ((w = entry->waiters) != NULL) {
+		entry->waiters = w->next;
+		w->entry = NULL;
+		w->wake(w->arg);
+	}
+}
+
+/* NOTE: gives up on a pending entry (eg. its session is gone), waiters are to send
+         the command themselves */
+void cache_abandon(cache_t *cache, cache_entry_t *entry)
+{
+	if (entry == NULL)
+		return;
+
+	if (entry->pending) {
+		cache_detach(cache, entry);
+		entry->pending = 0;
+		cache_wake(entry);
+	}
+
+	cache_release(cache, entry);
+}
+
+/* NOTE: reply is handed over to waiters in any case, but stored only when it's allowed
+         to and nothing has invalidated it in the meantime */
+void cache_fill(cache_t *cache, cache_entry_t *entry, struct evbuffer *eb, int offset, int len, int store)
+{
+	struct evbuffer_ptr p;
+	struct timeval now;
+	cache_entry_t *e;
+	int linked = entry->linked;
+
+	if (!entry->pending)
+		return;
+
+	cache_detach(cache, entry);
+	entry->pending = 0;
+
+	if ((sizeof(cache_entry_t) + entry->reqlen + entry->keylen + len <= cache->entry_max) && ((entry->reply = (char *)malloc(len)) != NULL)) {
+		if ((evbuffer_ptr_set(eb, &p, offset, EVBUFFER_PTR_SET) == -1) || (evbuffer_copyout_from(eb, &p, entry->reply, len) != len)) {
+			free(entry->reply);
+			entry->reply = NULL;
+		} else {
+			entry->replen = len;
+		}
+	}
+
+	cache_wake(entry);
+
+	if (!store || !linked || !cache->ready || (entry->reply == NULL))
+		return;
+
+	if ((e = cache_find(cache, entry->db, entry->request, entry->reqlen, entry->key, entry->keylen)) != NULL) {
+		if (e->pending)
+			return;
+		cache_unlink(cache, e);
+	}
+
+	/* NOTE: CLOCK eviction, hand sweeps the ring, clearing referenced bit of entries it
+	         passes and evicting the first one found without it */
+	while (cache->hand && (cache->used + CACHE_ENTRY_SIZE(entry) > cache->memory)) {
+		if (cache->hand->referenced) {
+			cache->hand->referenced = 0;
+			cache->hand = cache->hand->clock_next;
+		} else {
+			cache_unlink(cache, cache->hand);
+		}
+	}
+
+	e = entry;
+	e->next = cache->bucket[cache_hash(e->key, e->keylen) & (cache->buckets - 1)];
+	cache->bucket[cache_hash(e->key, e->keylen) & (cache->buckets - 1)] = e;
+
+	if (cache->hand) {
+		e->clock_next = cache->hand;
+		e->clock_prev = cache->hand->clock_prev;
+		cache->hand->clock_prev->clock_next = e;
+		cache->hand->clock_prev = e;
+	} else {
+		cache->hand = e->clock_next = e->clock_prev = e;
+	}
+
+	if (cache->ttl) {
+		event_base_gettimeofday_cached(cache->eb, &now);
+		e->expire = now.tv_sec + cache->ttl;
+	}
+
+	cache->used += CACHE_ENTRY_SIZE(e);
+	e->linked = 1;
+
+	__atomic_fetch_add(&cache->fills, 1, __ATOMIC_RELAXED);
+}
+
+/* NOTE: RESP3 push in form of '>2 $10 invalidate *N $.. key ...', or '_' instead of
+         keys' array when whole dataset has been flushed */
+void cache_push(cache_t *cache, char *c, int len)
+{
+	char *end = c + len, *eol;
+	long long n, l;
+
+	if ((len < 24) || strncmp(c, ">2\r\n$10\r\ninvalidate\r\n", 21))
+		return;
+
+	c += 21;
+
+	if (*c == '_') {
+		cache_clear(cache);
+		__atomic_fetch_add(&cache->invalidations, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	if ((*c != '*') || (sscanf(c + 1, "%lld", &n) != 1) || ((c = memchr(c, '\n', end - c)) == NULL))
+		return;
+
+	for (c++; (n > 0) && (c < end); n--) {
+		if ((*c != '$') || (sscanf(c + 1, "%lld", &l) != 1) || ((eol = memchr(c, '\n', end - c)) == NULL) || (eol + 1 + l + 2 > end))
+			return;
+		cache_invalidate(cache, eol + 1, l);
+		c = eol + 1 + l + 2;
+	}
+}
+
+void cache_disconnect(cache_t *cache)
+{
+	struct timeval tv = { CACHE_RETRY, 0 };
+
+	if (cache->be) {
+		bufferevent_free(cache->be);
+		cache->be = NULL;
+	}
+
+	/* NOTE: without tracking connection, there's no way to tell cached entries are still valid */
+	cache->ready = 0;
+	cache_clear(cache);
+
+	evtimer_add(cache->retry, &tv);
+}
+
+void cache_read(struct bufferevent *be, void *arg)
+{
+	cache_t *cache = (cache_t *)arg;
+	struct evbuffer *src = bufferevent_get_input(be);
+	char *c;
+	int i;
+
+	while ((i = resp_parse_reply(&cache->rr, src)) > 0) {
+		if (cache->handshake > 0) {
+			if ((cache->rr.type == '-') || (cache->rr.type == '!')) {
+				c = (char *)evbuffer_pullup(src, cache->rr.parsed);
+				c[cache->rr.parsed - 2] = '\0';
+				LOG(W1, "failed to enable client tracking on server for cache, %s", c + 1);
+				cache_disconnect(cache);
+				return;
+			}
+			if (--cache->handshake == 0) {
+				bufferevent_set_timeouts(be, NULL, NULL);
+				cache->ready = 1;
+				LOG(I1, "cache enabled, client tracking established");
+			}
+		} else if (cache->rr.type == '>') {
+			if ((c = (char *)evbuffer_pullup(src, cache->rr.parsed)) != NULL)
+				cache_push(cache, c, cache->rr.parsed);
+		}
+		evbuffer_drain(src, cache->rr.parsed);
+		cache->rr.parsed = 0;
+	}
+
+	if (i == -1) {
+		LOG(E1, "resp_parse_reply() failed on cache tracking connection");
+		cache_disconnect(cache);
+	}
+}
+
+void cache_event(struct bufferevent *be, short events, void *arg)
+{
+	cache_t *cache = (cache_t *)arg;
+
+	if (events & BEV_EVENT_CONNECTED)
+		return;
+
+	if (events & BEV_EVENT_TIMEOUT)
+		LOG(W1, "timeout reached on cache tracking connection");
+	else if (events & BEV_EVENT_ERROR)
+		LOG(W1, "got error on cache tracking connection, %s", evutil_socket_error_to_string(EVUTIL_SOCKET_ERROR()));
+	else if (events & BEV_EVENT_EOF)
+		LOG(W1, "server has closed cache tracking connection");
+
+	if (cache->ready)
+		LOG(W1, "cache disabled until client tracking is re-established");
+
+	cache_disconnect(cache);
+}
+
+void cache_connect(evutil_socket_t fd, short events, void *arg)
+{
+	cache_t *cache = (cache_t *)arg;
+	struct timeval tv = { CACHE_RETRY, 0 };
+
+	if ((cache->be = bufferevent_socket_new(cache->eb, -1, BEV_OPT_CLOSE_ON_FREE | BEV_OPT_DEFER_CALLBACKS)) == NULL) {
+		LOG(E1, "failed to initialize cache tracking bufferevent, %s", strerror(errno));
+		evtimer_add(cache->retry, &tv);
+		return;
+	}
+
+	memset(&cache->rr, 0, sizeof(resp_reply_t));
+
+	bufferevent_setcb(cache->be, cache_read, NULL, cache_event, cache);
+	bufferevent_enable(cache->be, EV_READ | EV_WRITE);
+	bufferevent_set_timeouts(cache->be, &tv, NULL);
+
+	/* NOTE: commands are queued before being connected, libevent sends them once it is */
+	cache->handshake = 0;
+
+	if (cache->auth && (bufferevent_write(cache->be, cache->auth->payload, cache->auth->len) == 0))
+		cache->handshake++;
+	if (bufferevent_write(cache->be, cache->hello->payload, cache->hello->len) == 0)
+		cache->handshake++;
+	if (bufferevent_write(cache->be, cache->tracking->payload, cache->tracking->len) == 0)
+		cache->handshake++;
+
+	if (bufferevent_socket_connect(cache->be, &cache->sa, sizeof(struct sockaddr)) == -1) {
+		LOG(W1, "failed to connect cache tracking connection");
+		cache_disconnect(cache);
+		return;
+	}
+
+	evutil_make_socket_closeonexec(bufferevent_getfd(cache->be));
+}
+
+void cache_start(cache_t *cache, struct event_base *eb, struct sockaddr *sa, resp_t *auth)
+{
+	if (cache == NULL)
+		return;
+
+	cache->eb = eb;
+	cache->auth = auth;
+
+	memcpy(&cache->sa, sa, sizeof(struct sockaddr));
+
+	if ((cache->retry = evtimer_new(eb, cache_connect, cache)) == NULL) {
+		LOG(E1, "evtimer_new() failed, cache disabled");
+		return;
+	}
+
+	cache_connect(-1, 0, cache);
+}
+
+/* NOTE: BCAST tracking of prefixes (up to the first wildcard of key patterns), overlapping
+         prefixes are refused by redis, so only the shortest of them is used */
+int cache_prefix(cache_t *cache, int n)
+{
+	int i, len = strcspn(cache->keys[n], "*?[\\"), l;
+
+	for (i = 0; cache->keys[i]; i++) {
+		if (i == n)
+			continue;
+		l = strcspn(cache->keys[i], "*?[\\");
+		if ((l < len) || ((l == len) && (i < n)))
+			if (strncmp(cache->keys[i], cache->keys[n], l) == 0)
+				return(-1);
+	}
+
+	return(len);
+}
+
+resp_t *cache_tracking(cache_t *cache)
+{
+	resp_t *result;
+	int i, l, count = 4, len = 128;
+
+	for (i = 0; cache->keys && cache->keys[i]; i++) {
+		if ((l = cache_prefix(cache, i)) == 0) {
+			count = 4;
+			break;
+		}
+		if (l > 0) {
+			count += 2;
+			len += l + 32;
+		}
+	}
+
+	if (((result = (resp_t *)malloc(sizeof(resp_t))) == NULL) || ((result->payload = malloc(len)) == NULL)) {
+		LOG(E1, "malloc() failed, %s", strerror(errno));
+		return(NULL);
+	}
+
+	result->type = RESP_ARRAY;
+	result->len = sprintf(result->payload, "*%d\r\n$6\r\nCLIENT\r\n$8\r\nTRACKING\r\n$2\r\non\r\n$5\r\nBCAST\r\n", count);
+
+	for (i = 0; (count > 4) && cache->keys[i]; i++)
+		if ((l = cache_prefix(cache, i)) > 0)
+			result->len += sprintf((char *)result->payload + result->len, "$6\r\nPREFIX\r\n$%d\r\n%.*s\r\n", l, l, cache->keys[i]);
+
+	return(result);
+}
+
+cache_t *cache_create(config_setting_t *config)
+{
+	cache_t *cache;
+	config_setting_t *s;
+	long long memory = 64 << 20;
+	const char *value;
+	int i, n, cmd;
+
+	if ((cache = (cache_t *)malloc(sizeof(cache_t))) == NULL) {
+		LOG(E1, "malloc() failed, %s", strerror(errno));
+		return(NULL);
+	}
+
+	memset(cache, 0, sizeof(cache_t));
+
+	if ((cache->commands = (char *)malloc(cmd_count)) == NULL) {
+		LOG(E1, "malloc() failed, %s", strerror(errno));
+		return(NULL);
+	}
+
+	memset(cache->commands, 0, cmd_count);
+
+	s = config_setting_get_member(config, "commands");
+	n = config_setting_length(s);
+
+	if (!config_setting_is_array(s) || (n == 0)) {
+		LOG(E1, "'cache' without valid 'commands'");
+		return(NULL);
+	}
+
+	for (i = 0; i < n; i++) {
+		if (((value = config_setting_get_string_elem(s, i)) == NULL) || ((cmd = cmd_lookup(value, strlen(value))) == CMD_UNKNOWN)) {
+			LOG(E1, "invalid 'cache' 'commands' entry");
+			return(NULL);
+		}
+		cache->commands[cmd] = 1;
+	}
+
+	s = config_setting_get_member(config, "keys");
+	n = config_setting_length(s);
+
+	if (config_setting_is_array(s) && (n > 0)) {
+		if ((cache->keys = (const char **)malloc((n + 1) * sizeof(char *))) == NULL) {
+			LOG(E1, "malloc() failed, %s", strerror(errno));
+			return(NULL);
+		}
+		memset(cache->keys, 0, (n + 1) * sizeof(char *));
+		for (i = 0; i < n; i++)
+			if ((cache->keys[i] = config_setting_get_string_elem(s, i)) == NULL) {
+				LOG(E1, "invalid 'cache' 'keys' entry");
+				return(NULL);
+			}
+	}
+
+	config_setting_lookup_int64(config, "memory", &memory);
+	config_setting_lookup_int(config, "ttl", &cache->ttl);
+
+	if ((memory < 65536) || (cache->ttl < 0)) {
+		LOG(E1, "invalid 'cache' 'memory' or 'ttl'");
+		return(NULL);
+	}
+
+	cache->memory = memory;
+	cache->entry_max = memory >> 3;
+
+	/* NOTE: fixed number of buckets, one per ~1 KB of memory */
+	for (cache->buckets = 1024; cache->buckets < (memory >> 10); cache->buckets <<= 1);
+
+	if ((cache->bucket = (cache_entry_t **)malloc(cache->buckets * sizeof(cache_entry_t *))) == NULL) {
+		LOG(E1, "malloc() failed, %s", strerror(errno));
+		return(NULL);
+	}
+
+	memset(cache->bucket, 0, cache->buckets * sizeof(cache_entry_t *));
+
+	cache->hello = resp_command("HELLO", "3", NULL);
+
+	if ((cache->tracking = cache_tracking(cache)) == NULL)
+		return(NULL);
+
+	return(cache);
+}
+
+void cache_destroy(cache_t *cache)
+{
+	if (cache == NULL)
+		return;
+
+	if (cache->be)
+		bufferevent_free(cache->be);
+	if (cache->retry)
+		event_free(cache->retry);
+
+	cache->ready = 0;
+	cache_clear(cache);
+
+	resp_free(cache->hello);
+	resp_free(cache->tracking);
+
+	free(cache->bucket);
+	free(cache->keys);
+	free(cache->commands);
+	free(cache);
+}
+
+void cache_log(cache_t *cache, const char *what)
+{
+	char line[256];
+
+	if (cache == NULL)
+		return;
+
+	snprintf(line, sizeof(line), "hits %llu, misses %llu, merges %llu, fills %llu, invalidations %llu",
+		(unsigned long long)__atomic_load_n(&cache->hits, __ATOMIC_RELAXED),
+		(unsigned long long)__atomic_load_n(&cache->misses, __ATOMIC_RELAXED),
+		(unsigned long long)__atomic_load_n(&cache->merges, __ATOMIC_RELAXED),
+		(unsigned long long)__atomic_load_n(&cache->fills, __ATOMIC_RELAXED),
+		(unsigned long long)__atomic_load_n(&cache->invalidations, __ATOMIC_RELAXED));
+
+	LOG(I1, "cache of %s: %s", what, line);
+}
@@ -0,0 +1,70 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <libconfig.h>
+#include <event.h>
+
+#include "resp.h"
+
+#define CACHE_REQUEST_MAX 1024 // longest command (as sent by a client) to be looked up in cache
+#define CACHE_RETRY 5 // seconds between attempts to establish tracking connection
+
+struct cache_entry_s;
+
+/* NOTE: session waiting for a reply to identical command sent by another one */
+typedef struct cache_waiter_s {
+	struct cache_waiter_s *next;
+	struct cache_entry_s *entry;
+	void (*wake)(void *arg);
+	void *arg;
+} cache_waiter_t;
+
+/* NOTE: entry is keyed by the whole command as sent by a client (and selected database),
+         its first argument is the redis key it gets invalidated by; pending entry is
+         the one whose reply is yet to come from redis (kept on flight list instead of
+         CLOCK ring, reusing its links) */
+typedef struct cache_entry_s {
+	struct cache_entry_s *next, *clock_prev, *clock_next;
+	char *request, *key, *reply;
+	int reqlen, keylen, replen, db;
+	time_t expire;
+	int refs;
+	cache_waiter_t *waiters;
+	char linked, referenced, pending;
+} cache_entry_t;
+
+typedef struct {
+	char *commands;
+	const char **keys;
+	long long memory, used, entry_max;
+	int ttl;
+	cache_entry_t **bucket, *hand, *flight;
+	unsigned int buckets;
+	int ready, handshake;
+	struct event_base *eb;
+	struct bufferevent *be;
+	struct event *retry;
+	struct sockaddr sa;
+	resp_t *auth, *hello, *tracking;
+	resp_reply_t rr;
+	uint64_t hits, misses, merges, fills, invalidations;
+} cache_t;
+
+cache_t *cache_create(config_setting_t *config);
+void cache_destroy(cache_t *cache);
+void cache_start(cache_t *cache, struct event_base *eb, struct sockaddr *sa, resp_t *auth);
+int cache_cacheable(cache_t *cache, int cmd, const char *key, int keylen);
+void cache_touch(cache_t *cache, int cmd, const char *key, int keylen);
+cache_entry_t *cache_get(cache_t *cache, int db, const char *request, int reqlen, const char *key, int keylen);
+cache_entry_t *cache_reserve(cache_t *cache, int db, const char *request, int reqlen, const char *key, int keylen);
+void cache_fill(cache_t *cache, cache_entry_t *entry, struct evbuffer *eb, int offset, int len, int store);
+void cache_abandon(cache_t *cache, cache_entry_t *entry);
+void cache_wait(cache_entry_t *entry, cache_waiter_t *waiter);
+void cache_unwait(cache_waiter_t *waiter);
+void cache_release(cache_t *cache, cache_entry_t *entry);
+void cache_clear(cache_t *cache);
+void cache_log(cache_t *cache, const char *what);
+
+#endif
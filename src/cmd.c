@@ -0,0 +1,326 @@
+/*
+   Copyright (c) 2018-2019, Seznam.cz, a.s.
+
+   Author: Daniel Bilik (daniel.bilik@firma.seznam.cz)
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+   PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+   BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+   POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "cmd.h"
+
+/* NOTE: entries have to be kept sorted (bytewise, lowercase), first one is reserved for unknown commands */
+const cmd_t cmd_table[] = {
+	{ "(unknown)", 0 },
+	{ "acl", 0 },
+	{ "append", CMD_WRITE, 1, 1, 1 },
+	{ "asking", 0 },
+	{ "auth", 0 },
+	{ "bgrewriteaof", 0 },
+	{ "bgsave", 0 },
+	{ "bitcount", CMD_READ, 1, 1, 1 },
+	{ "bitfield", CMD_WRITE, 1, 1, 1 },
+	{ "bitfield_ro", CMD_READ, 1, 1, 1 },
+	{ "bitop", CMD_WRITE, 2, -1, 1 },
+	{ "bitpos", CMD_READ, 1, 1, 1 },
+	{ "blmove", CMD_WRITE | CMD_BLOCKING, 1, 2, 1 },
+	{ "blmpop", CMD_WRITE | CMD_BLOCKING, 3, 3, 1, 2 },
+	{ "blpop", CMD_WRITE | CMD_BLOCKING, 1, -2, 1 },
+	{ "brpop", CMD_WRITE | CMD_BLOCKING, 1, -2, 1 },
+	{ "brpoplpush", CMD_WRITE | CMD_BLOCKING, 1, 2, 1 },
+	{ "bzmpop", CMD_WRITE | CMD_BLOCKING, 3, 3, 1, 2 },
+	{ "bzpopmax", CMD_WRITE | CMD_BLOCKING, 1, -2, 1 },
+	{ "bzpopmin", CMD_WRITE | CMD_BLOCKING, 1, -2, 1 },
+	{ "client", 0 },
+	{ "cluster", 0 },
+	{ "command", 0 },
+	{ "config", 0 },
+	{ "copy", CMD_WRITE, 1, 2, 1 },
+	{ "dbsize", CMD_READ },
+	{ "debug", 0 },
+	{ "decr", CMD_WRITE, 1, 1, 1 },
+	{ "decrby", CMD_WRITE, 1, 1, 1 },
+	{ "del", CMD_WRITE, 1, -1, 1 },
+	{ "discard", CMD_TX_END },
+	{ "dump", CMD_READ, 1, 1, 1 },
+	{ "echo", 0 },
+	{ "eval", CMD_WRITE, 0, 0, 0, 2 },
+	{ "eval_ro", CMD_READ, 0, 0, 0, 2 },
+	{ "evalsha", CMD_WRITE, 0, 0, 0, 2 },
+	{ "evalsha_ro", CMD_READ, 0, 0, 0, 2 },
+	{ "exec", CMD_TX_END },
+	{ "exists", CMD_READ, 1, -1, 1 },
+	{ "expire", CMD_WRITE, 1, 1, 1 },
+	{ "expireat", CMD_WRITE, 1, 1, 1 },
+	{ "expiretime", CMD_READ, 1, 1, 1 },
+	{ "failover", 0 },
+	{ "fcall", CMD_WRITE, 0, 0, 0, 2 },
+	{ "fcall_ro", CMD_READ, 0, 0, 0, 2 },
+	{ "flushall", CMD_FLUSH | CMD_WRITE },
+	{ "flushdb", CMD_FLUSH | CMD_WRITE },
+	{ "function", 0 },
+	{ "geoadd", CMD_WRITE, 1, 1, 1 },
+	{ "geodist", CMD_READ, 1, 1, 1 },
+	{ "geohash", CMD_READ, 1, 1, 1 },
+	{ "geopos", CMD_READ, 1, 1, 1 },
+	{ "georadius", CMD_STORE | CMD_WRITE, 1, 1, 1 },
+	{ "georadius_ro", CMD_READ, 1, 1, 1 },
+	{ "georadiusbymember", CMD_STORE | CMD_WRITE, 1, 1, 1 },
+	{ "georadiusbymember_ro", CMD_READ, 1, 1, 1 },
+	{ "geosearch", CMD_READ, 1, 1, 1 },
+	{ "geosearchstore", CMD_WRITE, 1, 2, 1 },
+	{ "get", CMD_READ, 1, 1, 1 },
+	{ "getbit", CMD_READ, 1, 1, 1 },
+	{ "getdel", CMD_WRITE, 1, 1, 1 },
+	{ "getex", CMD_WRITE, 1, 1, 1 },
+	{ "getrange", CMD_READ, 1, 1, 1 },
+	{ "getset", CMD_WRITE, 1, 1, 1 },
+	{ "hdel", CMD_WRITE, 1, 1, 1 },
+	{ "hello", CMD_PROTOCOL },
+	{ "hexists", CMD_READ, 1, 1, 1 },
+	{ "hget", CMD_READ, 1, 1, 1 },
+	{ "hgetall", CMD_READ, 1, 1, 1 },
+	{ "hincrby", CMD_WRITE, 1, 1, 1 },
+	{ "hincrbyfloat", CMD_WRITE, 1, 1, 1 },
+	{ "hkeys", CMD_READ, 1, 1, 1 },
+	{ "hlen", CMD_READ, 1, 1, 1 },
+	{ "hmget", CMD_READ, 1, 1, 1 },
+	{ "hmset", CMD_WRITE, 1, 1, 1 },
+	{ "hrandfield", CMD_READ, 1, 1, 1 },
+	{ "hscan", CMD_READ, 1, 1, 1 },
+	{ "hset", CMD_WRITE, 1, 1, 1 },
+	{ "hsetnx", CMD_WRITE, 1, 1, 1 },
+	{ "hstrlen", CMD_READ, 1, 1, 1 },
+	{ "hvals", CMD_READ, 1, 1, 1 },
+	{ "incr", CMD_WRITE, 1, 1, 1 },
+	{ "incrby", CMD_WRITE, 1, 1, 1 },
+	{ "incrbyfloat", CMD_WRITE, 1, 1, 1 },
+	{ "info", 0 },
+	{ "keys", CMD_READ },
+	{ "lastsave", 0 },
+	{ "latency", 0 },
+	{ "lcs", CMD_READ, 1, 2, 1 },
+	{ "lindex", CMD_READ, 1, 1, 1 },
+	{ "linsert", CMD_WRITE, 1, 1, 1 },
+	{ "llen", CMD_READ, 1, 1, 1 },
+	{ "lmove", CMD_WRITE, 1, 2, 1 },
+	{ "lmpop", CMD_WRITE, 2, 2, 1, 1 },
+	{ "lolwut", 0 },
+	{ "lpop", CMD_WRITE, 1, 1, 1 },
+	{ "lpos", CMD_READ, 1, 1, 1 },
+	{ "lpush", CMD_WRITE, 1, 1, 1 },
+	{ "lpushx", CMD_WRITE, 1, 1, 1 },
+	{ "lrange", CMD_READ, 1, 1, 1 },
+	{ "lrem", CMD_WRITE, 1, 1, 1 },
+	{ "lset", CMD_WRITE, 1, 1, 1 },
+	{ "ltrim", CMD_WRITE, 1, 1, 1 },
+	{ "memory", 0 },
+	{ "mget", CMD_READ, 1, -1, 1 },
+	{ "migrate", 0 },
+	{ "module", 0 },
+	{ "monitor", CMD_UNTRACKED },
+	{ "move", CMD_WRITE, 1, 1, 1 },
+	{ "mset", CMD_WRITE, 1, -1, 2 },
+	{ "msetnx", CMD_WRITE, 1, -1, 2 },
+	{ "multi", CMD_TX_BEGIN },
+	{ "object", CMD_READ, 2, 2, 1 },
+	{ "persist", CMD_WRITE, 1, 1, 1 },
+	{ "pexpire", CMD_WRITE, 1, 1, 1 },
+	{ "pexpireat", CMD_WRITE, 1, 1, 1 },
+	{ "pexpiretime", CMD_READ, 1, 1, 1 },
+	{ "pfadd", CMD_WRITE, 1, 1, 1 },
+	{ "pfcount", CMD_READ, 1, -1, 1 },
+	{ "pfdebug", 0 },
+	{ "pfmerge", CMD_WRITE, 1, -1, 1 },
+	{ "pfselftest", 0 },
+	{ "ping", 0 },
+	{ "psetex", CMD_WRITE, 1, 1, 1 },
+	{ "psubscribe", CMD_UNTRACKED | CMD_SUBSCRIBE },
+	{ "psync", CMD_UNTRACKED },
+	{ "pttl", CMD_READ, 1, 1, 1 },
+	{ "publish", 0 },
+	{ "pubsub", 0 },
+	{ "punsubscribe", 0 },
+	{ "quit", 0 },
+	{ "randomkey", CMD_READ },
+	{ "readonly", 0 },
+	{ "readwrite", 0 },
+	{ "rename", CMD_WRITE, 1, 2, 1 },
+	{ "renamenx", CMD_WRITE, 1, 2, 1 },
+	{ "replconf", 0 },
+	{ "replicaof", 0 },
+	{ "reset", CMD_TX_END | CMD_RESET },
+	{ "restore", CMD_WRITE, 1, 1, 1 },
+	{ "restore-asking", 0, 1, 1, 1 },
+	{ "role", 0 },
+	{ "rpop", CMD_WRITE, 1, 1, 1 },
+	{ "rpoplpush", CMD_WRITE, 1, 2, 1 },
+	{ "rpush", CMD_WRITE, 1, 1, 1 },
+	{ "rpushx", CMD_WRITE, 1, 1, 1 },
+	{ "sadd", CMD_WRITE, 1, 1, 1 },
+	{ "save", 0 },
+	{ "scan", CMD_READ },
+	{ "scard", CMD_READ, 1, 1, 1 },
+	{ "script", 0 },
+	{ "sdiff", CMD_READ, 1, -1, 1 },
+	{ "sdiffstore", CMD_WRITE, 1, -1, 1 },
+	{ "select", CMD_SELECT },
+	{ "set", CMD_WRITE, 1, 1, 1 },
+	{ "setbit", CMD_WRITE, 1, 1, 1 },
+	{ "setex", CMD_WRITE, 1, 1, 1 },
+	{ "setnx", CMD_WRITE, 1, 1, 1 },
+	{ "setrange", CMD_WRITE, 1, 1, 1 },
+	{ "shutdown", 0 },
+	{ "sinter", CMD_READ, 1, -1, 1 },
+	{ "sintercard", CMD_READ, 2, 2, 1, 1 },
+	{ "sinterstore", CMD_WRITE, 1, -1, 1 },
+	{ "sismember", CMD_READ, 1, 1, 1 },
+	{ "slaveof", 0 },
+	{ "slowlog", 0 },
+	{ "smembers", CMD_READ, 1, 1, 1 },
+	{ "smismember", CMD_READ, 1, 1, 1 },
+	{ "smove", CMD_WRITE, 1, 2, 1 },
+	{ "sort", CMD_STORE | CMD_WRITE, 1, 1, 1 },
+	{ "sort_ro", CMD_READ, 1, 1, 1 },
+	{ "spop", CMD_WRITE, 1, 1, 1 },
+	{ "spublish", 0 },
+	{ "srandmember", CMD_READ, 1, 1, 1 },
+	{ "srem", CMD_WRITE, 1, 1, 1 },
+	{ "sscan", CMD_READ, 1, 1, 1 },
+	{ "ssubscribe", CMD_UNTRACKED },
+	{ "strlen", CMD_READ, 1, 1, 1 },
+	{ "subscribe", CMD_UNTRACKED | CMD_SUBSCRIBE },
+	{ "substr", CMD_READ, 1, 1, 1 },
+	{ "sunion", CMD_READ, 1, -1, 1 },
+	{ "sunionstore", CMD_WRITE, 1, -1, 1 },
+	{ "sunsubscribe", 0 },
+	{ "swapdb", CMD_FLUSH | CMD_WRITE },
+	{ "sync", CMD_UNTRACKED },
+	{ "time", 0 },
+	{ "touch", CMD_READ, 1, -1, 1 },
+	{ "ttl", CMD_READ, 1, 1, 1 },
+	{ "type", CMD_READ, 1, 1, 1 },
+	{ "unlink", CMD_WRITE, 1, -1, 1 },
+	{ "unsubscribe", 0 },
+	{ "unwatch", 0 },
+	{ "wait", CMD_BLOCKING },
+	{ "waitaof", CMD_BLOCKING },
+	{ "watch", 0, 1, -1, 1 },
+	{ "xack", CMD_WRITE, 1, 1, 1 },
+	{ "xadd", CMD_WRITE, 1, 1, 1 },
+	{ "xautoclaim", CMD_WRITE, 1, 1, 1 },
+	{ "xclaim", CMD_WRITE, 1, 1, 1 },
+	{ "xdel", CMD_WRITE, 1, 1, 1 },
+	{ "xgroup", CMD_WRITE, 2, 2, 1 },
+	{ "xinfo", CMD_READ, 2, 2, 1 },
+	{ "xlen", CMD_READ, 1, 1, 1 },
+	{ "xpending", CMD_READ, 1, 1, 1 },
+	{ "xrange", CMD_READ, 1, 1, 1 },
+	{ "xread", CMD_READ | CMD_BLOCKING },
+	{ "xreadgroup", CMD_WRITE | CMD_BLOCKING },
+	{ "xrevrange", CMD_READ, 1, 1, 1 },
+	{ "xsetid", CMD_WRITE, 1, 1, 1 },
+	{ "xtrim", CMD_WRITE, 1, 1, 1 },
+	{ "zadd", CMD_WRITE, 1, 1, 1 },
+	{ "zcard", CMD_READ, 1, 1, 1 },
+	{ "zcount", CMD_READ, 1, 1, 1 },
+	{ "zdiff", CMD_READ, 2, 2, 1, 1 },
+	{ "zdiffstore", CMD_WRITE, 1, 1, 1, 2 },
+	{ "zincrby", CMD_WRITE, 1, 1, 1 },
+	{ "zinter", CMD_READ, 2, 2, 1, 1 },
+	{ "zintercard", CMD_READ, 2, 2, 1, 1 },
+	{ "zinterstore", CMD_WRITE, 1, 1, 1, 2 },
+	{ "zlexcount", CMD_READ, 1, 1, 1 },
+	{ "zmpop", CMD_WRITE, 2, 2, 1, 1 },
+	{ "zmscore", CMD_READ, 1, 1, 1 },
+	{ "zpopmax", CMD_WRITE, 1, 1, 1 },
+	{ "zpopmin", CMD_WRITE, 1, 1, 1 },
+	{ "zrandmember", CMD_READ, 1, 1, 1 },
+	{ "zrange", CMD_READ, 1, 1, 1 },
+	{ "zrangebylex", CMD_READ, 1, 1, 1 },
+	{ "zrangebyscore", CMD_READ, 1, 1, 1 },
+	{ "zrangestore", CMD_WRITE, 1, 2, 1 },
+	{ "zrank", CMD_READ, 1, 1, 1 },
+	{ "zrem", CMD_WRITE, 1, 1, 1 },
+	{ "zremrangebylex", CMD_WRITE, 1, 1, 1 },
+	{ "zremrangebyrank", CMD_WRITE, 1, 1, 1 },
+	{ "zremrangebyscore", CMD_WRITE, 1, 1, 1 },
+	{ "zrevrange", CMD_READ, 1, 1, 1 },
+	{ "zrevrangebylex", CMD_READ, 1, 1, 1 },
+	{ "zrevrangebyscore", CMD_READ, 1, 1, 1 },
+	{ "zrevrank", CMD_READ, 1, 1, 1 },
+	{ "zscan", CMD_READ, 1, 1, 1 },
+	{ "zscore", CMD_READ, 1, 1, 1 },
+	{ "zunion", CMD_READ, 2, 2, 1, 1 },
+	{ "zunionstore", CMD_WRITE, 1, 1, 1, 2 },
+};
+
+const int cmd_count = sizeof(cmd_table) / sizeof(cmd_t);
+
+int cmd_compare(const char *name, int len, const char *entry)
+{
+	int i, c;
+
+	for (i = 0; i < len; i++) {
+		if (entry[i] == '\0')
+			return(1);
+		if ((c = tolower((unsigned char)name[i]) - entry[i]) != 0)
+			return(c);
+	}
+
+	return((entry[i] == '\0') ? 0:-1);
+}
+
+int cmd_lookup(const char *name, int len)
+{
+	int low = 1, high = cmd_count - 1, middle, c;
+
+	if (name == NULL)
+		return(CMD_UNKNOWN);
+
+	while (low <= high) {
+		middle = (low + high) / 2;
+		if ((c = cmd_compare(name, len, cmd_table[middle].name)) == 0)
+			return(middle);
+		if (c < 0)
+			high = middle - 1;
+		else
+			low = middle + 1;
+	}
+
+	return(CMD_UNKNOWN);
+}
+
+/* NOTE: tells whether argument arg (command name being zeroth) of a command with args
+         parts (name included) is a key */
+int cmd_key(int cmd, int arg, int args)
+{
+	const cmd_t *c = &cmd_table[cmd];
+	int last = (c->last < 0) ? args + c->last:c->last;
+
+	return((c->first > 0) && (arg >= c->first) && (arg <= last) && ((arg - c->first) % c->step == 0));
+}
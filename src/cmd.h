@@ -0,0 +1,36 @@
+#ifndef CMD_H
+#define CMD_H
+
+#define CMD_UNKNOWN 0
+
+#define CMD_UNTRACKED 0x01 // replies can't be paired with commands anymore once it's passed
+#define CMD_TX_BEGIN 0x02 // starts a transaction
+#define CMD_TX_END 0x04 // ends a transaction
+#define CMD_SELECT 0x08 // changes selected database
+#define CMD_RESET 0x10 // resets connection state (database, protocol)
+#define CMD_PROTOCOL 0x20 // may change protocol (and thus encoding) of replies
+#define CMD_FLUSH 0x40 // changes keys without them being invalidated one by one
+#define CMD_SUBSCRIBE 0x80 // subscribes to channels (or patterns), see 'shared_pubsub'
+#define CMD_READ 0x100 // reads keys (or the keyspace)
+#define CMD_WRITE 0x200 // may change keys
+#define CMD_BLOCKING 0x400 // may block the connection until a key changes (or a timeout)
+#define CMD_STORE 0x800 // may store its result to a key following 'store' (or 'storedist') argument
+
+/* NOTE: keys are arguments first to last (counted from the end when negative), every
+         step-th of them; commands taking keys by 'numkeys' have their first key only
+         there, numkeys is an index of the argument giving their count, keys follow it;
+         those with no fixed key position (scripts, 'xread') have none */
+typedef struct {
+	const char *name;
+	int flags;
+	int first, last, step;
+	int numkeys;
+} cmd_t;
+
+extern const cmd_t cmd_table[];
+extern const int cmd_count;
+
+int cmd_lookup(const char *name, int len);
+int cmd_key(int cmd, int arg, int args);
+
+#endif
@@ -0,0 +1,306 @@
+/*
+   Copyright (c) 2018-2019, Seznam.cz, a.s.
+
+   Author: Daniel Bilik (daniel.bilik@firma.seznam.cz)
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+   PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+   BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+   POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <libconfig.h>
+#include <event.h>
+
+#include "log.h"
+#include "hotkeys.h"
+
+/* NOTE: the whole sketch is kept by the proxy thread only, just entries of the hottest
+         keys (and number of samples taken) are read from elsewhere; a command is
+         sampled after a random number of others (one of 'sample' on average), so that
+         there's nothing but a decrement for the rest of them */
+
+uint64_t hotkeys_hash(const char *key, int keylen)
+{
+	uint64_t h = 14695981039346656037ull;
+
+	while (keylen-- > 0)
+		h = (h ^ (unsigned char)*key++) * 1099511628211ull;
+
+	return(h);
+}
+
+uint32_t hotkeys_skip(hotkeys_t *hotkeys)
+{
+	uint32_t r = hotkeys->random;
+
+	r ^= r << 13;
+	r ^= r >> 17;
+	r ^= r << 5;
+	hotkeys->random = r;
+
+	return(1 + r % (2 * hotkeys->sample - 1));
+}
+
+/* NOTE: rows are indexed by two halves of a single hash combined (Kirsch-Mitzenmacher),
+         the estimate is the least sum of both sketch halves */
+uint32_t hotkeys_estimate(hotkeys_t *hotkeys, uint64_t hash, int add)
+{
+	uint32_t *cur = hotkeys->sketch[hotkeys->current], *prev = hotkeys->sketch[hotkeys->current ^ 1];
+	uint32_t h1 = (uint32_t)hash, h2 = (uint32_t)(hash >> 32) | 1, c, est = UINT32_MAX;
+	int d, i;
+
+	for (d = 0; d < HOTKEYS_DEPTH; d++) {
+		i = d * HOTKEYS_WIDTH + ((h1 + d * h2) & (HOTKEYS_WIDTH - 1));
+		cur[i] += add;
+		c = cur[i] + prev[i];
+		if (c < est)
+			est = c;
+	}
+
+	return(est);
+}
+
+void hotkeys_swap(hotkeys_t *hotkeys, int i, int j)
+{
+	int slot = hotkeys->heap[i];
+
+	hotkeys->heap[i] = hotkeys->heap[j];
+	hotkeys->heap[j] = slot;
+}
+
+void hotkeys_sift_up(hotkeys_t *hotkeys, int i)
+{
+	int parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (hotkeys->entry[hotkeys->heap[parent]].count <= hotkeys->entry[hotkeys->heap[i]].count)
+			break;
+		hotkeys_swap(hotkeys, i, parent);
+		i = parent;
+	}
+}
+
+void hotkeys_sift_down(hotkeys_t *hotkeys, int i)
+{
+	int least, child;
+
+	while (1) {
+		least = i;
+		for (child = 2 * i + 1; (child <= 2 * i + 2) && (child < hotkeys->used); child++)
+			if (hotkeys->entry[hotkeys->heap[child]].count < hotkeys->entry[hotkeys->heap[least]].count)
+				least = child;
+		if (least == i)
+			break;
+		hotkeys_swap(hotkeys, i, least);
+		i = least;
+	}
+}
+
+/* NOTE: entry is updated in place (count and hits of acl, or all of its hits halved
+         when acl is negative) or taken over by another key (key is given then), always
+         between odd and even seq */
+void hotkeys_write(hotkeys_t *hotkeys, int slot, uint64_t hash, uint32_t count, const char *key, int keylen, int acl)
+{
+	hotkeys_entry_t *e = &hotkeys->entry[slot];
+	uint32_t *hits = &hotkeys->hits[slot * (hotkeys->acls + 1)];
+	uint32_t seq = e->seq;
+	int i;
+
+	__atomic_store_n(&e->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	if (key) {
+		e->hash = hash;
+		e->keylen = keylen;
+		memcpy(e->key, key, (keylen < HOTKEYS_KEY_MAX) ? keylen:HOTKEYS_KEY_MAX);
+		memset(hits, 0, (hotkeys->acls + 1) * sizeof(uint32_t));
+	}
+	e->count = count;
+	if (acl >= 0)
+		hits[acl]++;
+	else
+		for (i = 0; i <= hotkeys->acls; i++)
+			hits[i] /= 2;
+
+	__atomic_store_n(&e->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void hotkeys_count(hotkeys_t *hotkeys, const char *key, int keylen, int acl)
+{
+	uint64_t hash = hotkeys_hash(key, keylen);
+	uint32_t est = hotkeys_estimate(hotkeys, hash, 1);
+	int i, slot;
+
+	for (i = 0; i < hotkeys->used; i++) {
+		if (hotkeys->entry[hotkeys->heap[i]].hash == hash) {
+			hotkeys_write(hotkeys, hotkeys->heap[i], hash, est, NULL, 0, acl);
+			hotkeys_sift_down(hotkeys, i);
+			return;
+		}
+	}
+
+	if (hotkeys->used < hotkeys->top) {
+		slot = hotkeys->heap[hotkeys->used] = hotkeys->used;
+		hotkeys_write(hotkeys, slot, hash, est, key, keylen, acl);
+		__atomic_store_n(&hotkeys->used, hotkeys->used + 1, __ATOMIC_RELEASE);
+		hotkeys_sift_up(hotkeys, hotkeys->used - 1);
+		return;
+	}
+
+	/* NOTE: the coldest one of the hottest keys is replaced only by a hotter one */
+	if (est > hotkeys->entry[hotkeys->heap[0]].count) {
+		hotkeys_write(hotkeys, hotkeys->heap[0], hash, est, key, keylen, acl);
+		hotkeys_sift_down(hotkeys, 0);
+	}
+}
+
+void hotkeys_sample(hotkeys_t *hotkeys, const char *key, int keylen, acl_t *acl)
+{
+	if (--hotkeys->next > 0)
+		return;
+
+	hotkeys->next = hotkeys_skip(hotkeys);
+
+	hotkeys_count(hotkeys, key, keylen, (acl) ? acl->index + 1:0);
+
+	__atomic_fetch_add(&hotkeys->sampled, 1, __ATOMIC_RELAXED);
+}
+
+/* NOTE: every half a window the older half of the sketch is cleared and becomes the
+         current one, counts of the hottest keys are estimated anew and their hits
+         halved, so that keys no longer hit fade away within a window */
+void hotkeys_rotate(evutil_socket_t fd, short events, void *arg)
+{
+	hotkeys_t *hotkeys = (hotkeys_t *)arg;
+	int i;
+
+	hotkeys->current ^= 1;
+	memset(hotkeys->sketch[hotkeys->current], 0, HOTKEYS_DEPTH * HOTKEYS_WIDTH * sizeof(uint32_t));
+
+	for (i = 0; i < hotkeys->used; i++)
+		hotkeys_write(hotkeys, i, 0, hotkeys_estimate(hotkeys, hotkeys->entry[i].hash, 0), NULL, 0, -1);
+
+	for (i = hotkeys->used / 2 - 1; i >= 0; i--)
+		hotkeys_sift_down(hotkeys, i);
+}
+
+/* NOTE: copies out entries still counted, dst must hold 'top' of them, hits 'top'
+         times number of acl entries plus one */
+int hotkeys_read(hotkeys_t *hotkeys, hotkeys_entry_t *dst, uint32_t *hits)
+{
+	int used = __atomic_load_n(&hotkeys->used, __ATOMIC_ACQUIRE);
+	int i, n = 0, size = (hotkeys->acls + 1) * sizeof(uint32_t);
+	hotkeys_entry_t *e;
+	uint32_t seq;
+
+	for (i = 0; i < used; i++) {
+		e = &hotkeys->entry[i];
+		do {
+			while ((seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE)) & 1);
+			memcpy(&dst[n], e, sizeof(hotkeys_entry_t));
+			memcpy(&hits[n * (hotkeys->acls + 1)], &hotkeys->hits[i * (hotkeys->acls + 1)], size);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		} while (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) != seq);
+		if (dst[n].count > 0)
+			n++;
+	}
+
+	return(n);
+}
+
+hotkeys_t *hotkeys_create(config_setting_t *config, int acls)
+{
+	hotkeys_t *hotkeys;
+
+	if ((hotkeys = (hotkeys_t *)malloc(sizeof(hotkeys_t))) == NULL) {
+		LOG(E1, "malloc() failed, %s", strerror(errno));
+		return(NULL);
+	}
+
+	memset(hotkeys, 0, sizeof(hotkeys_t));
+
+	hotkeys->sample = HOTKEYS_SAMPLE;
+	hotkeys->top = HOTKEYS_TOP;
+	hotkeys->window = HOTKEYS_WINDOW;
+	hotkeys->acls = acls;
+
+	config_setting_lookup_int(config, "sample", &hotkeys->sample);
+	config_setting_lookup_int(config, "top", &hotkeys->top);
+	config_setting_lookup_int(config, "window", &hotkeys->window);
+
+	if ((hotkeys->sample < 1) || (hotkeys->sample > 65536) || (hotkeys->top < 1) || (hotkeys->top > 1024) || (hotkeys->window < 2)) {
+		LOG(E1, "invalid 'hotkeys' 'sample', 'top' or 'window'");
+		free(hotkeys);
+		return(NULL);
+	}
+
+	if (((hotkeys->sketch[0] = (uint32_t *)calloc(2 * HOTKEYS_DEPTH * HOTKEYS_WIDTH, sizeof(uint32_t))) == NULL) ||
+		((hotkeys->entry = (hotkeys_entry_t *)calloc(hotkeys->top, sizeof(hotkeys_entry_t))) == NULL) ||
+		((hotkeys->hits = (uint32_t *)calloc(hotkeys->top * (acls + 1), sizeof(uint32_t))) == NULL) ||
+		((hotkeys->heap = (int *)calloc(hotkeys->top, sizeof(int))) == NULL)) {
+		LOG(E1, "calloc() failed, %s", strerror(errno));
+		hotkeys_destroy(hotkeys);
+		return(NULL);
+	}
+
+	hotkeys->sketch[1] = hotkeys->sketch[0] + HOTKEYS_DEPTH * HOTKEYS_WIDTH;
+	hotkeys->random = 2463534242u ^ (uint32_t)(uintptr_t)hotkeys;
+	if (hotkeys->random == 0)
+		hotkeys->random = 2463534242u;
+	hotkeys->next = hotkeys_skip(hotkeys);
+
+	return(hotkeys);
+}
+
+void hotkeys_destroy(hotkeys_t *hotkeys)
+{
+	if (hotkeys == NULL)
+		return;
+
+	if (hotkeys->rotate)
+		event_free(hotkeys->rotate);
+
+	free(hotkeys->sketch[0]);
+	free(hotkeys->entry);
+	free(hotkeys->hits);
+	free(hotkeys->heap);
+	free(hotkeys);
+}
+
+void hotkeys_start(hotkeys_t *hotkeys, struct event_base *eb)
+{
+	struct timeval tv;
+
+	if (hotkeys == NULL)
+		return;
+
+	tv.tv_sec = hotkeys->window / 2;
+	tv.tv_usec = (hotkeys->window % 2) * 500000;
+
+	if (((hotkeys->rotate = event_new(eb, -1, EV_PERSIST, hotkeys_rotate, hotkeys)) == NULL) || (event_add(hotkeys->rotate, &tv) == -1))
+		LOG(E1, "event_new() failed, hotkeys won't fade away");
+}
@@ -0,0 +1,51 @@
+#ifndef HOTKEYS_H
+#define HOTKEYS_H
+
+#include <stdint.h>
+#include <libconfig.h>
+#include <event.h>
+
+#include "acl.h"
+
+#define HOTKEYS_DEPTH 4 // rows of count-min sketch
+#define HOTKEYS_WIDTH 4096 // counters per row, power of two
+#define HOTKEYS_KEY_MAX 64 // (prefix of) key kept with an entry
+#define HOTKEYS_SAMPLE 16 // default, one of this many commands is sampled (on average)
+#define HOTKEYS_TOP 32 // default number of the hottest keys kept
+#define HOTKEYS_WINDOW 60 // default window in seconds keys are counted over
+
+/* NOTE: seq is odd while an entry is being written, reader retries until it gets
+         the same even value before and after copying the entry out (along with its
+         hits, kept aside as their number depends on acl entries configured) */
+typedef struct {
+	uint32_t seq;
+	uint64_t hash;
+	uint32_t count;
+	int keylen;
+	char key[HOTKEYS_KEY_MAX];
+} hotkeys_entry_t;
+
+/* NOTE: keys sampled are counted in a count-min sketch of two halves, the current one
+         and the previous one, they're rotated every half a window; the hottest keys are
+         kept in a min-heap of entries, each with samples per acl entry (index plus one,
+         zero when none is used); written by a single proxy thread only, read lock-free
+         by anyone else */
+typedef struct {
+	int sample, top, window, acls;
+	uint32_t next, random;
+	uint32_t *sketch[2];
+	int current;
+	hotkeys_entry_t *entry;
+	uint32_t *hits;
+	int *heap, used;
+	struct event *rotate;
+	uint64_t sampled;
+} hotkeys_t;
+
+hotkeys_t *hotkeys_create(config_setting_t *config, int acls);
+void hotkeys_destroy(hotkeys_t *hotkeys);
+void hotkeys_start(hotkeys_t *hotkeys, struct event_base *eb);
+void hotkeys_sample(hotkeys_t *hotkeys, const char *key, int keylen, acl_t *acl);
+int hotkeys_read(hotkeys_t *hotkeys, hotkeys_entry_t *dst, uint32_t *hits);
+
+#endif
@@ -29,8 +29,11 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <time.h>
 #include <stdarg.h>
+#include <pthread.h>
+#include <sys/uio.h>
 
 #include "log.h"
 
@@ -40,7 +43,28 @@ struct logmask_t {
 	char err, warn, info, debug, fatal;
 } logmask;
 
-FILE *logfile = NULL;
+/* NOTE: messages are formatted by a thread logging them into a ring of its own (single
+         producer, single consumer), a writer thread moves whole lines from all of them
+         to a file by writev(); until the writer is started (ie. before forking to
+         background), lines are written right away */
+typedef struct log_ring_s {
+	struct log_ring_s *next;
+	char *data;
+	uint64_t head __attribute__((aligned(64)));
+	uint64_t tail __attribute__((aligned(64)));
+} log_ring_t;
+
+char log_threshold[16];
+
+int log_fd = -1, log_async = 0, log_stop = 0, log_running = 0, log_atexit = 0;
+uint64_t log_dropped_count = 0, log_dropped_reported = 0;
+log_ring_t *log_rings = NULL;
+pthread_t log_thread;
+pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+__thread log_ring_t *log_ring = NULL;
+__thread time_t log_time = 0;
+__thread char log_now[20];
 
 void
 log_set_mask(const char *mask)
@@ -90,142 +114,319 @@ log_set_mask(const char *mask)
 		}
 		mask++;
 	}
+
+	log_threshold[E0 >> 4] = logmask.err;
+	log_threshold[W0 >> 4] = logmask.warn;
+	log_threshold[I0 >> 4] = logmask.info;
+	log_threshold[D0 >> 4] = logmask.debug;
+	log_threshold[F0 >> 4] = logmask.fatal;
+}
+
+log_ring_t *
+log_ring_get(void)
+{
+	log_ring_t *ring;
+
+	if (log_ring)
+		return(log_ring);
+
+	if ((ring = (log_ring_t *)malloc(sizeof(log_ring_t))) == NULL)
+		return(NULL);
+
+	memset(ring, 0, sizeof(log_ring_t));
+
+	if ((ring->data = (char *)malloc(LOG_RING_SIZE)) == NULL) {
+		free(ring);
+		return(NULL);
+	}
+
+	ring->next = __atomic_load_n(&log_rings, __ATOMIC_RELAXED);
+
+	while (!__atomic_compare_exchange_n(&log_rings, &ring->next, ring, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	log_ring = ring;
+
+	return(ring);
+}
+
+int
+log_enqueue(const char *line, int len)
+{
+	log_ring_t *ring = log_ring_get();
+	uint64_t head, offset;
+	int first;
+
+	if ((ring == NULL) || (LOG_RING_SIZE - (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) < len)) {
+		__atomic_fetch_add(&log_dropped_count, 1, __ATOMIC_RELAXED);
+		return(-1);
+	}
+
+	head = ring->head;
+	offset = head & (LOG_RING_SIZE - 1);
+	first = (len < LOG_RING_SIZE - offset) ? len:LOG_RING_SIZE - offset;
+
+	memcpy(ring->data + offset, line, first);
+	memcpy(ring->data, line + first, len - first);
+
+	__atomic_store_n(&ring->head, head + len, __ATOMIC_RELEASE);
+
+	return(0);
+}
+
+/* NOTE: called by writer thread holding log_lock, gathers everything written to rings
+         so far into a single writev() (two iovecs per ring at most, as data may wrap) */
+int
+log_flush(void)
+{
+	struct iovec iov[LOG_IOV_MAX], *v;
+	log_ring_t *ring[LOG_IOV_MAX / 2], *r;
+	uint64_t head[LOG_IOV_MAX / 2], offset, dropped;
+	char line[128], now[20];
+	int i, n, rings, total = 0;
+	ssize_t written;
+	time_t t;
+	struct tm tm;
+
+	r = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE);
+
+	while (r) {
+		for (n = rings = 0; r && (rings < LOG_IOV_MAX / 2); r = r->next) {
+			if ((head[rings] = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) == r->tail)
+				continue;
+			offset = r->tail & (LOG_RING_SIZE - 1);
+			iov[n].iov_base = r->data + offset;
+			iov[n].iov_len = head[rings] - r->tail;
+			if (iov[n].iov_len > LOG_RING_SIZE - offset) {
+				iov[n + 1].iov_base = r->data;
+				iov[n + 1].iov_len = iov[n].iov_len - (LOG_RING_SIZE - offset);
+				iov[n].iov_len = LOG_RING_SIZE - offset;
+				total += iov[n++].iov_len;
+			}
+			total += iov[n++].iov_len;
+			ring[rings++] = r;
+		}
+		/* NOTE: in case of an error (eg. full disk), messages are lost */
+		for (v = iov; (n > 0) && ((written = writev(log_fd, v, n)) != 0);) {
+			if (written == -1) {
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+			while ((n > 0) && (written >= (ssize_t)v->iov_len)) {
+				written -= v->iov_len;
+				v++;
+				n--;
+			}
+			if (n > 0) {
+				v->iov_base = (char *)v->iov_base + written;
+				v->iov_len -= written;
+			}
+		}
+		for (i = 0; i < rings; i++)
+			__atomic_store_n(&ring[i]->tail, head[i], __ATOMIC_RELEASE);
+	}
+
+	dropped = __atomic_load_n(&log_dropped_count, __ATOMIC_RELAXED);
+
+	if (dropped != log_dropped_reported) {
+		t = time(NULL);
+		localtime_r(&t, &tm);
+		strftime(now, sizeof(now), "%d/%m/%Y %H:%M:%S", &tm);
+		n = snprintf(line, sizeof(line), "%s W1: %llu log messages dropped, ring buffer full\n", now, (unsigned long long)(dropped - log_dropped_reported));
+		if (write(log_fd, line, n) == n)
+			log_dropped_reported = dropped;
+	}
+
+	return(total);
+}
+
+void *
+log_writer(void *arg)
+{
+	int n;
+
+	while (!__atomic_load_n(&log_stop, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_lock(&log_lock);
+		n = log_flush();
+		pthread_mutex_unlock(&log_lock);
+		if (n == 0)
+			usleep(LOG_WRITER_USLEEP);
+	}
+
+	pthread_mutex_lock(&log_lock);
+	log_flush();
+	pthread_mutex_unlock(&log_lock);
+
+	return(NULL);
 }
 
+void log_exit(void);
+
 int
 log_open(const char *path, const char *logmask)
 {
+	int fd = 1;
+
 	log_set_mask(logmask);
 
-	if (path == NULL) {
-		logfile = stdout;
+	if ((path != NULL) && ((fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644)) == -1))
+		return(-1);
+
+	pthread_mutex_lock(&log_lock);
+	log_fd = fd;
+	pthread_mutex_unlock(&log_lock);
+
+	/* NOTE: logging to stdout (before forking to background) is synchronous */
+	if ((path == NULL) || log_running)
 		return(0);
-	}
 
-	if ((logfile = fopen(path, "a")) == NULL)
-		return(-1);
+	log_stop = 0;
 
-	if (setvbuf(logfile, (char *)NULL, _IOLBF, 0) == EOF)
-		return(-1);
+	if (pthread_create(&log_thread, NULL, log_writer, NULL) != 0)
+		return(0);
+
+	log_running = 1;
+	__atomic_store_n(&log_async, 1, __ATOMIC_RELEASE);
+
+	/* NOTE: whatever is left in rings gets written even when exit() is called */
+	if (!log_atexit && (atexit(log_exit) == 0))
+		log_atexit = 1;
 
 	return(0);
 }
 
+/* NOTE: writer is stopped (having flushed all rings), messages logged until
+         the log is opened again wait in rings */
 int
 log_close(void)
 {
-	if (logfile != NULL) {
-		if (logfile == stdout) {
-			logfile = NULL;
-			return(0);
-		}
-		flockfile(logfile);
-		if (fclose(logfile) == 0) {
-			logfile = NULL;
-			return(0);
-		} else
-			return(-2);
-	} else
+	int rc = 0;
+
+	if (log_running) {
+		__atomic_store_n(&log_stop, 1, __ATOMIC_RELEASE);
+		pthread_join(log_thread, NULL);
+		log_running = 0;
+	}
+
+	if (log_fd == -1)
 		return(-1);
+
+	pthread_mutex_lock(&log_lock);
+	if ((log_fd != 1) && (close(log_fd) == -1))
+		rc = -2;
+	log_fd = -1;
+	pthread_mutex_unlock(&log_lock);
+
+	return(rc);
+}
+
+void
+log_exit(void)
+{
+	if (log_running)
+		log_close();
+}
+
+uint64_t
+log_dropped(void)
+{
+	return(__atomic_load_n(&log_dropped_count, __ATOMIC_RELAXED));
+}
+
+int
+log_format(char *dst, int size, const char *message, va_list data)
+{
+	const char *c, *d;
+	int len = 0, i;
+
+	for (c = message; *c && (len < size - 1); c++) {
+		if (*c != '%') {
+			dst[len++] = *c;
+			continue;
+		}
+		c++;
+		switch (*c) {
+		case 's':
+			d = va_arg(data, char *);
+			i = snprintf(dst + len, size - len, "%s", (d == NULL) ? "(null)":d);
+			break;
+		case 'd':
+			i = snprintf(dst + len, size - len, "%d", va_arg(data, signed int));
+			break;
+		case 'u':
+			i = snprintf(dst + len, size - len, "%u", va_arg(data, unsigned int));
+			break;
+		case 'l':
+			i = snprintf(dst + len, size - len, "%ld", va_arg(data, long int));
+			break;
+		case 'f':
+			i = snprintf(dst + len, size - len, "%f", va_arg(data, double));
+			break;
+		case '\0':
+			c--;
+			i = 0;
+			break;
+		default:
+			i = snprintf(dst + len, size - len, "%%%c", *c);
+		}
+		len += (i < size - len) ? i:size - len - 1;
+	}
+
+	return(len);
 }
 
 int
 log_write(char level, char *message, ...)
 {
-	char *fullmessage, a, b, *c, *d;
-	signed int e;
-	unsigned int f;
-	long int g;
-	double h;
-	char now[20] = "";
-	time_t timeunix;
-	struct tm *timestruct;
+	char line[LOG_LINE_MAX], b;
+	int len;
+	time_t now;
+	struct tm tm;
 	va_list data;
 
-	if (logfile == NULL)
+	if ((log_fd == -1) || !LOG_ENABLED(level))
 		return(-1);
 
 	switch (level & 240) {
 	case 16:
-		a = logmask.err;
 		b = 'E';
 		break;
 	case 32:
-		a = logmask.warn;
 		b = 'W';
 		break;
 	case 64:
-		a = logmask.info;
 		b = 'I';
 		break;
 	case 128:
-		a = logmask.debug;
 		b = 'D';
 		break;
 	case 144:
-		a = logmask.fatal;
 		b = 'F';
 		break;
 	default:
-		a = 0;
-		b = 0;
+		return(0);
 	}
 
-	if (a >= (level & 15)) {
-		time(&timeunix);
-		timestruct = localtime(&timeunix);
-		strftime(now, 20, "%d/%m/%Y %H:%M:%S", timestruct);
-		if ((fullmessage = malloc(strlen(now) + strlen(message) + 6)) == NULL) {
-			fprintf(logfile, "malloc() problem: can't allocate memory: %s (%s:%d)\n", strerror(errno), __FILE__, __LINE__);
-			return(-2);
-		}
-		sprintf(fullmessage, "%s %c%d: %s", now, b, (level & 15), message);
-		va_start(data, message);
-		c = fullmessage;
-		while (logfile && ftrylockfile(logfile))
-			usleep(5000);
-		while (*c && logfile) {
-			if ((*c) == '%') {
-				c++;
-				switch (*c) {
-				case 's':
-					d = va_arg(data, char *);
-					if (d == NULL)
-						fprintf(logfile, "(null)");
-					else
-						fprintf(logfile, "%s", d);
-					break;
-				case 'd':
-					e = va_arg(data, signed int);
-					fprintf(logfile, "%d", e);
-					break;
-				case 'u':
-					f = va_arg(data, unsigned int);
-					fprintf(logfile, "%d", f);
-					break;
-				case 'l':
-					g = va_arg(data, long int);
-					fprintf(logfile, "%ld", g);
-					break;
-				case 'f':
-					h = va_arg(data, double);
-					fprintf(logfile, "%f", h);
-					break;
-				default:
-					fprintf(logfile, "%%%c", *c);
-				}
-			}
-			else
-				fprintf(logfile, "%c", *c);
-			c++;
-		}
-		if (logfile)
-			funlockfile(logfile);
-		va_end(data);
-		free(fullmessage);
+	/* NOTE: timestamp is formatted once a second by each thread */
+	if ((now = time(NULL)) != log_time) {
+		localtime_r(&now, &tm);
+		strftime(log_now, sizeof(log_now), "%d/%m/%Y %H:%M:%S", &tm);
+		log_time = now;
 	}
 
-	return(0);
+	len = snprintf(line, sizeof(line), "%s %c%d: ", log_now, b, (level & 15));
+
+	va_start(data, message);
+	len += log_format(line + len, sizeof(line) - len, message, data);
+	va_end(data);
+
+	if (line[len - 1] != '\n')
+		line[len - 1] = '\n';
+
+	if (__atomic_load_n(&log_async, __ATOMIC_ACQUIRE))
+		return(log_enqueue(line, len));
+
+	return((write(log_fd, line, len) == len) ? 0:-2);
 }
 
 void
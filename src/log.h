@@ -2,6 +2,8 @@
 
 #define _LOG_H
 
+#include <stdint.h>
+
 #define	E0	16
 #define	E1	17
 #define	E2	18
@@ -33,15 +35,26 @@
 #define	F4	148
 #define	F5	149
 
+#define	LOG_LINE_MAX	2048
+#define	LOG_RING_SIZE	65536	// per thread, power of two
+#define	LOG_IOV_MAX	64
+#define	LOG_WRITER_USLEEP	10000
+
+/* NOTE: level is checked before arguments are even evaluated */
+#define LOG_ENABLED(level)	(log_threshold[((level) >> 4) & 15] >= ((level) & 15))
+
 #ifdef NLOG
 #define LOG(level, fmt, args...)	do {} while(0)
 #else
-#define LOG(level, fmt, args...)	log_write(level, fmt " (%s:%d)\n", ##args, __FILE__, __LINE__)
+#define LOG(level, fmt, args...)	do { if (LOG_ENABLED(level)) log_write(level, fmt " (%s:%d)\n", ##args, __FILE__, __LINE__); } while(0)
 #endif
 
+extern char log_threshold[16];
+
 int log_open(const char *path, const char *logmask);
 int log_close(void);
 int log_write(char level, char *message, ...);
+uint64_t log_dropped(void);
 void log_dump_mask(void);
 
 #endif
@@ -36,12 +36,16 @@
 #include <getopt.h>
 #include <signal.h>
 #include <pwd.h>
+#include <time.h>
 #include <libconfig.h>
 #include <openssl/ssl.h>
 
 #include "log.h"
 #include "acl.h"
 #include "proxy.h"
+#include "stats.h"
+#include "admin.h"
+#include "upgrade.h"
 
 #define NAME PROJECT_NAME
 #define VERSION PROJECT_VERSION
@@ -88,9 +92,22 @@ signal_handle(int sig)
 	}
 }
 
+/* NOTE: proxies stop accepting and close their sessions once those are in between
+         commands, main loop exits when there are none left (or drain timeout expires) */
+void main_drain(proxy_t **proxy, admin_t *admin)
+{
+	admin_stop(admin);
+
+	while (*proxy)
+		proxy_drain(*(proxy++));
+}
+
 int main(int argc, char **argv)
 {
-	int a, i = 0, daemonize = 1, test = 0;
+	int a, i = 0, daemonize = 1, test = 0, drain_timeout = PROXY_DRAIN_TIMEOUT;
+	time_t draining = 0;
+	uint64_t sessions;
+	char what[256];
 	FILE *pid;
 	struct passwd *process_user = NULL;
 	uid_t process_user_id;
@@ -98,6 +115,7 @@ int main(int argc, char **argv)
 	config_setting_t *s;
 	acl_t **acl;
 	proxy_t **proxy, **p;
+	admin_t *admin = NULL;
 
 	struct option long_options[] = {
 		{"config", required_argument, 0, 'c'},
@@ -114,6 +132,8 @@ int main(int argc, char **argv)
 
 	memset(&config, 0, sizeof(config_t));
 
+	upgrade_init(argv[0], argv);
+
 	while ((a = getopt_long(argc, argv, "c:t:hf", long_options, &i)) != -1)
 		switch (a) {
 		case 'c':
@@ -178,9 +198,11 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 	memset(acl, 0, (i + 1) * sizeof(acl_t *));
-	for (a = 0; a < i; a++)
+	for (a = 0; a < i; a++) {
 		if ((acl[a] = acl_create(config_setting_get_elem(s, a))) == NULL)
 			exit(1);
+		acl[a]->index = a;
+	}
 
 	if (daemonize && !test) {
 		LOG(I1, "forking to background");
@@ -212,6 +234,10 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* NOTE: listeners passed by a previous process (if any) are claimed by proxies */
+	if (upgrade_receive() == -1)
+		exit(1);
+
 	s = config_lookup(&config, "proxy");
 	if (s == NULL) {
 		LOG(E1, "missing 'proxy' configuration");
@@ -231,6 +257,12 @@ int main(int argc, char **argv)
 		if ((proxy[a] = proxy_create(config_setting_get_elem(s, a), acl)) == NULL)
 			exit(1);
 
+	const char *admin_listen = NULL;
+	config_lookup_string(&config, "admin", &admin_listen);
+
+	if (admin_listen && ((admin = admin_create(admin_listen, proxy, acl)) == NULL))
+		exit(1);
+
 	const char *chroot_dir = NULL;
 	config_lookup_string(&config, "chroot", &chroot_dir);
 
@@ -282,17 +314,66 @@ int main(int argc, char **argv)
 	signal(SIGHUP, signal_handle);
 	signal(SIGUSR1, signal_handle);
 	signal(SIGUSR2, signal_handle);
+	signal(SIGPIPE, SIG_IGN);
 
 	p = proxy;
 
 	while (*p)
 		proxy_start(*(p++));
 
+	admin_start(admin);
+
+	upgrade_ready();
+
+	config_lookup_int(&config, "drain_timeout", &drain_timeout);
+
 	while (1) {
-		if (sigterm) {
-			LOG(I1, "got TERM signal, exiting");
+		if (sigterm && draining) {
+			LOG(I1, "got TERM signal while draining, exiting");
 			break;
 		}
+		if (sigterm) {
+			LOG(I1, "got TERM signal, draining sessions for up to %d seconds", drain_timeout);
+			draining = time(NULL) + drain_timeout;
+			sigterm = 0;
+			main_drain(proxy, admin);
+		}
+		if (sigusr2 && !draining) {
+			LOG(I1, "got USR2 signal, upgrading");
+			if (chroot_dir) {
+				LOG(E1, "hot upgrade isn't supported with 'chroot'");
+			} else {
+				for (a = 0; proxy[a]; a++);
+				const char *names[a + 1];
+				int fds[a + 1];
+				for (a = 0; proxy[a]; a++) {
+					names[a] = proxy[a]->name;
+					fds[a] = evconnlistener_get_fd(proxy[a]->ecl);
+				}
+				if (admin) {
+					names[a] = admin->name;
+					fds[a++] = evconnlistener_get_fd(admin->ecl);
+				}
+				if (upgrade_spawn(names, fds, a) != -1) {
+					LOG(I1, "new process is ready, draining sessions for up to %d seconds", drain_timeout);
+					draining = time(NULL) + drain_timeout;
+					main_drain(proxy, admin);
+				}
+			}
+		}
+		sigusr2 = 0;
+		if (draining) {
+			for (p = proxy, sessions = 0; *p; p++)
+				sessions += STATS_GET((*p)->counters->sessions);
+			if (sessions == 0) {
+				LOG(I1, "all sessions drained, exiting");
+				break;
+			}
+			if (time(NULL) >= draining) {
+				LOG(I1, "drain timeout expired with %l sessions left, exiting", (long)sessions);
+				break;
+			}
+		}
 		if (sighup) {
 			LOG(I1, "got HUP signal, closing logfile");
 			log_close();
@@ -300,9 +381,21 @@ int main(int argc, char **argv)
 				LOG(I1, "logfile re-opened");
 			sighup = 0;
 		}
+		if (sigusr1) {
+			LOG(I1, "got USR1 signal, dumping statistics");
+			for (p = proxy; *p; p++)
+				proxy_dump_stats(*p);
+			for (a = 0; acl[a]; a++) {
+				snprintf(what, sizeof(what), "acl '%s'", acl[a]->id);
+				stats_histogram_log(acl[a]->latency, what);
+			}
+			sigusr1 = 0;
+		}
 		usleep(10000);
 	}
 
+	admin_stop(admin);
+
 	p = proxy;
 
 	while (*p)
@@ -0,0 +1,139 @@
+/*
+   Copyright (c) 2018-2019, Seznam.cz, a.s.
+
+   Author: Daniel Bilik (daniel.bilik@firma.seznam.cz)
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+   PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+   BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+   POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "log.h"
+#include "stats.h"
+#include "pool.h"
+
+/* NOTE: object size is rounded up to a cache line, so that no two of them share one */
+pool_t *pool_create(size_t size)
+{
+	pool_t *pool = (pool_t *)malloc(sizeof(pool_t));
+
+	if (pool == NULL) {
+		LOG(E1, "malloc() failed, %s", strerror(errno));
+		return(NULL);
+	}
+
+	memset(pool, 0, sizeof(pool_t));
+
+	pool->size = (size + STATS_CACHELINE - 1) & ~((size_t)STATS_CACHELINE - 1);
+
+	return(pool);
+}
+
+/* NOTE: release is called for each object on the free list, to let go of whatever
+         its owner has kept in it for reuse */
+void pool_destroy(pool_t *pool, void (*release)(void *object))
+{
+	pool_object_t *o;
+	pool_slab_t *s;
+
+	if (pool == NULL)
+		return;
+
+	if (release)
+		for (o = pool->free; o; o = o->next)
+			release((void *)o);
+
+	while ((s = pool->slab) != NULL) {
+		pool->slab = s->next;
+		free(s);
+	}
+
+	free(pool);
+}
+
+int pool_grow(pool_t *pool)
+{
+	pool_slab_t *s;
+	pool_object_t *o;
+	char *p;
+	int i;
+
+	if (posix_memalign((void **)&s, STATS_CACHELINE, STATS_CACHELINE + POOL_SLAB * pool->size) != 0) {
+		LOG(E1, "posix_memalign() failed");
+		return(-1);
+	}
+
+	memset(s, 0, STATS_CACHELINE + POOL_SLAB * pool->size);
+
+	s->next = pool->slab;
+	pool->slab = s;
+
+	for (i = POOL_SLAB - 1, p = (char *)s + STATS_CACHELINE; i >= 0; i--) {
+		o = (pool_object_t *)(p + i * pool->size);
+		o->next = pool->free;
+		pool->free = o;
+	}
+
+	STATS_ADD(pool->slabs, 1);
+	STATS_ADD(pool->available, POOL_SLAB);
+
+	return(0);
+}
+
+/* NOTE: object fresh from a slab is zeroed, a reused one is left as it's been put
+         (except for its first pointer) */
+void *pool_get(pool_t *pool)
+{
+	pool_object_t *o;
+
+	if ((pool->free == NULL) && (pool_grow(pool) == -1))
+		return(NULL);
+
+	o = pool->free;
+	pool->free = o->next;
+	o->next = NULL;
+
+	STATS_ADD(pool->used, 1);
+	STATS_ADD(pool->available, -1);
+	STATS_ADD(pool->gets, 1);
+
+	return((void *)o);
+}
+
+void pool_put(pool_t *pool, void *object)
+{
+	pool_object_t *o = (pool_object_t *)object;
+
+	if (o == NULL)
+		return;
+
+	o->next = pool->free;
+	pool->free = o;
+
+	STATS_ADD(pool->used, -1);
+	STATS_ADD(pool->available, 1);
+}
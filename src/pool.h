@@ -0,0 +1,33 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define POOL_SLAB 64 // objects carved out of a single slab
+
+typedef struct pool_object_s {
+	struct pool_object_s *next;
+} pool_object_t;
+
+typedef struct pool_slab_s {
+	struct pool_slab_s *next;
+} pool_slab_t;
+
+/* NOTE: pool of objects of a single size used by a single thread, objects are carved
+         out of slabs and never given back to malloc(), freed ones are handed out again
+         (with their contents as they've been left, see pool_get()); counters are read
+         by admin thread */
+typedef struct {
+	size_t size;
+	pool_slab_t *slab;
+	pool_object_t *free;
+	uint64_t slabs, used, available, gets;
+} pool_t;
+
+pool_t *pool_create(size_t size);
+void pool_destroy(pool_t *pool, void (*release)(void *object));
+void *pool_get(pool_t *pool);
+void pool_put(pool_t *pool, void *object);
+
+#endif
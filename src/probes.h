@@ -0,0 +1,21 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/* NOTE: USDT probes of provider 'proxis', each one is a single nop instruction until
+         a tracer attaches to it (arguments are only passed in registers), eg.
+         bpftrace -e 'usdt:/usr/bin/proxis:proxis:session__drop { printf("%s\n", str(arg2)); }'
+         without sys/sdt.h (or with NPROBES defined) they compile to nothing */
+#if defined(HAVE_SYS_SDT_H) && !defined(NPROBES)
+#include <sys/sdt.h>
+#define PROBE1(name, a)	DTRACE_PROBE1(proxis, name, a)
+#define PROBE2(name, a, b)	DTRACE_PROBE2(proxis, name, a, b)
+#define PROBE3(name, a, b, c)	DTRACE_PROBE3(proxis, name, a, b, c)
+#define PROBE4(name, a, b, c, d)	DTRACE_PROBE4(proxis, name, a, b, c, d)
+#else
+#define PROBE1(name, a)	do {} while(0)
+#define PROBE2(name, a, b)	do {} while(0)
+#define PROBE3(name, a, b, c)	do {} while(0)
+#define PROBE4(name, a, b, c, d)	do {} while(0)
+#endif
+
+#endif
@@ -29,6 +29,7 @@
 */
 
 #include <unistd.h>
+#include <sys/socket.h>
 #include <string.h>
 #include <errno.h>
 #include <libconfig.h>
@@ -42,16 +43,76 @@
 #include "session.h"
 #include "resp.h"
 #include "worker.h"
+#include "cmd.h"
+#include "stats.h"
+#include "cache.h"
+#include "pubsub.h"
+#include "shadow.h"
+#include "hotkeys.h"
+#include "slowlog.h"
+#include "audit.h"
+#include "wheel.h"
+#include "upgrade.h"
+
+void proxy_drain_check(evutil_socket_t fd, short events, void *arg);
+void proxy_lag_check(evutil_socket_t fd, short events, void *arg);
 
 void proxy_accept(struct evconnlistener *ecl, evutil_socket_t fd, struct sockaddr *address, int socklen, void *arg)
 {
 	proxy_t *proxy = (proxy_t *)arg;
-	session_t *session = session_create(proxy, fd, address, socklen);
+	session_t *session;
+
+	/* NOTE: client is shed right away when connect queue is full, a TLS one can't be
+	         told why without a handshake we can't afford then */
+	if (proxy->connect_queue && (STATS_GET(proxy->counters->connect_queued) >= proxy->connect_queue)) {
+		if (proxy->frontend.ssl_ctx == NULL)
+			send(fd, PROXY_REJECTED, sizeof(PROXY_REJECTED) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+		evutil_closesocket(fd);
+		STATS_ADD(proxy->counters->rejected, 1);
+		return;
+	}
+
+	session = session_create(proxy, fd, address, socklen);
 
 	if (session)
 		LOG(D1, "accepted connection from client %s", session->remote.address);
 }
 
+struct event_base *proxy_event_base(const char *method, int changelist)
+{
+	struct event_config *ec;
+	struct event_base *eb;
+	const char **m;
+	int found = 0;
+
+	if ((ec = event_config_new()) == NULL)
+		return(NULL);
+
+	if (method) {
+		for (m = event_get_supported_methods(); *m; m++)
+			if (strcmp(*m, method) == 0)
+				found = 1;
+			else
+				event_config_avoid_method(ec, *m);
+		if (!found) {
+			LOG(E1, "unsupported 'event_method' '%s'", method);
+			event_config_free(ec);
+			return(NULL);
+		}
+	}
+
+	/* NOTE: changes to epoll interest list are batched and applied just before epoll_wait(),
+	         add/del of the same event within one loop iteration doesn't cost any syscall then */
+	if (changelist)
+		event_config_set_flag(ec, EVENT_BASE_FLAG_EPOLL_USE_CHANGELIST);
+
+	eb = event_base_new_with_config(ec);
+
+	event_config_free(ec);
+
+	return(eb);
+}
+
 void proxy_worker(void *i)
 {
 	proxy_t *proxy = (proxy_t *)i;
@@ -61,8 +122,8 @@ void proxy_worker(void *i)
 
 proxy_t *proxy_create(config_setting_t *config, acl_t **acl)
 {
-	int n, i;
-	const char *value;
+	int n, acls, i = 0;
+	const char *value, *method = NULL;
 	config_setting_t *s;
 	acl_t **a;
 	proxy_t *proxy = (proxy_t *)malloc(sizeof(proxy_t));
@@ -84,8 +145,22 @@ proxy_t *proxy_create(config_setting_t *config, acl_t **acl)
 		return(NULL);
 	}
 
-	if ((proxy->eb = event_base_new()) == NULL) {
-		LOG(E1, "event_base_new() failed, %s", strerror(errno));
+	i = 1;
+	config_setting_lookup_string(config, "event_method", &method);
+	config_setting_lookup_bool(config, "event_changelist", &i);
+
+	if ((proxy->eb = proxy_event_base(method, i)) == NULL) {
+		LOG(E1, "failed to initialize event base");
+		return(NULL);
+	}
+
+	i = 0;
+
+	config_setting_lookup_int(config, "io_chunk", &proxy->io_chunk);
+	config_setting_lookup_int(config, "read_quantum", &proxy->read_quantum);
+
+	if (proxy->read_quantum < 0) {
+		LOG(E1, "invalid 'read_quantum'");
 		return(NULL);
 	}
 
@@ -94,6 +169,10 @@ proxy_t *proxy_create(config_setting_t *config, acl_t **acl)
 		return(NULL);
 	}
 
+	proxy->name = value;
+
+	LOG(D1, "proxy '%s' using '%s' event method", proxy->name, event_base_get_method(proxy->eb));
+
 	n = sizeof(proxy->frontend.local.sa);
 
 	if (evutil_parse_sockaddr_port(value, &proxy->frontend.local.sa, &n) == -1) {
@@ -103,13 +182,24 @@ proxy_t *proxy_create(config_setting_t *config, acl_t **acl)
 
 	value = NULL;
 
-	proxy->ecl = evconnlistener_new_bind(proxy->eb, NULL, NULL, LEV_OPT_CLOSE_ON_FREE | LEV_OPT_CLOSE_ON_EXEC | LEV_OPT_REUSEABLE, -1, &proxy->frontend.local.sa, n);
+	/* NOTE: listening socket is inherited from a previous process upon hot upgrade */
+	if ((i = upgrade_listener(proxy->name)) != -1)
+		proxy->ecl = evconnlistener_new(proxy->eb, NULL, NULL, LEV_OPT_CLOSE_ON_FREE | LEV_OPT_CLOSE_ON_EXEC | LEV_OPT_REUSEABLE, -1, i);
+	else
+		proxy->ecl = evconnlistener_new_bind(proxy->eb, NULL, NULL, LEV_OPT_CLOSE_ON_FREE | LEV_OPT_CLOSE_ON_EXEC | LEV_OPT_REUSEABLE, -1, &proxy->frontend.local.sa, n);
+
+	i = 0;
 
 	if (proxy->ecl == NULL) {
 		LOG(E1, "evconnlistener_new_bind() failed, %s", strerror(errno));
 		return(NULL);
 	}
 
+	if ((proxy->drain = event_new(proxy->eb, -1, EV_PERSIST, proxy_drain_check, proxy)) == NULL) {
+		LOG(E1, "event_new() failed");
+		return(NULL);
+	}
+
 	config_setting_lookup_string(config, "cert", &proxy->frontend.cert);
 	config_setting_lookup_string(config, "key", &proxy->frontend.key);
 
@@ -171,6 +261,112 @@ proxy_t *proxy_create(config_setting_t *config, acl_t **acl)
 
 	proxy->backend.nauth = resp_command("NOT AUTHORIZED", NULL);
 
+	config_setting_lookup_bool(config, "redis_lazy", &proxy->lazy);
+
+	/* NOTE: subscribers of a proxy share a single connection to redis */
+	if (config_setting_lookup_bool(config, "shared_pubsub", &i) && i && ((proxy->pubsub = pubsub_create()) == NULL))
+		return(NULL);
+
+	for (acls = 0; acl[acls]; acls++);
+
+	if ((proxy->counters = stats_counters_create(cmd_count, acls)) == NULL)
+		return(NULL);
+
+	/* NOTE: sessions are recycled, so that connection churn doesn't churn the allocator */
+	if ((proxy->pool = pool_create(sizeof(session_t))) == NULL)
+		return(NULL);
+
+	long long slower_than = SLOWLOG_SLOWER_THAN;
+	n = SLOWLOG_MAX_LEN;
+	config_setting_lookup_int64(config, "slowlog_slower_than", &slower_than);
+	config_setting_lookup_int(config, "slowlog_max_len", &n);
+
+	if (n <= 0) {
+		LOG(E1, "invalid 'slowlog_max_len' of 'proxy' '%s'", proxy->name);
+		return(NULL);
+	}
+
+	/* NOTE: negative threshold disables slowlog */
+	if ((slower_than >= 0) && ((proxy->slowlog = slowlog_create(slower_than, n)) == NULL))
+		return(NULL);
+
+	if (config_setting_lookup_string(config, "audit", &value) == CONFIG_TRUE) {
+		long long size = AUDIT_SEGMENT_SIZE;
+		n = AUDIT_SEGMENTS;
+		config_setting_lookup_int64(config, "audit_segment_size", &size);
+		config_setting_lookup_int(config, "audit_segments", &n);
+		if ((proxy->audit = audit_create(value, size, n, acl)) == NULL) {
+			LOG(E1, "invalid 'audit' of 'proxy' '%s'", proxy->name);
+			return(NULL);
+		}
+	}
+
+	config_setting_lookup_bool(config, "latency", &i);
+
+	if (i) {
+		proxy->latency = (stats_histogram_t **)malloc(cmd_count * sizeof(stats_histogram_t *));
+		if (proxy->latency == NULL) {
+			LOG(E1, "malloc() failed, %s", strerror(errno));
+			return(NULL);
+		}
+		memset(proxy->latency, 0, cmd_count * sizeof(stats_histogram_t *));
+	}
+
+	i = 0;
+	config_setting_lookup_bool(config, "splice", &i);
+
+	/* NOTE: splice() moves data between file descriptors, there's nothing to move with TLS */
+#ifdef LINUX
+	if (i && proxy->frontend.ssl_ctx)
+		LOG(W1, "'splice' has no effect on a TLS 'proxy' '%s'", proxy->name);
+	else
+		proxy->splice = i;
+#else
+	if (i)
+		LOG(W1, "'splice' is supported on linux only, ignoring it for 'proxy' '%s'", proxy->name);
+#endif
+
+	config_setting_lookup_int(config, "max_connecting", &proxy->max_connecting);
+	config_setting_lookup_int(config, "connect_queue", &proxy->connect_queue);
+	config_setting_lookup_int(config, "max_loop_lag", &proxy->max_loop_lag);
+
+	if ((proxy->max_connecting < 0) || (proxy->connect_queue < 0) || (proxy->max_loop_lag < 0)) {
+		LOG(E1, "invalid 'max_connecting', 'connect_queue' or 'max_loop_lag' of 'proxy' '%s'", proxy->name);
+		return(NULL);
+	}
+
+	if (proxy->max_loop_lag && ((proxy->lag = event_new(proxy->eb, -1, EV_PERSIST, proxy_lag_check, proxy)) == NULL)) {
+		LOG(E1, "event_new() failed");
+		return(NULL);
+	}
+
+	config_setting_lookup_int(config, "client_idle_timeout", &proxy->idle_timeout);
+	config_setting_lookup_int(config, "max_session_lifetime", &proxy->max_lifetime);
+
+	if ((proxy->idle_timeout < 0) || (proxy->max_lifetime < 0)) {
+		LOG(E1, "invalid 'client_idle_timeout' or 'max_session_lifetime' of 'proxy' '%s'", proxy->name);
+		return(NULL);
+	}
+
+	/* NOTE: timers of all sessions are kept in a single wheel, driven by a single event */
+	if ((proxy->idle_timeout || proxy->max_lifetime) && ((proxy->wheel = wheel_create(proxy->eb)) == NULL))
+		return(NULL);
+
+	if (((s = config_setting_get_member(config, "cache")) != NULL) && ((proxy->cache = cache_create(s)) == NULL)) {
+		LOG(E1, "invalid 'cache' of 'proxy' '%s'", proxy->name);
+		return(NULL);
+	}
+
+	if (((s = config_setting_get_member(config, "shadow")) != NULL) && ((proxy->shadow = shadow_create(s)) == NULL)) {
+		LOG(E1, "invalid 'shadow' of 'proxy' '%s'", proxy->name);
+		return(NULL);
+	}
+
+	if (((s = config_setting_get_member(config, "hotkeys")) != NULL) && ((proxy->hotkeys = hotkeys_create(s, acls)) == NULL)) {
+		LOG(E1, "invalid 'hotkeys' of 'proxy' '%s'", proxy->name);
+		return(NULL);
+	}
+
 	s = config_setting_get_member(config, "acl");
 	n = config_setting_length(s);
 
@@ -204,12 +400,15 @@ proxy_t *proxy_create(config_setting_t *config, acl_t **acl)
 
 	proxy->frontend.authok = resp_msg("OK");
 	proxy->frontend.autherr = resp_err("ERR invalid password");
+	proxy->frontend.denied = resp_err("ERR NOT AUTHORIZED");
 
 	return(proxy);
 }
 
 void proxy_destroy(proxy_t *proxy)
 {
+	int i;
+
 	if (proxy == NULL)
 		return;
 
@@ -218,15 +417,37 @@ void proxy_destroy(proxy_t *proxy)
 	worker_destroy(proxy->worker);
 
 	evconnlistener_free(proxy->ecl);
+	event_free(proxy->drain);
+	if (proxy->lag)
+		event_free(proxy->lag);
+	wheel_destroy(proxy->wheel);
+	pubsub_destroy(proxy->pubsub);
+	shadow_destroy(proxy->shadow);
+	hotkeys_destroy(proxy->hotkeys);
 	event_base_free(proxy->eb);
 
+	pool_destroy(proxy->pool, session_release);
+
 	resp_free(proxy->backend.auth);
 	resp_free(proxy->backend.nauth);
 	resp_free(proxy->frontend.authok);
 	resp_free(proxy->frontend.autherr);
+	resp_free(proxy->frontend.denied);
 
 	free(proxy->acl);
 
+	cache_destroy(proxy->cache);
+
+	stats_counters_destroy(proxy->counters);
+	slowlog_destroy(proxy->slowlog);
+	audit_destroy(proxy->audit);
+
+	if (proxy->latency) {
+		for (i = 0; i < cmd_count; i++)
+			stats_histogram_destroy(proxy->latency[i]);
+		free(proxy->latency);
+	}
+
 	if (proxy->frontend.ssl_ctx)
 		SSL_CTX_free(proxy->frontend.ssl_ctx);
 
@@ -238,8 +459,23 @@ void proxy_start(proxy_t *proxy)
 	if (proxy == NULL)
 		return;
 
+	struct timeval tv = { 0, PROXY_DRAIN_CHECK * 1000 };
+
 	evconnlistener_set_cb(proxy->ecl, proxy_accept, proxy);
 
+	event_add(proxy->drain, &tv);
+
+	if (proxy->lag) {
+		tv.tv_usec = PROXY_LAG_CHECK * 1000;
+		proxy->lag_tick = stats_clock();
+		event_add(proxy->lag, &tv);
+	}
+
+	cache_start(proxy->cache, proxy->eb, &proxy->backend.remote.sa, proxy->backend.auth);
+	pubsub_start(proxy->pubsub, proxy->eb, &proxy->backend.remote.sa, proxy->backend.auth);
+	shadow_start(proxy->shadow, proxy->eb);
+	hotkeys_start(proxy->hotkeys, proxy->eb);
+
 	worker_instruct(proxy->worker, RUN);
 }
 
@@ -254,3 +490,156 @@ void proxy_stop(proxy_t *proxy)
 
 	worker_instruct(proxy->worker, SLEEP);
 }
+
+/* NOTE: listener is paused while any of the reasons lasts, a drained one isn't resumed */
+void proxy_pause(proxy_t *proxy, int reason, int pause)
+{
+	int paused = (pause) ? (proxy->paused | reason):(proxy->paused & ~reason);
+
+	if (paused && !proxy->paused) {
+		LOG(W1, "proxy '%s' overloaded (%s), not accepting", proxy->name, (reason == PROXY_PAUSED_QUEUE) ? "connect queue full":"event loop lag");
+		STATS_ADD(proxy->counters->accept_pauses, 1);
+		evconnlistener_disable(proxy->ecl);
+	} else if (!paused && proxy->paused && !__atomic_load_n(&proxy->draining, __ATOMIC_ACQUIRE)) {
+		LOG(I1, "proxy '%s' accepting again", proxy->name);
+		evconnlistener_enable(proxy->ecl);
+	}
+
+	__atomic_store_n(&proxy->paused, paused, __ATOMIC_RELAXED);
+}
+
+/* NOTE: number of backend connects in progress is capped by 'max_connecting', sessions
+         over the cap wait in FIFO order, listener is paused while there are
+         'connect_queue' of them and resumed once the queue is half that long */
+void proxy_connect(proxy_t *proxy, session_t *session)
+{
+	stats_counters_t *c = proxy->counters;
+
+	if ((proxy->max_connecting == 0) || (STATS_GET(c->connecting) < proxy->max_connecting)) {
+		session->connecting = PROXY_CONNECT_RUNNING;
+		STATS_ADD(c->connecting, 1);
+		session_connect(session);
+		return;
+	}
+
+	session->connecting = PROXY_CONNECT_QUEUED;
+	session->connect_next = NULL;
+	if ((session->connect_prev = proxy->connect_tail) != NULL)
+		proxy->connect_tail->connect_next = session;
+	else
+		proxy->connect_head = session;
+	proxy->connect_tail = session;
+
+	STATS_ADD(c->connect_queued, 1);
+
+	if (proxy->connect_queue && (STATS_GET(c->connect_queued) >= proxy->connect_queue))
+		proxy_pause(proxy, PROXY_PAUSED_QUEUE, 1);
+}
+
+/* NOTE: called once a connect is done (or a session is gone), next one waiting is started */
+void proxy_connected(proxy_t *proxy, session_t *session)
+{
+	stats_counters_t *c = proxy->counters;
+
+	if (session->connecting == PROXY_CONNECT_QUEUED) {
+		if (session->connect_prev)
+			session->connect_prev->connect_next = session->connect_next;
+		else
+			proxy->connect_head = session->connect_next;
+		if (session->connect_next)
+			session->connect_next->connect_prev = session->connect_prev;
+		else
+			proxy->connect_tail = session->connect_prev;
+		STATS_ADD(c->connect_queued, -1);
+	} else {
+		STATS_ADD(c->connecting, -1);
+	}
+
+	session->connecting = 0;
+
+	while (proxy->connect_head && (STATS_GET(c->connecting) < proxy->max_connecting)) {
+		session = proxy->connect_head;
+		if ((proxy->connect_head = session->connect_next) != NULL)
+			proxy->connect_head->connect_prev = NULL;
+		else
+			proxy->connect_tail = NULL;
+		STATS_ADD(c->connect_queued, -1);
+		session->connecting = PROXY_CONNECT_RUNNING;
+		STATS_ADD(c->connecting, 1);
+		session_connect(session);
+	}
+
+	if ((proxy->paused & PROXY_PAUSED_QUEUE) && (STATS_GET(c->connect_queued) <= proxy->connect_queue / 2))
+		proxy_pause(proxy, PROXY_PAUSED_QUEUE, 0);
+}
+
+/* NOTE: lag is how late a periodic timer fires, a loop busy with accepting doesn't
+         get to serve sessions it already has */
+void proxy_lag_check(evutil_socket_t fd, short events, void *arg)
+{
+	proxy_t *proxy = (proxy_t *)arg;
+	uint64_t now = stats_clock();
+	int64_t lag = (int64_t)(now - proxy->lag_tick) / 1000 - PROXY_LAG_CHECK;
+
+	proxy->lag_tick = now;
+
+	if (lag > proxy->max_loop_lag)
+		proxy_pause(proxy, PROXY_PAUSED_LAG, 1);
+	else if (lag <= proxy->max_loop_lag / 2)
+		proxy_pause(proxy, PROXY_PAUSED_LAG, 0);
+}
+
+/* NOTE: drain is requested by main thread and carried out by proxy's own one, new clients
+         aren't accepted anymore and sessions get closed as soon as they're in between
+         commands */
+void proxy_drain(proxy_t *proxy)
+{
+	if (proxy)
+		__atomic_store_n(&proxy->draining, 1, __ATOMIC_RELEASE);
+}
+
+void proxy_drain_check(evutil_socket_t fd, short events, void *arg)
+{
+	proxy_t *proxy = (proxy_t *)arg;
+	session_t *session, *next;
+
+	switch (__atomic_load_n(&proxy->draining, __ATOMIC_ACQUIRE)) {
+	case 0:
+		return;
+	case 1:
+		LOG(I1, "proxy '%s' not accepting anymore, draining %d sessions", proxy->name, (int)STATS_GET(proxy->counters->sessions));
+		evconnlistener_disable(proxy->ecl);
+		__atomic_store_n(&proxy->draining, 2, __ATOMIC_RELEASE);
+		break;
+	}
+
+	for (session = proxy->sessions; session; session = next) {
+		next = session->next;
+		session_drain(session);
+	}
+}
+
+void proxy_dump_stats(proxy_t *proxy)
+{
+	char what[MAXHOSTNAME];
+	stats_histogram_t *h;
+	int i;
+
+	if (proxy == NULL)
+		return;
+
+	if (proxy->cache) {
+		snprintf(what, sizeof(what), "proxy %s", proxy->name);
+		cache_log(proxy->cache, what);
+	}
+
+	if (proxy->latency == NULL)
+		return;
+
+	for (i = 0; i < cmd_count; i++) {
+		if ((h = __atomic_load_n(&proxy->latency[i], __ATOMIC_ACQUIRE)) == NULL)
+			continue;
+		snprintf(what, sizeof(what), "command '%s' on proxy %s", cmd_table[i].name, proxy->name);
+		stats_histogram_log(h, what);
+	}
+}
@@ -7,9 +7,31 @@
 
 #include "acl.h"
 #include "resp.h"
+#include "stats.h"
+#include "cache.h"
+#include "pubsub.h"
+#include "shadow.h"
+#include "hotkeys.h"
+#include "slowlog.h"
+#include "audit.h"
+#include "wheel.h"
+#include "pool.h"
 #include "worker.h"
 
 #define MAXHOSTNAME 256
+#define PROXY_DRAIN_TIMEOUT 30 // seconds sessions are given to finish upon shutdown
+#define PROXY_DRAIN_CHECK 100 // milliseconds between attempts to close drained sessions
+#define PROXY_LAG_CHECK 100 // milliseconds between event loop lag measurements
+
+#define PROXY_REJECTED "-ERR max number of clients reached\r\n"
+
+#define PROXY_CONNECT_QUEUED 1
+#define PROXY_CONNECT_RUNNING 2
+
+#define PROXY_PAUSED_QUEUE 1
+#define PROXY_PAUSED_LAG 2
+
+struct session_s;
 
 typedef struct {
 	char address[INET6_ADDRSTRLEN];
@@ -21,7 +43,7 @@ typedef struct {
 	proxy_peer_t local;
 	SSL_CTX *ssl_ctx;
 	const char *ca, *cert, *key;
-	resp_t *authok, *autherr;
+	resp_t *authok, *autherr, *denied;
 } proxy_frontend_t;
 
 typedef struct {
@@ -31,17 +53,45 @@ typedef struct {
 } proxy_backend_t;
 
 typedef struct {
+	const char *name;
 	worker_t *worker;
 	struct event_base *eb;
 	struct evconnlistener *ecl;
 	proxy_frontend_t frontend;
 	proxy_backend_t backend;
 	acl_t **acl;
+	stats_histogram_t **latency;
+	stats_counters_t *counters;
+	slowlog_t *slowlog;
+	audit_t *audit;
+	int splice;
+	int io_chunk;
+	cache_t *cache;
+	wheel_t *wheel;
+	int idle_timeout, max_lifetime;
+	struct session_s *sessions;
+	struct event *drain;
+	int draining;
+	int max_connecting, connect_queue, max_loop_lag;
+	struct session_s *connect_head, *connect_tail;
+	struct event *lag;
+	uint64_t lag_tick;
+	int paused;
+	pool_t *pool;
+	int lazy;
+	pubsub_t *pubsub;
+	shadow_t *shadow;
+	hotkeys_t *hotkeys;
+	int read_quantum;
 } proxy_t;
 
 proxy_t *proxy_create(config_setting_t *config, acl_t **acl);
 void proxy_destroy(proxy_t *proxy);
 void proxy_start(proxy_t *proxy);
 void proxy_stop(proxy_t *proxy);
+void proxy_connect(proxy_t *proxy, struct session_s *session);
+void proxy_connected(proxy_t *proxy, struct session_s *session);
+void proxy_drain(proxy_t *proxy);
+void proxy_dump_stats(proxy_t *proxy);
 
 #endif
@@ -0,0 +1,535 @@
+/*
+   Copyright (c) 2018-2019, Seznam.cz, a.s.
+
+   Author: Daniel Bilik (daniel.bilik@firma.seznam.cz)
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+   PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+   BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+   POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <event.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+
+#include "log.h"
+#include "resp.h"
+#include "pubsub.h"
+
+/* NOTE: pubsub is owned by a single proxy, thus used by a single thread (its event loop),
+         only statistics counters are read from elsewhere (hence atomics) */
+
+#define PUBSUB_BUCKET(p, n, l) (&(p)->bucket[pubsub_hash(n, l) & (PUBSUB_BUCKETS - 1)])
+
+unsigned int pubsub_hash(const char *name, int len)
+{
+	unsigned int h = 2166136261u;
+
+	while (len-- > 0)
+		h = (h ^ (unsigned char)*(name++)) * 16777619u;
+
+	return(h);
+}
+
+pubsub_channel_t *pubsub_find(pubsub_t *pubsub, const char *name, int len, int pattern)
+{
+	pubsub_channel_t *c = *PUBSUB_BUCKET(pubsub, name, len);
+
+	while (c && ((c->pattern != pattern) || (c->len != len) || memcmp(c->name, name, len)))
+		c = c->next;
+
+	return(c);
+}
+
+void pubsub_unlink(pubsub_t *pubsub, pubsub_channel_t *channel)
+{
+	pubsub_channel_t **c = PUBSUB_BUCKET(pubsub, channel->name, channel->len);
+
+	while (*c && (*c != channel))
+		c = &(*c)->next;
+	if (*c)
+		*c = channel->next;
+
+	free(channel);
+	__atomic_fetch_sub(&pubsub->channels, 1, __ATOMIC_RELAXED);
+}
+
+/* NOTE: subscriber is told it's gone just once, the rest is up to its owner */
+void pubsub_lose(pubsub_subscriber_t *subscriber, const char *reason)
+{
+	if (subscriber->gone)
+		return;
+
+	subscriber->gone = reason;
+	subscriber->lost(subscriber->arg);
+}
+
+/* NOTE: all subscriptions are lost along with the connection, subscribers are dropped
+         (they'd miss messages otherwise), next subscription connects again */
+void pubsub_disconnect(pubsub_t *pubsub, const char *reason)
+{
+	pubsub_channel_t *c, *next;
+	pubsub_member_t *m, *n;
+	int i;
+
+	if (pubsub->be) {
+		bufferevent_free(pubsub->be);
+		pubsub->be = NULL;
+	}
+
+	for (i = 0; i < PUBSUB_BUCKETS; i++) {
+		for (c = pubsub->bucket[i]; c; c = next) {
+			next = c->next;
+			for (m = c->members; m; m = n) {
+				n = m->next;
+				m->subscriber->members = NULL;
+				m->subscriber->count = 0;
+				if (reason)
+					pubsub_lose(m->subscriber, reason);
+				free(m);
+			}
+			free(c);
+			__atomic_fetch_sub(&pubsub->channels, 1, __ATOMIC_RELAXED);
+		}
+		pubsub->bucket[i] = NULL;
+	}
+}
+
+void pubsub_release(const void *data, size_t len, void *arg)
+{
+	pubsub_message_t *m = (pubsub_message_t *)arg;
+
+	if (--m->refs == 0)
+		free(m);
+}
+
+/* NOTE: message is kept as received from redis, each subscriber's output refers to it
+         (subscriber whose client can't keep up is lost instead) */
+void pubsub_deliver(pubsub_t *pubsub, pubsub_channel_t *channel, pubsub_message_t *message, int len)
+{
+	pubsub_member_t *m;
+	int n = 0;
+
+	for (m = channel->members; m; m = m->next) {
+		if (m->subscriber->gone)
+			continue;
+		if (evbuffer_get_length(m->subscriber->out) > PUBSUB_OUTPUT_MAX) {
+			pubsub_lose(m->subscriber, "client can't keep up with messages published");
+			continue;
+		}
+		message->refs++;
+		if (evbuffer_add_reference(m->subscriber->out, message->data, len, pubsub_release, message) == -1) {
+			message->refs--;
+			pubsub_lose(m->subscriber, "failed to deliver message published");
+			continue;
+		}
+		n++;
+	}
+
+	__atomic_fetch_add(&pubsub->deliveries, n, __ATOMIC_RELAXED);
+}
+
+/* NOTE: bulk string at c, in form of '$N\r\n...\r\n', returns pointer behind it */
+char *pubsub_bulk(char *c, char *end, char **value, int *len)
+{
+	char *eol;
+
+	if ((c >= end) || (*c != '$') || ((eol = memchr(c, '\n', end - c)) == NULL))
+		return(NULL);
+	*len = atoi(c + 1);
+	*value = eol + 1;
+	if ((*len < 0) || (*value + *len + 2 > end))
+		return(NULL);
+
+	return(*value + *len + 2);
+}
+
+/* NOTE: 'message' and 'pmessage' are delivered to their channel (pattern) subscribers,
+         replies to our own 'subscribe' and 'unsubscribe' are of no interest */
+void pubsub_message(pubsub_t *pubsub, pubsub_message_t *message, int len)
+{
+	pubsub_channel_t *channel = NULL;
+	char *c = message->data, *end = c + len, *kind, *name;
+	int kl, nl;
+
+	if ((len < 4) || (c[0] != '*') || ((c = memchr(c, '\n', len)) == NULL) || ((c = pubsub_bulk(c + 1, end, &kind, &kl)) == NULL) ||
+	    (pubsub_bulk(c, end, &name, &nl) == NULL))
+		return;
+
+	if ((kl == 7) && (strncmp(kind, "message", 7) == 0))
+		channel = pubsub_find(pubsub, name, nl, 0);
+	else if ((kl == 8) && (strncmp(kind, "pmessage", 8) == 0))
+		channel = pubsub_find(pubsub, name, nl, 1);
+	else
+		return;
+
+	__atomic_fetch_add(&pubsub->messages, 1, __ATOMIC_RELAXED);
+
+	if (channel)
+		pubsub_deliver(pubsub, channel, message, len);
+}
+
+void pubsub_read(struct bufferevent *be, void *arg)
+{
+	pubsub_t *pubsub = (pubsub_t *)arg;
+	struct evbuffer *src = bufferevent_get_input(be);
+	pubsub_message_t *m;
+	char *c;
+	int i;
+
+	while ((i = resp_parse_reply(&pubsub->rr, src)) > 0) {
+		if (pubsub->handshake > 0) {
+			if ((pubsub->rr.type == '-') || (pubsub->rr.type == '!')) {
+				c = (char *)evbuffer_pullup(src, pubsub->rr.parsed);
+				c[pubsub->rr.parsed - 2] = '\0';
+				LOG(W1, "failed to authenticate subscriber connection, %s", c + 1);
+				pubsub_disconnect(pubsub, "failed to authenticate to a server");
+				return;
+			}
+			if (--pubsub->handshake == 0)
+				bufferevent_set_timeouts(be, NULL, NULL);
+			evbuffer_drain(src, pubsub->rr.parsed);
+		} else {
+			/* NOTE: whole message is moved out of input just once, subscribers share it */
+			if ((m = (pubsub_message_t *)malloc(sizeof(pubsub_message_t) + pubsub->rr.parsed)) == NULL) {
+				LOG(E1, "failed to allocate message received on subscriber connection");
+				evbuffer_drain(src, pubsub->rr.parsed);
+			} else {
+				m->refs = 1;
+				evbuffer_remove(src, m->data, pubsub->rr.parsed);
+				pubsub_message(pubsub, m, pubsub->rr.parsed);
+				pubsub_release(m->data, pubsub->rr.parsed, m);
+			}
+		}
+		pubsub->rr.parsed = 0;
+	}
+
+	if (i == -1) {
+		LOG(E1, "resp_parse_reply() failed on subscriber connection");
+		pubsub_disconnect(pubsub, "got error from a server");
+	}
+}
+
+void pubsub_event(struct bufferevent *be, short events, void *arg)
+{
+	pubsub_t *pubsub = (pubsub_t *)arg;
+
+	if (events & BEV_EVENT_CONNECTED) {
+		LOG(D1, "subscriber connection established");
+		if (pubsub->handshake == 0)
+			bufferevent_set_timeouts(be, NULL, NULL);
+		return;
+	}
+
+	if (events & BEV_EVENT_TIMEOUT)
+		LOG(W1, "timeout reached on subscriber connection");
+	else if (events & BEV_EVENT_ERROR)
+		LOG(W1, "got error on subscriber connection, %s", evutil_socket_error_to_string(EVUTIL_SOCKET_ERROR()));
+	else if (events & BEV_EVENT_EOF)
+		LOG(W1, "server has closed subscriber connection");
+
+	pubsub_disconnect(pubsub, "lost subscriber connection to a server");
+}
+
+int pubsub_connect(pubsub_t *pubsub)
+{
+	struct timeval tv = { PUBSUB_TIMEOUT, 0 };
+
+	if ((pubsub->be = bufferevent_socket_new(pubsub->eb, -1, BEV_OPT_CLOSE_ON_FREE | BEV_OPT_DEFER_CALLBACKS)) == NULL) {
+		LOG(E1, "failed to initialize subscriber bufferevent, %s", strerror(errno));
+		return(-1);
+	}
+
+	memset(&pubsub->rr, 0, sizeof(resp_reply_t));
+
+	bufferevent_setcb(pubsub->be, pubsub_read, NULL, pubsub_event, pubsub);
+	bufferevent_enable(pubsub->be, EV_READ | EV_WRITE);
+
+	/* NOTE: commands are queued before being connected, libevent sends them once it is */
+	pubsub->handshake = 0;
+
+	if (pubsub->auth) {
+		if (bufferevent_write(pubsub->be, pubsub->auth->payload, pubsub->auth->len) == -1) {
+			pubsub_disconnect(pubsub, NULL);
+			return(-1);
+		}
+		pubsub->handshake++;
+	}
+
+	bufferevent_set_timeouts(pubsub->be, &tv, NULL);
+
+	if (bufferevent_socket_connect(pubsub->be, &pubsub->sa, sizeof(struct sockaddr)) == -1) {
+		LOG(W1, "failed to connect subscriber connection");
+		pubsub_disconnect(pubsub, NULL);
+		return(-1);
+	}
+
+	evutil_make_socket_closeonexec(bufferevent_getfd(pubsub->be));
+
+	return(0);
+}
+
+/* NOTE: channel is (un)subscribed on server by the first (last) of local subscribers */
+int pubsub_send(pubsub_t *pubsub, const char *command, const char *name, int len)
+{
+	if ((pubsub->be == NULL) && (pubsub_connect(pubsub) == -1))
+		return(-1);
+
+	if ((evbuffer_add_printf(bufferevent_get_output(pubsub->be), "*2\r\n$%d\r\n%s\r\n$%d\r\n", (int)strlen(command), command, len) == -1) ||
+	    (evbuffer_add(bufferevent_get_output(pubsub->be), name, len) == -1) ||
+	    (evbuffer_add(bufferevent_get_output(pubsub->be), "\r\n", 2) == -1)) {
+		LOG(E1, "failed to send '%s' on subscriber connection", command);
+		return(-1);
+	}
+
+	return(0);
+}
+
+/* NOTE: confirmation in the very same form redis itself would send, name is nil
+         when there's nothing to unsubscribe from */
+int pubsub_confirm(pubsub_subscriber_t *subscriber, const char *kind, const char *name, int len)
+{
+	struct evbuffer *out = subscriber->out;
+
+	if (evbuffer_add_printf(out, "*3\r\n$%d\r\n%s\r\n", (int)strlen(kind), kind) == -1)
+		return(-1);
+
+	if (name == NULL)
+		return((evbuffer_add_printf(out, "$-1\r\n:%d\r\n", subscriber->count) == -1) ? -1:0);
+
+	if ((evbuffer_add_printf(out, "$%d\r\n", len) == -1) || (evbuffer_add(out, name, len) == -1))
+		return(-1);
+
+	return((evbuffer_add_printf(out, "\r\n:%d\r\n", subscriber->count) == -1) ? -1:0);
+}
+
+int pubsub_subscribe(pubsub_t *pubsub, pubsub_subscriber_t *subscriber, const char *name, int len, int pattern)
+{
+	pubsub_channel_t *c = pubsub_find(pubsub, name, len, pattern), **b;
+	pubsub_member_t *m;
+
+	for (m = subscriber->members; m; m = m->sibling)
+		if (m->channel == c)
+			return(pubsub_confirm(subscriber, (pattern) ? "psubscribe":"subscribe", name, len));
+
+	if (c == NULL) {
+		if (pubsub_send(pubsub, (pattern) ? "psubscribe":"subscribe", name, len) == -1)
+			return(-1);
+		if ((c = (pubsub_channel_t *)malloc(sizeof(pubsub_channel_t) + len)) == NULL)
+			return(-1);
+		memcpy(c->name, name, len);
+		c->len = len;
+		c->pattern = pattern;
+		c->members = NULL;
+		b = PUBSUB_BUCKET(pubsub, name, len);
+		c->next = *b;
+		*b = c;
+		__atomic_fetch_add(&pubsub->channels, 1, __ATOMIC_RELAXED);
+	}
+
+	if ((m = (pubsub_member_t *)malloc(sizeof(pubsub_member_t))) == NULL) {
+		if (c->members == NULL) {
+			pubsub_send(pubsub, (pattern) ? "punsubscribe":"unsubscribe", name, len);
+			pubsub_unlink(pubsub, c);
+		}
+		return(-1);
+	}
+
+	m->channel = c;
+	m->subscriber = subscriber;
+	m->prev = NULL;
+	m->next = c->members;
+	if (c->members)
+		c->members->prev = m;
+	c->members = m;
+	m->sibling = subscriber->members;
+	subscriber->members = m;
+	subscriber->count++;
+
+	return(pubsub_confirm(subscriber, (pattern) ? "psubscribe":"subscribe", name, len));
+}
+
+/* NOTE: takes member out of both lists, the channel goes away with its last member */
+void pubsub_remove(pubsub_t *pubsub, pubsub_member_t *member)
+{
+	pubsub_channel_t *c = member->channel;
+	pubsub_member_t **s = &member->subscriber->members;
+
+	while (*s && (*s != member))
+		s = &(*s)->sibling;
+	if (*s)
+		*s = member->sibling;
+	member->subscriber->count--;
+
+	if (member->prev)
+		member->prev->next = member->next;
+	else
+		c->members = member->next;
+	if (member->next)
+		member->next->prev = member->prev;
+
+	if (c->members == NULL) {
+		pubsub_send(pubsub, (c->pattern) ? "punsubscribe":"unsubscribe", c->name, c->len);
+		pubsub_unlink(pubsub, c);
+	}
+
+	free(member);
+}
+
+int pubsub_unsubscribe(pubsub_t *pubsub, pubsub_subscriber_t *subscriber, const char *name, int len, int pattern)
+{
+	pubsub_channel_t *c = pubsub_find(pubsub, name, len, pattern);
+	pubsub_member_t *m;
+
+	for (m = subscriber->members; c && m; m = m->sibling) {
+		if (m->channel == c) {
+			pubsub_remove(pubsub, m);
+			break;
+		}
+	}
+
+	return(pubsub_confirm(subscriber, (pattern) ? "punsubscribe":"unsubscribe", name, len));
+}
+
+/* NOTE: unsubscribes from all channels (or patterns), confirming each of them with
+         number of subscriptions left (hence name is written before it's gone) */
+int pubsub_unsubscribe_all(pubsub_t *pubsub, pubsub_subscriber_t *subscriber, int pattern)
+{
+	const char *kind = (pattern) ? "punsubscribe":"unsubscribe";
+	pubsub_member_t *m = subscriber->members, *next;
+	int n = 0;
+
+	for (; m; m = next) {
+		next = m->sibling;
+		if (m->channel->pattern != pattern)
+			continue;
+		if ((evbuffer_add_printf(subscriber->out, "*3\r\n$%d\r\n%s\r\n$%d\r\n", (int)strlen(kind), kind, m->channel->len) == -1) ||
+		    (evbuffer_add(subscriber->out, m->channel->name, m->channel->len) == -1))
+			return(-1);
+		pubsub_remove(pubsub, m);
+		if (evbuffer_add_printf(subscriber->out, "\r\n:%d\r\n", subscriber->count) == -1)
+			return(-1);
+		n++;
+	}
+
+	return((n == 0) ? pubsub_confirm(subscriber, kind, NULL, 0):0);
+}
+
+void pubsub_leave(pubsub_t *pubsub, pubsub_subscriber_t *subscriber)
+{
+	while (subscriber->members)
+		pubsub_remove(pubsub, subscriber->members);
+}
+
+/* NOTE: command of a subscribed client as it's been sent (complete), 1 is returned
+         for those not allowed in subscribed state, they're up to a caller */
+int pubsub_command(pubsub_t *pubsub, pubsub_subscriber_t *subscriber, char *request, int len)
+{
+	char *c = request, *end = request + len, *cmd, *arg;
+	int n, cl, al, pattern, i = 0;
+
+	if ((len < 4) || (*c != '*') || ((n = atoi(c + 1)) < 1) || ((c = memchr(c, '\n', len)) == NULL) || ((c = pubsub_bulk(c + 1, end, &cmd, &cl)) == NULL))
+		return(1);
+
+	n--;
+
+	if ((cl == 4) && (strncasecmp(cmd, "ping", 4) == 0)) {
+		if ((n > 0) && (pubsub_bulk(c, end, &arg, &al) == NULL))
+			return(-1);
+		if (evbuffer_add_printf(subscriber->out, "*2\r\n$4\r\npong\r\n$%d\r\n", (n > 0) ? al:0) == -1)
+			return(-1);
+		if ((n > 0) && (evbuffer_add(subscriber->out, arg, al) == -1))
+			return(-1);
+		return(evbuffer_add(subscriber->out, "\r\n", 2));
+	}
+
+	pattern = (cl > 0) && ((*cmd == 'p') || (*cmd == 'P'));
+
+	if ((cl - pattern == 9) && (strncasecmp(cmd + pattern, "subscribe", 9) == 0)) {
+		if (n == 0)
+			return((evbuffer_add_printf(subscriber->out, "-ERR wrong number of arguments for '%.*s' command\r\n", cl, cmd) == -1) ? -1:0);
+		while ((n-- > 0) && (i == 0)) {
+			if ((c = pubsub_bulk(c, end, &arg, &al)) == NULL)
+				return(-1);
+			i = pubsub_subscribe(pubsub, subscriber, arg, al, pattern);
+		}
+		return(i);
+	}
+
+	if ((cl - pattern == 11) && (strncasecmp(cmd + pattern, "unsubscribe", 11) == 0)) {
+		if (n == 0)
+			return(pubsub_unsubscribe_all(pubsub, subscriber, pattern));
+		while ((n-- > 0) && (i == 0)) {
+			if ((c = pubsub_bulk(c, end, &arg, &al)) == NULL)
+				return(-1);
+			i = pubsub_unsubscribe(pubsub, subscriber, arg, al, pattern);
+		}
+		return(i);
+	}
+
+	return(1);
+}
+
+void pubsub_start(pubsub_t *pubsub, struct event_base *eb, struct sockaddr *sa, resp_t *auth)
+{
+	if (pubsub == NULL)
+		return;
+
+	pubsub->eb = eb;
+	pubsub->auth = auth;
+
+	memcpy(&pubsub->sa, sa, sizeof(struct sockaddr));
+}
+
+pubsub_t *pubsub_create(void)
+{
+	pubsub_t *pubsub;
+
+	if ((pubsub = (pubsub_t *)malloc(sizeof(pubsub_t))) == NULL)
+		return(NULL);
+
+	memset(pubsub, 0, sizeof(pubsub_t));
+
+	if ((pubsub->bucket = (pubsub_channel_t **)calloc(PUBSUB_BUCKETS, sizeof(pubsub_channel_t *))) == NULL) {
+		free(pubsub);
+		return(NULL);
+	}
+
+	return(pubsub);
+}
+
+void pubsub_destroy(pubsub_t *pubsub)
+{
+	if (pubsub == NULL)
+		return;
+
+	pubsub_disconnect(pubsub, NULL);
+
+	free(pubsub->bucket);
+	free(pubsub);
+}
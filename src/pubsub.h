@@ -0,0 +1,73 @@
+#ifndef PUBSUB_H
+#define PUBSUB_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <event.h>
+
+#include "resp.h"
+
+#define PUBSUB_BUCKETS 1024 // power of two
+#define PUBSUB_TIMEOUT 5 // seconds to establish subscriber connection
+#define PUBSUB_OUTPUT_MAX 33554432 // subscriber with more than this pending is dropped
+
+struct pubsub_channel_s;
+struct pubsub_subscriber_s;
+
+/* NOTE: subscription of a single subscriber to a single channel (or pattern), linked
+         into the list of both */
+typedef struct pubsub_member_s {
+	struct pubsub_member_s *next, *prev, *sibling;
+	struct pubsub_channel_s *channel;
+	struct pubsub_subscriber_s *subscriber;
+} pubsub_member_t;
+
+/* NOTE: subscriber is embedded in a session, messages are added to its output; lost is
+         called (to be deferred by an owner) when it can't be served anymore, with
+         a reason set */
+typedef struct pubsub_subscriber_s {
+	struct evbuffer *out;
+	pubsub_member_t *members;
+	int count;
+	const char *gone;
+	void (*lost)(void *arg);
+	void *arg;
+} pubsub_subscriber_t;
+
+typedef struct pubsub_channel_s {
+	struct pubsub_channel_s *next;
+	pubsub_member_t *members;
+	int pattern, len;
+	char name[];
+} pubsub_channel_t;
+
+/* NOTE: message received once is referenced by outputs of all its subscribers */
+typedef struct {
+	int refs;
+	char data[];
+} pubsub_message_t;
+
+/* NOTE: single subscriber connection to redis shared by all sessions of a proxy, it's
+         established with the first subscription and closed (along with sessions
+         subscribed) when it fails */
+typedef struct {
+	pubsub_channel_t **bucket;
+	struct event_base *eb;
+	struct bufferevent *be;
+	struct sockaddr sa;
+	resp_t *auth;
+	resp_reply_t rr;
+	int handshake;
+	uint64_t channels, messages, deliveries;
+} pubsub_t;
+
+pubsub_t *pubsub_create(void);
+void pubsub_destroy(pubsub_t *pubsub);
+void pubsub_start(pubsub_t *pubsub, struct event_base *eb, struct sockaddr *sa, resp_t *auth);
+int pubsub_subscribe(pubsub_t *pubsub, pubsub_subscriber_t *subscriber, const char *name, int len, int pattern);
+int pubsub_unsubscribe(pubsub_t *pubsub, pubsub_subscriber_t *subscriber, const char *name, int len, int pattern);
+int pubsub_unsubscribe_all(pubsub_t *pubsub, pubsub_subscriber_t *subscriber, int pattern);
+int pubsub_command(pubsub_t *pubsub, pubsub_subscriber_t *subscriber, char *request, int len);
+void pubsub_leave(pubsub_t *pubsub, pubsub_subscriber_t *subscriber);
+
+#endif
@@ -0,0 +1,109 @@
+/*
+   Copyright (c) 2018-2019, Seznam.cz, a.s.
+
+   Author: Daniel Bilik (daniel.bilik@firma.seznam.cz)
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+   PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+   BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+   POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "log.h"
+#include "queue.h"
+
+#define QUEUE_INITIAL_SIZE 16
+#define QUEUE_KEEP_SIZE 64 // largest ring kept by an emptied queue
+
+/* NOTE: head and tail grow freely and wrap around, size is always a power of two */
+
+queue_entry_t *queue_push(queue_t *queue)
+{
+	queue_entry_t *entry;
+	unsigned int i, length = queue->tail - queue->head, size = (queue->size) ? queue->size << 1:QUEUE_INITIAL_SIZE;
+
+	if (length == queue->size) {
+		if ((entry = (queue_entry_t *)malloc(size * sizeof(queue_entry_t))) == NULL) {
+			LOG(E1, "malloc() failed, %s", strerror(errno));
+			return(NULL);
+		}
+		for (i = 0; i < length; i++)
+			entry[i] = queue->entry[(queue->head + i) & (queue->size - 1)];
+		free(queue->entry);
+		queue->entry = entry;
+		queue->size = size;
+		queue->head = 0;
+		queue->tail = length;
+	}
+
+	entry = &queue->entry[queue->tail++ & (queue->size - 1)];
+
+	memset(entry, 0, sizeof(queue_entry_t));
+
+	return(entry);
+}
+
+queue_entry_t *queue_head(queue_t *queue)
+{
+	if (queue->head == queue->tail)
+		return(NULL);
+
+	return(&queue->entry[queue->head & (queue->size - 1)]);
+}
+
+queue_entry_t *queue_tail(queue_t *queue)
+{
+	if (queue->head == queue->tail)
+		return(NULL);
+
+	return(&queue->entry[(queue->tail - 1) & (queue->size - 1)]);
+}
+
+void queue_pop(queue_t *queue)
+{
+	if (queue->head != queue->tail)
+		queue->head++;
+}
+
+unsigned int queue_length(queue_t *queue)
+{
+	return(queue->tail - queue->head);
+}
+
+/* NOTE: emptied queue keeps its ring for reuse, unless it's grown large */
+void queue_reset(queue_t *queue)
+{
+	if (queue->size > QUEUE_KEEP_SIZE)
+		queue_free(queue);
+	else
+		queue->head = queue->tail = 0;
+}
+
+void queue_free(queue_t *queue)
+{
+	free(queue->entry);
+	memset(queue, 0, sizeof(queue_t));
+}
@@ -0,0 +1,45 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stdint.h>
+
+#include "acl.h"
+#include "resp.h"
+#include "cache.h"
+#include "slowlog.h"
+
+#define QUEUE_BLOCKED 0x01 // command has been blocked, reply comes for 'backend.nauth'
+#define QUEUE_HIT 0x02 // command is answered from cached (or pending) entry
+#define QUEUE_FILL 0x04 // reply is going to be stored into cached entry
+#define QUEUE_SELECT 0x08 // reply confirms (or not) database has been selected
+
+/* NOTE: entry with reply set (or a cache hit) is answered by proxis itself, once all preceding are
+         (and a pending entry it refers to has got its reply) */
+typedef struct {
+	uint64_t sent;
+	acl_t *acl;
+	resp_t *reply;
+	cache_entry_t *cached;
+	short cmd;
+	short flags;
+	int args, arglen;
+	char arg[SLOWLOG_ARG_MAX];
+} queue_entry_t;
+
+#define queue_local(e) (((e)->reply != NULL) || ((e)->flags & QUEUE_HIT))
+
+/* NOTE: FIFO of commands awaiting their reply, ring buffer growing as needed */
+typedef struct {
+	queue_entry_t *entry;
+	unsigned int size, head, tail;
+} queue_t;
+
+queue_entry_t *queue_push(queue_t *queue);
+queue_entry_t *queue_head(queue_t *queue);
+queue_entry_t *queue_tail(queue_t *queue);
+void queue_pop(queue_t *queue);
+unsigned int queue_length(queue_t *queue);
+void queue_reset(queue_t *queue);
+void queue_free(queue_t *queue);
+
+#endif
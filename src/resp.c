@@ -126,32 +126,40 @@ void resp_free(resp_t *obj)
 
 int resp_parse_quantity(resp_buffer_t *buffer, char prefix, int *dst)
 {
-	char *c;
-	int i;
+	struct evbuffer_ptr start, p;
+	char line[32];
+	size_t eol;
+	int len;
 
 	if ((buffer == NULL) || (buffer->eb == NULL))
 		return(-1);
 
-	i = buffer->parsed + 4;
+	len = evbuffer_get_length(buffer->eb) - buffer->parsed;
 
-	while ((c = evbuffer_pullup(buffer->eb, i)) != NULL) {
-		if ((c[i - 2] == '\r') && (c[i - 1] == '\n'))
-			break;
-		i++;
-	}
-
-	if (c == NULL)
+	if (len < 4)
 		return(0);
 
-	if (c[buffer->parsed] != prefix)
+	if (evbuffer_ptr_set(buffer->eb, &start, buffer->parsed, EVBUFFER_PTR_SET) == -1)
 		return(-1);
 
-	c[i - 1] = '\0';
-	if (sscanf(c + buffer->parsed + 1, "%d\r", dst) != 1)
+	/* NOTE: line is searched for from where we've stopped, not from the beginning of a buffer,
+	         one that is too long to hold a number is a protocol error */
+	p = evbuffer_search_eol(buffer->eb, &start, &eol, EVBUFFER_EOL_CRLF_STRICT);
+	if (p.pos == -1)
+		return((len < sizeof(line)) ? 0:-1);
+
+	len = p.pos - buffer->parsed;
+	if (len >= sizeof(line))
 		return(-1);
-	c[i - 1] = '\n';
 
-	buffer->parsed = i;
+	if (evbuffer_copyout_from(buffer->eb, &start, line, len) != len)
+		return(-1);
+	line[len] = '\0';
+
+	if ((line[0] != prefix) || (sscanf(line + 1, "%d", dst) != 1))
+		return(-1);
+
+	buffer->parsed += len + 2;
 
 	return(1);
 }
@@ -166,47 +174,90 @@ int resp_parse_length(resp_buffer_t *buffer, int *dst)
 	return(resp_parse_quantity(buffer, '$', dst));
 }
 
+int resp_parse_copy(resp_buffer_t *buffer, char *dst, int wait)
+{
+	struct evbuffer_ptr p;
+	int i = (buffer->expected_bytes < RESP_ARG_MAX) ? buffer->expected_bytes:RESP_ARG_MAX;
+
+	if (evbuffer_get_length(buffer->eb) - buffer->parsed < ((wait > i) ? wait:i))
+		return(0);
+
+	if (evbuffer_ptr_set(buffer->eb, &p, buffer->parsed, EVBUFFER_PTR_SET) == -1)
+		return(-1);
+
+	if (evbuffer_copyout_from(buffer->eb, &p, dst, i) != i)
+		return(-1);
+
+	dst[i] = '\0';
+
+	return(1);
+}
+
 int resp_parse_buffer(resp_buffer_t *buffer)
 {
-	char *c;
 	int i;
 
 	if (buffer == NULL)
 		return(-1);
 
 	if (buffer->pending_parts == 0) {
+		buffer->start = buffer->parsed;
 		i = resp_parse_count(buffer, &buffer->pending_parts);
 		if (i <= 0)
 			return(i);
+		if (buffer->pending_parts < 0)
+			return(-1);
+		buffer->parts = buffer->pending_parts;
+		buffer->cmd[0] = '\0';
+		buffer->cmdlen = (buffer->pending_parts > 0) ? -1:0;
+		buffer->arglen = -1;
+		buffer->keys = 0;
+		buffer->keyn = 0;
 	}
 
 	if (buffer->pending_parts == 0)
 		return(buffer->parsed);
 
+	/* NOTE: pending_bytes includes trailing CRLF, so that it can't drop to zero
+	         while a part is still incomplete (eg. when a read ends right after
+	         its payload), which would make us parse CRLF as a length */
 	if (buffer->pending_bytes == 0) {
-		i = resp_parse_length(buffer, &buffer->pending_bytes);
+		i = resp_parse_length(buffer, &buffer->expected_bytes);
 		if (i <= 0)
 			return(i);
-		buffer->expected_bytes = buffer->pending_bytes;
+		if (buffer->expected_bytes < 0)
+			return(-1);
+		buffer->pending_bytes = buffer->expected_bytes + 2;
+		buffer->keylen = -1;
 	}
 
-	if (buffer->cmd == NULL) {
-		i = buffer->pending_bytes + 2;
-		if ((c = evbuffer_pullup(buffer->eb, buffer->parsed + i)) == NULL)
-			return(0);
-		buffer->cmd = c + buffer->parsed;
-		buffer->cmdlen = buffer->pending_bytes;
+	if (buffer->cmdlen == -1) {
+		/* NOTE: command name is only returned as a whole */
+		if ((i = resp_parse_copy(buffer, buffer->cmd, buffer->pending_bytes)) <= 0)
+			return(i);
+		buffer->cmdlen = (buffer->expected_bytes < RESP_ARG_MAX) ? buffer->expected_bytes:RESP_ARG_MAX;
+	} else if ((buffer->arglen == -1) && (buffer->parts - buffer->pending_parts == 1)) {
+		/* NOTE: (prefix of) first argument is kept aside, it's usually a key */
+		if ((i = resp_parse_copy(buffer, buffer->arg, 0)) <= 0)
+			return(i);
+		buffer->arglen = buffer->expected_bytes;
+	} else if (buffer->keys && (buffer->keylen == -1) && (buffer->parts - buffer->pending_parts > 1)) {
+		if ((i = resp_parse_copy(buffer, buffer->key, 0)) <= 0)
+			return(i);
+		buffer->keylen = buffer->expected_bytes;
+		buffer->keyn = buffer->parts - buffer->pending_parts;
+	}
+
+	/* NOTE: nothing left to parse, not even a part of pending bytes */
+	if ((i = evbuffer_get_length(buffer->eb) - buffer->parsed) == 0)
+		return(0);
+
+	if (i >= buffer->pending_bytes) {
+		i = buffer->pending_bytes;
 		buffer->pending_bytes = 0;
 		buffer->pending_parts--;
 	} else {
-		i = evbuffer_get_length(buffer->eb) - buffer->parsed;
-		if (i >= (buffer->pending_bytes + 2)) {
-			i = buffer->pending_bytes + 2;
-			buffer->pending_bytes = 0;
-			buffer->pending_parts--;
-		} else {
-			buffer->pending_bytes -= i;
-		}
+		buffer->pending_bytes -= i;
 	}
 
 	buffer->parsed += i;
@@ -214,16 +265,117 @@ int resp_parse_buffer(resp_buffer_t *buffer)
 	return(buffer->parsed);
 }
 
-char *resp_get_last_value(resp_buffer_t *buffer) {
+/* NOTE: value is copied into dst when it fits (with its terminating NUL), it's
+         malloc()ed otherwise and has to be freed by a caller then */
+char *resp_get_last_value(resp_buffer_t *buffer, char *dst, int size) {
+	struct evbuffer_ptr p;
 	char *c;
 
 	if (buffer->pending_bytes > 0)
 		return(NULL);
 
-	if ((c = evbuffer_pullup(buffer->eb, buffer->parsed)) == NULL)
+	if (evbuffer_ptr_set(buffer->eb, &p, buffer->parsed - (buffer->expected_bytes + 2), EVBUFFER_PTR_SET) == -1)
 		return(NULL);
 
-	c += buffer->parsed - (buffer->expected_bytes + 2);
+	if (buffer->expected_bytes < size)
+		c = dst;
+	else if ((c = (char *)malloc(buffer->expected_bytes + 1)) == NULL)
+		return(NULL);
+
+	if (evbuffer_copyout_from(buffer->eb, &p, c, buffer->expected_bytes) != buffer->expected_bytes) {
+		if (c != dst)
+			free(c);
+		return(NULL);
+	}
+
+	c[buffer->expected_bytes] = '\0';
+
+	return(c);
+}
+
+int resp_parse_reply(resp_reply_t *reply, struct evbuffer *eb)
+{
+	struct evbuffer_ptr start, p;
+	char line[32];
+	long long n;
+	size_t eol;
+	int len, available;
+
+	if ((reply == NULL) || (eb == NULL))
+		return(-1);
 
-	return(strndup(c, buffer->expected_bytes));
+	while (1) {
+		available = evbuffer_get_length(eb) - reply->parsed;
+		if (reply->pending_bytes > 0) {
+			if (available < reply->pending_bytes) {
+				reply->parsed += available;
+				reply->size += available;
+				reply->pending_bytes -= available;
+				return(0);
+			}
+			reply->parsed += reply->pending_bytes;
+			reply->size += reply->pending_bytes;
+			reply->pending_bytes = 0;
+			if (--reply->remaining == 0)
+				return(1);
+			continue;
+		}
+		if (available < 3)
+			return(0);
+		if (evbuffer_ptr_set(eb, &start, reply->parsed, EVBUFFER_PTR_SET) == -1)
+			return(-1);
+		p = evbuffer_search_eol(eb, &start, &eol, EVBUFFER_EOL_CRLF_STRICT);
+		if (p.pos == -1)
+			return(0);
+		len = p.pos - reply->parsed;
+		memset(line, 0, sizeof(line));
+		if (evbuffer_copyout_from(eb, &start, line, (len < sizeof(line)) ? len:sizeof(line) - 1) == -1)
+			return(-1);
+		if (reply->remaining == 0) {
+			reply->type = line[0];
+			reply->remaining = 1;
+			reply->size = 0;
+		}
+		reply->parsed += len + 2;
+		reply->size += len + 2;
+		switch (line[0]) {
+		case '+':
+		case '-':
+		case ':':
+		case '_':
+		case '#':
+		case ',':
+		case '(':
+			reply->remaining--;
+			break;
+		case '$':
+		case '!':
+		case '=':
+			if (sscanf(line + 1, "%lld", &n) != 1)
+				return(-1);
+			if (n < 0)
+				reply->remaining--;
+			else
+				reply->pending_bytes = n + 2;
+			break;
+		case '*':
+		case '~':
+		case '>':
+		case '%':
+		case '|':
+			if (sscanf(line + 1, "%lld", &n) != 1)
+				return(-1);
+			if (n < 0)
+				n = 0;
+			if ((line[0] == '%') || (line[0] == '|'))
+				n <<= 1;
+			/* NOTE: attribute doesn't replace a value, it's followed by one */
+			reply->remaining += (line[0] == '|') ? n:n - 1;
+			break;
+		default:
+			return(-1);
+		}
+		if (reply->remaining == 0)
+			return(1);
+	}
 }
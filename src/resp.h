@@ -3,19 +3,44 @@
 
 #include <event.h>
 
+#define RESP_ARG_MAX 128
+#define RESP_VALUE_MAX 256 // values up to this long are copied out with no malloc()
+
 typedef enum {
 	RESP_MSG, RESP_ERR, RESP_INT, RESP_STRING, RESP_ARRAY
 } resp_type_t;
 
+/* NOTE: state of streaming command parser, parsed is an offset into eb (not yet
+         consumed by a caller), start is an offset of a command being parsed;
+         command name and (prefix of) its first argument are copied aside, so that
+         eb never has to be made contiguous; with keys set (by a caller, for the current
+         command only), (prefix of) each further argument is copied aside as well, keyn
+         being its index until the caller resets it */
 typedef struct {
 	struct evbuffer *eb;
-	int parsed;
+	int parsed, start;
 	int pending_parts;
 	int pending_bytes, expected_bytes;
-	char *cmd;
+	char cmd[RESP_ARG_MAX + 1];
 	int cmdlen;
+	int parts;
+	char arg[RESP_ARG_MAX + 1];
+	int arglen;
+	int keys;
+	char key[RESP_ARG_MAX + 1];
+	int keylen, keyn;
 } resp_buffer_t;
 
+/* NOTE: state of streaming reply parser, it only needs to see header lines,
+         bulk payloads are skipped by their length without being inspected */
+typedef struct {
+	int parsed;
+	char type;
+	long long remaining;
+	long long pending_bytes;
+	long long size;
+} resp_reply_t;
+
 typedef struct {
 	resp_type_t type;
 	void *payload;
@@ -27,6 +52,7 @@ resp_t *resp_err(char *err);
 resp_t *resp_command(char *command, ...);
 void resp_free(resp_t *obj);
 int resp_parse_buffer(resp_buffer_t *buffer);
-char *resp_get_last_value(resp_buffer_t *buffer);
+char *resp_get_last_value(resp_buffer_t *buffer, char *dst, int size);
+int resp_parse_reply(resp_reply_t *reply, struct evbuffer *eb);
 
 #endif
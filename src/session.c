@@ -28,8 +28,14 @@
    POSSIBILITY OF SUCH DAMAGE.
 */
 
+#ifdef LINUX
+#define _GNU_SOURCE
+#endif
+
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
@@ -44,18 +50,180 @@
 #include "proxy.h"
 #include "session.h"
 #include "resp.h"
+#include "queue.h"
+#include "stats.h"
+#include "cmd.h"
+#include "cache.h"
+#include "audit.h"
+#include "probes.h"
+#include "wheel.h"
+#include "pool.h"
+#include "pubsub.h"
+#include "shadow.h"
+#include "hotkeys.h"
 
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #define MAX(a,b) (((a)>(b))?(a):(b))
 
+void session_wake(void *arg);
+void session_drop(session_t *session, char *err);
+
 void session_destroy(session_t *session)
 {
+	queue_entry_t *e;
+
 	if (session == NULL)
 		return;
 
+	cache_unwait(&session->wait);
+
+	if (session->connecting)
+		proxy_connected(session->proxy, session);
+
+	if (session->prev)
+		session->prev->next = session->next;
+	else
+		session->proxy->sessions = session->next;
+	if (session->next)
+		session->next->prev = session->prev;
+
+	if (session->proxy->wheel) {
+		wheel_cancel(session->proxy->wheel, &session->idle);
+		wheel_cancel(session->proxy->wheel, &session->lifetime);
+	}
+
+	while ((e = queue_head(&session->rq)) != NULL) {
+		if (e->flags & QUEUE_FILL)
+			cache_abandon(session->proxy->cache, e->cached);
+		else
+			cache_release(session->proxy->cache, e->cached);
+		queue_pop(&session->rq);
+	}
+
+	if (session->splice_read) {
+		event_free(session->splice_read);
+		event_free(session->splice_write);
+		close(session->pipe[0]);
+		close(session->pipe[1]);
+	}
+
+	if (session->sub.members)
+		pubsub_leave(session->proxy->pubsub, &session->sub);
+
+	if (session->staged)
+		evbuffer_free(session->staged);
+
 	bufferevent_free(session->client);
 	bufferevent_free(session->server);
-	free(session);
+	queue_reset(&session->rq);
+
+	STATS_ADD(session->proxy->counters->sessions, -1);
+
+	pool_put(session->proxy->pool, session);
+}
+
+/* NOTE: called for sessions kept in a pool when it's destroyed */
+void session_release(void *object)
+{
+	queue_free(&((session_t *)object)->rq);
+}
+
+void session_acl(session_t *session, acl_t *acl)
+{
+	session->acl = acl;
+
+	if (acl)
+		STATS_ADD(session->proxy->counters->acl[acl->index].sessions, 1);
+}
+
+void session_count(session_t *session, int allowed)
+{
+	stats_counters_t *c = session->proxy->counters;
+
+	if (allowed) {
+		STATS_ADD(c->command[session->cmd].allowed, 1);
+		if (session->acl)
+			STATS_ADD(c->acl[session->acl->index].allowed, 1);
+	} else {
+		STATS_ADD(c->command[session->cmd].blocked, 1);
+		if (session->acl)
+			STATS_ADD(c->acl[session->acl->index].blocked, 1);
+	}
+}
+
+/* NOTE: complete command is audited, its size is known then (parsed and start are both
+         shifted by whatever has been forwarded or drained so far) */
+void session_audit(session_t *session, int verdict)
+{
+	int keylen = ((verdict == AUDIT_ALLOWED) || (verdict == AUDIT_BLOCKED)) ? MIN(session->rs.arglen, RESP_ARG_MAX):0;
+
+	if (session->proxy->audit)
+		audit_record(session->proxy->audit, session->id, session->acl, session->cmd, verdict, session->rs.arg, keylen, session->rs.parsed - session->rs.start);
+}
+
+/* NOTE: session isn't idle while waiting for replies (blocking commands included) or
+         receiving messages (pubsub, monitor), time of client's last read is checked
+         only once the timer expires, rather than moving the timer upon each read */
+void session_idle(wheel_timer_t *timer, void *arg)
+{
+	session_t *session = (session_t *)arg;
+	wheel_t *wheel = session->proxy->wheel;
+	uint64_t now = wheel_now(wheel), idle = (uint64_t)session->proxy->idle_timeout * 1000 / WHEEL_TICK;
+
+	if (session->untracked || session->sub.count || session->waiting || queue_length(&session->rq))
+		session->active = now;
+
+	if (now - session->active < idle) {
+		wheel_add(wheel, timer, (idle - (now - session->active)) * WHEEL_TICK, session_idle, session);
+		return;
+	}
+
+	LOG(D1, "client %s has been idle for %d seconds, dropping session", session->remote.address, session->proxy->idle_timeout);
+	STATS_ADD(session->proxy->counters->idle_timeouts, 1);
+	session_drop(session, NULL);
+}
+
+/* NOTE: session which has outlived its lifetime is closed once there's no reply pending */
+void session_expire(wheel_timer_t *timer, void *arg)
+{
+	session_t *session = (session_t *)arg;
+
+	if (session->waiting || queue_length(&session->rq)) {
+		wheel_add(session->proxy->wheel, timer, WHEEL_TICK, session_expire, session);
+		return;
+	}
+
+	LOG(D1, "session of client %s has reached its maximum lifetime, dropping it", session->remote.address);
+	STATS_ADD(session->proxy->counters->lifetime_expirations, 1);
+	session_drop(session, NULL);
+}
+
+/* NOTE: session being drained is closed in between commands, ie. with no reply pending
+         (or yet to be written) and nothing (not even a part of a command) received from
+         its client; untracked, subscribed and transaction ones are left to drain timeout */
+void session_drain(session_t *session)
+{
+	if ((session->ss != SESSION_CLIENT_CHECK) || session->untracked || session->sub.count || session->multi || session->waiting || session->splice ||
+	    queue_length(&session->rq) || evbuffer_get_length(bufferevent_get_input(session->client)) ||
+	    evbuffer_get_length(bufferevent_get_output(session->client)))
+		return;
+
+	LOG(D1, "closing drained session of client %s", session->remote.address);
+	session_drop(session, NULL);
+}
+
+/* NOTE: bytes read from a socket are those added to an input buffer, bytes written
+         are those removed from an output one */
+void session_count_in(struct evbuffer *eb, const struct evbuffer_cb_info *info, void *arg)
+{
+	if (info->n_added)
+		STATS_ADD(*(uint64_t *)arg, info->n_added);
+}
+
+void session_count_out(struct evbuffer *eb, const struct evbuffer_cb_info *info, void *arg)
+{
+	if (info->n_deleted)
+		STATS_ADD(*(uint64_t *)arg, info->n_deleted);
 }
 
 void session_drop(session_t *session, char *err)
@@ -65,6 +233,9 @@ void session_drop(session_t *session, char *err)
 	if (session == NULL)
 		return;
 
+	/* NOTE: no reason means the client has gone (or we've failed to handle it, see log) */
+	PROBE3(session__drop, session->id, session->remote.address, (err) ? err:"");
+
 	if (err && (r = resp_err(err))) {
 		bufferevent_write(session->client, r->payload, r->len);
 		resp_free(r);
@@ -82,7 +253,17 @@ void session_client_event(struct bufferevent *be, short events, void *arg)
 {
 	session_t *session = (session_t *)arg;
 
-	if (events & BEV_EVENT_ERROR) {
+	/* NOTE: subscriber lost by pubsub (see session_lost()) */
+	if (session->sub.gone) {
+		LOG(W1, "dropping subscribed client %s, %s", session->remote.address, session->sub.gone);
+		session_drop(session, (char *)session->sub.gone);
+		return;
+	}
+
+	/* NOTE: client bufferevent is only ever connected by TLS handshake */
+	if (events & BEV_EVENT_CONNECTED) {
+		PROBE3(tls__handshake, session->id, session->remote.address, SSL_get_version(session->ssl));
+	} else if (events & BEV_EVENT_ERROR) {
 		LOG(E1, "got error from client %s, %s", session->remote.address, evutil_socket_error_to_string(EVUTIL_SOCKET_ERROR()));
 		session_drop(session, NULL);
 	} else if (events & BEV_EVENT_EOF) {
@@ -94,8 +275,25 @@ void session_client_event(struct bufferevent *be, short events, void *arg)
 void session_server_event(struct bufferevent *be, short events, void *arg)
 {
 	session_t *session = (session_t *)arg;
+	stats_counters_t *c = session->proxy->counters;
 
-	if (events & BEV_EVENT_CONNECTED) {
+	/* NOTE: connect has either succeeded or failed, its slot is free for another one */
+	if (session->connecting)
+		proxy_connected(session->proxy, session);
+
+	if (!(events & BEV_EVENT_CONNECTED) && ((session->ss <= SESSION_SERVER_AUTH) || (session->deferred > SESSION_DEFERRED)))
+		STATS_ADD(*(((session->ss == SESSION_SERVER_CONNECT) || (session->deferred == SESSION_DEFERRED_CONNECT)) ? &c->connect_failures:&c->server_auth_failures), 1);
+
+	if ((events & BEV_EVENT_CONNECTED) && session->deferred) {
+		PROBE2(backend__connect, session->id, session->proxy->backend.remote.address);
+		if (session->proxy->backend.auth) {
+			session->deferred = SESSION_DEFERRED_AUTH;
+		} else {
+			bufferevent_set_timeouts(session->server, NULL, NULL);
+			session->deferred = 0;
+		}
+	} else if (events & BEV_EVENT_CONNECTED) {
+		PROBE2(backend__connect, session->id, session->proxy->backend.remote.address);
 		if (session->proxy->backend.auth == NULL) {
 			bufferevent_set_timeouts(session->server, NULL, NULL);
 			session->ss = SESSION_CLIENT_CHECK;
@@ -120,35 +318,479 @@ void session_server_event(struct bufferevent *be, short events, void *arg)
 	}
 }
 
+int session_flush(session_t *session)
+{
+	queue_entry_t *e;
+	int i;
+
+	while (((e = queue_head(&session->rq)) != NULL) && queue_local(e)) {
+		if (e->cached && (e->cached->reply == NULL))
+			break;
+		if (e->cached) {
+			i = bufferevent_write(session->client, e->cached->reply, e->cached->replen);
+			cache_release(session->proxy->cache, e->cached);
+		} else {
+			i = bufferevent_write(session->client, e->reply->payload, e->reply->len);
+		}
+		queue_pop(&session->rq);
+		if (i == -1) {
+			LOG(E1, "bufferevent_write() failed, dropping session from client %s", session->remote.address);
+			session_drop(session, NULL);
+			return(-1);
+		}
+	}
+
+	return(0);
+}
+
+int session_reply(session_t *session, resp_t *reply)
+{
+	queue_entry_t *e;
+
+	if (session->untracked && (queue_length(&session->rq) == 0)) {
+		if (bufferevent_write(session->client, reply->payload, reply->len) == -1) {
+			LOG(E1, "bufferevent_write() failed, dropping session from client %s", session->remote.address);
+			session_drop(session, NULL);
+			return(-1);
+		}
+		return(0);
+	}
+
+	if ((e = queue_push(&session->rq)) == NULL) {
+		session_drop(session, NULL);
+		return(-1);
+	}
+
+	e->reply = reply;
+
+	return(session_flush(session));
+}
+
+int session_db(session_t *session)
+{
+	int i, db = 0;
+
+	if ((session->rs.arglen < 1) || (session->rs.arglen > 9) || session->multi)
+		return(-1);
+
+	for (i = 0; i < session->rs.arglen; i++) {
+		if ((session->rs.arg[i] < '0') || (session->rs.arg[i] > '9'))
+			return(-1);
+		db = db * 10 + session->rs.arg[i] - '0';
+	}
+
+	return(db);
+}
+
+/* NOTE: tells whether a command may write keys past its first argument */
+int session_keys(session_t *session)
+{
+	const cmd_t *c = &cmd_table[session->cmd];
+
+	return((c->flags & CMD_WRITE) && ((c->last < 0) || (c->last > 1) || c->numkeys || (c->flags & CMD_STORE)));
+}
+
+/* NOTE: tells whether an argument past the first one, just copied aside by the parser, is
+         a key; besides those at fixed positions, keys are counted by 'numkeys' argument
+         (its index being given by the command) or follow 'store' (and 'storedist') */
+int session_key(session_t *session)
+{
+	const cmd_t *c = &cmd_table[session->cmd];
+	int n = session->rs.keyn;
+
+	if (session->store) {
+		session->store = 0;
+		return(1);
+	}
+
+	if ((c->flags & CMD_STORE) && (((session->rs.keylen == 5) && (strncasecmp(session->rs.key, "store", 5) == 0)) ||
+		((session->rs.keylen == 9) && (strncasecmp(session->rs.key, "storedist", 9) == 0)))) {
+		session->store = 1;
+		return(0);
+	}
+
+	if (c->numkeys) {
+		if (n == c->numkeys)
+			session->numkeys = atoi(session->rs.key);
+		else if ((c->numkeys == 1) && (n == 2))
+			session->numkeys = atoi(session->rs.arg);
+		if ((n > c->numkeys) && (n <= c->numkeys + session->numkeys))
+			return(1);
+	}
+
+	return(cmd_key(session->cmd, n, session->rs.parts));
+}
+
+void session_track(session_t *session, int flags, cache_entry_t *cached)
+{
+	queue_entry_t *e;
+	int i = cmd_table[session->cmd].flags;
+
+	if (!(flags & QUEUE_BLOCKED)) {
+		if (i & CMD_TX_BEGIN)
+			session->multi = 1;
+		else if (i & CMD_TX_END)
+			session->multi = 0;
+		if (i & CMD_PROTOCOL)
+			session->nocache = 1;
+		if ((i & CMD_FLUSH) && session->proxy->cache)
+			cache_clear(session->proxy->cache);
+		cache_touch(session->proxy->cache, session->cmd, session->rs.arg, session->rs.arglen);
+		/* NOTE: database isn't known (and cache can't be used) until redis confirms it has been selected */
+		if (i & (CMD_SELECT | CMD_RESET)) {
+			session->db_pending = (i & CMD_SELECT) ? session_db(session):0;
+			session->db = -1;
+			session->selecting++;
+			flags |= QUEUE_SELECT;
+		}
+	}
+
+	if (session->untracked) {
+		cache_abandon(session->proxy->cache, cached);
+		return;
+	}
+
+	if ((session->rs.arglen == 5) && (strncasecmp(session->rs.arg, "reply", 5) == 0) && (strcmp(cmd_table[session->cmd].name, "client") == 0)) {
+		/* NOTE: 'client reply off|skip' suppresses replies, there's nothing to pair them with */
+		session->untracked = 1;
+		cache_abandon(session->proxy->cache, cached);
+		return;
+	}
+
+	if ((e = queue_push(&session->rq)) == NULL) {
+		session->untracked = 1;
+		cache_abandon(session->proxy->cache, cached);
+		return;
+	}
+
+	e->sent = stats_clock();
+	e->acl = session->acl;
+	e->cmd = session->cmd;
+	e->flags = flags;
+
+	if (session->proxy->slowlog) {
+		e->args = session->rs.parts - 1;
+		e->arglen = session->rs.arglen;
+		if (e->arglen > 0)
+			memcpy(e->arg, session->rs.arg, MIN(e->arglen, SLOWLOG_ARG_MAX));
+	}
+
+	if (cached) {
+		e->cached = cached;
+		e->flags |= QUEUE_FILL;
+	}
+
+	/* NOTE: replies don't pair with commands anymore (pubsub, monitor...), stop tracking for good,
+	         once reply to this very command has been received */
+	if (cmd_table[session->cmd].flags & CMD_UNTRACKED)
+		session->untracked = 1;
+}
+
+int session_block(session_t *session)
+{
+	/* NOTE: blocked command is answered by proxis in its place in a pipeline, unless
+	         replies aren't tracked or we're in a transaction (redis has to know about
+	         failed command to discard it); then we send non-existing command to backend
+	         to let redis itself generate an error for us */
+	if (!session->untracked && !session->multi)
+		return(session_reply(session, session->proxy->frontend.denied));
+
+	if (bufferevent_write(session->server, session->proxy->backend.nauth->payload, session->proxy->backend.nauth->len) != 0) {
+		LOG(E1, "got error from server %s, %s", session->proxy->backend.remote.address, strerror(errno));
+		session_drop(session, "got error from a server");
+		return(-1);
+	}
+
+	session_track(session, QUEUE_BLOCKED, NULL);
+
+	return(0);
+}
+
+void session_latency(session_t *session, queue_entry_t *e, uint64_t now)
+{
+	stats_histogram_record(stats_histogram_get(&session->proxy->latency[e->cmd]), now - e->sent);
+
+	if (e->acl)
+		stats_histogram_record(stats_histogram_get(&e->acl->latency), now - e->sent);
+}
+
+/* NOTE: allowed commands aren't moved to a server one by one, but in runs,
+         as a single chain move up to the first command not passing */
+int session_forward(session_t *session, int len)
+{
+	if (len <= 0)
+		return(0);
+
+	if (evbuffer_remove_buffer(bufferevent_get_input(session->client), bufferevent_get_output(session->server), len) != len) {
+		LOG(E1, "evbuffer_remove_buffer() failed, dropping session from client %s", session->remote.address);
+		session_drop(session, NULL);
+		return(-1);
+	}
+
+	PROBE2(forward, session->id, len);
+
+	/* NOTE: start becomes negative when a command has been forwarded only partially */
+	session->rs.parsed -= len;
+	session->rs.start -= len;
+
+	return(0);
+}
+
+int session_cacheable(session_t *session)
+{
+	cache_t *cache = session->proxy->cache;
+
+	return(cache && cache->commands[session->cmd] && !session->untracked && !session->multi && !session->nocache && (session->db >= 0) && (session->rs.start >= 0) && (session->rs.parsed - session->rs.start <= CACHE_REQUEST_MAX));
+}
+
+/* NOTE: answers complete command from cache (returns 1), or gives an entry to be filled by its reply;
+         identical command already sent by any session is not sent again, its reply is waited for */
+int session_cache(session_t *session, cache_entry_t **fill)
+{
+	cache_t *cache = session->proxy->cache;
+	struct evbuffer *src = bufferevent_get_input(session->client);
+	char request[CACHE_REQUEST_MAX];
+	struct evbuffer_ptr p;
+	cache_entry_t *entry;
+	queue_entry_t *e;
+	int len = session->rs.parsed - session->rs.start;
+
+	*fill = NULL;
+
+	if (!session_cacheable(session) || !cache_cacheable(cache, session->cmd, session->rs.arg, session->rs.arglen))
+		return(0);
+
+	if ((evbuffer_ptr_set(src, &p, session->rs.start, EVBUFFER_PTR_SET) == -1) || (evbuffer_copyout_from(src, &p, request, len) != len))
+		return(0);
+
+	if ((entry = cache_get(cache, session->db, request, len, session->rs.arg, session->rs.arglen)) == NULL) {
+		*fill = cache_reserve(cache, session->db, request, len, session->rs.arg, session->rs.arglen);
+		return(0);
+	}
+
+	if (session_forward(session, session->rs.start) == -1) {
+		cache_release(cache, entry);
+		return(-1);
+	}
+
+	if ((evbuffer_drain(src, session->rs.parsed) != 0) || ((e = queue_push(&session->rq)) == NULL)) {
+		LOG(E1, "failed to answer from cache, dropping session from client %s", session->remote.address);
+		cache_release(cache, entry);
+		session_drop(session, NULL);
+		return(-1);
+	}
+
+	session->rs.parsed = session->rs.start = 0;
+
+	e->acl = session->acl;
+	e->cmd = session->cmd;
+	e->cached = entry;
+	e->flags = QUEUE_HIT;
+
+	/* NOTE: waiting entry is always the last one, nothing more is read from a client meanwhile */
+	if (entry->pending) {
+		cache_wait(entry, &session->wait);
+		session->waiting = 1;
+		bufferevent_disable(session->client, EV_READ);
+		return(1);
+	}
+
+	return((session_flush(session) == -1) ? -1:1);
+}
+
+/* NOTE: called from within another session, actual work is deferred to a client read callback */
+void session_wake(void *arg)
+{
+	session_t *session = (session_t *)arg;
+
+	bufferevent_trigger(session->client, EV_READ, BEV_TRIG_IGNORE_WATERMARKS | BEV_TRIG_DEFER_CALLBACKS);
+}
+
+int session_resume(session_t *session)
+{
+	queue_entry_t *e = queue_tail(&session->rq);
+
+	session->waiting = 0;
+	bufferevent_enable(session->client, EV_READ);
+
+	/* NOTE: command waited for hasn't got its reply (session sending it is gone, reply too large...),
+	         so it's sent to a server after all */
+	if (e && (e->flags & QUEUE_HIT) && (e->cached->reply == NULL)) {
+		if (bufferevent_write(session->server, e->cached->request, e->cached->reqlen) == -1) {
+			LOG(E1, "got error from server %s, %s", session->proxy->backend.remote.address, strerror(errno));
+			session_drop(session, "got error from a server");
+			return(-1);
+		}
+		cache_release(session->proxy->cache, e->cached);
+		e->cached = NULL;
+		e->flags &= ~QUEUE_HIT;
+		e->sent = stats_clock();
+	}
+
+	return(session_flush(session));
+}
+
+/* NOTE: bytes of a command to be mirrored still in client's input (those forwarded already
+         have been staged), the command is sent to shadow redis once complete */
+int session_shadow(session_t *session, int complete)
+{
+	shadow_t *shadow = session->proxy->shadow;
+	int start = MAX(session->rs.start, 0);
+
+	if (shadow_stage(shadow, &session->staged, bufferevent_get_input(session->client), start, session->rs.parsed - start) == -1) {
+		__atomic_fetch_add(&shadow->dropped, 1, __ATOMIC_RELAXED);
+		if (session->staged)
+			evbuffer_drain(session->staged, evbuffer_get_length(session->staged));
+		session->shadow = 0;
+		return(-1);
+	}
+
+	if (complete) {
+		shadow_send(shadow, session->shadow, session->db, session->staged);
+		session->shadow = 0;
+	}
+
+	return(0);
+}
+
+/* NOTE: called by pubsub when a subscriber can't be served anymore, the session is dropped
+         from within its own event callback */
+void session_lost(void *arg)
+{
+	session_t *session = (session_t *)arg;
+
+	bufferevent_trigger_event(session->client, BEV_EVENT_ERROR, BEV_TRIG_DEFER_CALLBACKS);
+}
+
+/* NOTE: with 'shared_pubsub', subscribe commands are served by proxis itself (once no reply
+         is pending), so are all commands of a subscribed session; 'quit' and 'reset' leave
+         all the channels and pass to redis as usual */
+int session_subscriber(session_t *session)
+{
+	int flags = cmd_table[session->cmd].flags;
+
+	if (session->sub.count) {
+		if (!(flags & CMD_RESET) && strcmp(cmd_table[session->cmd].name, "quit"))
+			return(1);
+		pubsub_leave(session->proxy->pubsub, &session->sub);
+		return(0);
+	}
+
+	return(session->proxy->pubsub && (flags & CMD_SUBSCRIBE) && !session->untracked && !session->multi && !session->nocache && !queue_length(&session->rq));
+}
+
+/* NOTE: complete command of a subscriber is answered right into client's output, messages
+         published are added there in between */
+int session_pubsub(session_t *session)
+{
+	struct evbuffer *src = bufferevent_get_input(session->client);
+	char *request;
+	int i = -1;
+
+	if ((session->rs.start == 0) && ((request = (char *)evbuffer_pullup(src, session->rs.parsed)) != NULL))
+		i = pubsub_command(session->proxy->pubsub, &session->sub, request, session->rs.parsed);
+
+	if ((i == 1) && (evbuffer_add_printf(bufferevent_get_output(session->client),
+	    "-ERR Can't execute '%s': only (P)SUBSCRIBE / (P)UNSUBSCRIBE / PING / QUIT / RESET are allowed in this context\r\n", session->rs.cmd) == -1))
+		i = -1;
+
+	if ((i == -1) || (evbuffer_drain(src, session->rs.parsed) != 0)) {
+		LOG(E1, "failed to serve subscriber, dropping session from client %s", session->remote.address);
+		session_drop(session, NULL);
+		return(-1);
+	}
+
+	session->rs.parsed = session->rs.start = 0;
+
+	return(0);
+}
+
+/* NOTE: session which has used up its quantum gets its read callback run again (with
+         no new data needed), after other events of the loop iteration */
+void session_yield(session_t *session)
+{
+	STATS_ADD(session->proxy->counters->read_yields, 1);
+
+	if (session->acl)
+		STATS_ADD(session->proxy->counters->acl[session->acl->index].yields, 1);
+
+	bufferevent_trigger(session->client, EV_READ, BEV_TRIG_IGNORE_WATERMARKS | BEV_TRIG_DEFER_CALLBACKS);
+}
+
+/* NOTE: deferred session connects to a server with the first command allowed, the
+         command itself is forwarded (into server's output) right away, as usual, right
+         behind our 'auth' */
+int session_server_connect(session_t *session)
+{
+	resp_t *auth = session->proxy->backend.auth;
+
+	LOG(D1, "client %s has got a command to pass, connecting to server %s", session->remote.address, session->proxy->backend.remote.address);
+
+	if (auth && (bufferevent_write(session->server, auth->payload, auth->len) == -1)) {
+		LOG(E1, "failed to authenticate to server %s, %s", session->proxy->backend.remote.address, strerror(errno));
+		session_drop(session, "failed to authenticate to a server");
+		return(-1);
+	}
+
+	session->deferred = SESSION_DEFERRED_CONNECT;
+
+	proxy_connect(session->proxy, session);
+
+	return(0);
+}
+
 void session_client_read(struct bufferevent *be, void *arg)
 {
 	session_t *session = (session_t *)arg;
 	struct evbuffer *src = bufferevent_get_input(session->client);
-	struct evbuffer *dst = bufferevent_get_output(session->server);
 	int i;
 	const char **c = NULL;
-	char *password;
+	char *password, value[RESP_VALUE_MAX];
+	cache_entry_t *cached;
 	X509 *cert;
+	size_t budget = 0, available = 0;
+
+	if (session->closing)
+		return;
+
+	if (session->proxy->wheel)
+		session->active = wheel_now(session->proxy->wheel);
 
 	if ((session->ssl != NULL) && (session->remote.common_name[0] == '\0')) {
 		cert = SSL_get_peer_certificate(session->ssl);
 		if (cert) {
 			X509_NAME_get_text_by_NID(X509_get_subject_name(cert), NID_commonName, session->remote.common_name, MAXHOSTNAME);
-			session->acl = acl_match_cert(session->proxy->acl, session->remote.common_name);
+			session_acl(session, acl_match_cert(session->proxy->acl, session->remote.common_name));
 			LOG(D1, "client %s has sent a certificate for commonName '%s'", session->remote.address, session->remote.common_name);
 		}
 	}
 
-	if ((session->ss == SESSION_SERVER_CONNECT) || (session->ss == SESSION_SERVER_AUTH))
+	if ((session->ss == SESSION_SERVER_CONNECT) || (session->ss == SESSION_SERVER_AUTH) || session->wait.entry)
 		return;
 
+	if (session->waiting && (session_resume(session) == -1))
+		return;
+
+	/* NOTE: with 'read_quantum', a single callback processes commands up to a quantum
+	         weighted by session's acl entry, the rest is left for the next loop iteration,
+	         so that a client pipelining in bulk can't hold the loop for everyone else */
+	if (session->proxy->read_quantum) {
+		available = evbuffer_get_length(src) - session->rs.parsed;
+		budget = (size_t)session->proxy->read_quantum * ((session->acl) ? session->acl->weight:1);
+	}
+
 	while ((i = resp_parse_buffer(&session->rs)) > 0) {
 		if (session->ss == SESSION_CLIENT_CHECK) {
+			session->cmd = cmd_lookup(session->rs.cmd, session->rs.cmdlen);
 			if (strncasecmp(session->rs.cmd, "auth", MIN(4, session->rs.cmdlen)) == 0) {
 				/* NOTE: in case we've got 'auth' command with correct number of arguments,
 				         we're gonna process it ourselves, otherwise we pass it to let redis
 				         generate an error for a client */
 				session->ss = (session->rs.pending_parts == 1) ? SESSION_CLIENT_AUTH:SESSION_CLIENT_PASS;
+				if ((session->ss == SESSION_CLIENT_AUTH) && (session_forward(session, session->rs.start) == -1))
+					return;
+				if ((session->ss == SESSION_CLIENT_PASS) && (session->deferred == SESSION_DEFERRED) && (session_server_connect(session) == -1))
+					return;
 				continue;
 			}
 			session->ss = SESSION_CLIENT_BLOCK;
@@ -167,112 +809,427 @@ void session_client_read(struct bufferevent *be, void *arg)
 				}
 				c++;
 			}
-			session->rs.cmd[session->rs.cmdlen] = '\0';
 			LOG(D1, "command '%s' from client %s %s using acl '%s'", session->rs.cmd, session->remote.address, (session->ss == SESSION_CLIENT_PASS) ? "allowed":"blocked", (session->acl) ? session->acl->id:"");
-			session->rs.cmd[session->rs.cmdlen] = '\n';
+			PROBE4(acl__decision, session->id, session->rs.cmd, session->ss == SESSION_CLIENT_PASS, (session->acl) ? session->acl->id:"");
+			session_count(session, session->ss == SESSION_CLIENT_PASS);
+			/* NOTE: commands queued in a transaction aren't mirrored, it may be discarded yet */
+			session->shadow = ((session->ss == SESSION_CLIENT_PASS) && session->proxy->shadow && !session->multi) ? shadow_begin(session->proxy->shadow, session->cmd):0;
+			/* NOTE: keys of a write past its first argument are invalidated as they're parsed,
+			         they may be forwarded before the command is complete */
+			session->rs.keys = (session->ss == SESSION_CLIENT_PASS) && session->proxy->cache && session_keys(session);
+			session->numkeys = session->store = 0;
+			if ((session->ss == SESSION_CLIENT_PASS) && session_subscriber(session)) {
+				session->ss = SESSION_CLIENT_PUBSUB;
+				if (session_forward(session, session->rs.start) == -1)
+					return;
+			}
+			if ((session->ss == SESSION_CLIENT_PASS) && (session->deferred == SESSION_DEFERRED) && (session_server_connect(session) == -1))
+				return;
+			if ((session->ss == SESSION_CLIENT_BLOCK) && (session_forward(session, session->rs.start) == -1))
+				return;
+		}
+		if (session->rs.keyn) {
+			if (session_key(session))
+				cache_touch(session->proxy->cache, session->cmd, session->rs.key, session->rs.keylen);
+			session->rs.keyn = 0;
 		}
-		if (session->ss == SESSION_CLIENT_PASS) {
-			session->rs.parsed -= evbuffer_remove_buffer(src, dst, session->rs.parsed);
-		} else if (session->ss == SESSION_CLIENT_BLOCK) {
+		if (session->ss == SESSION_CLIENT_BLOCK) {
 			if (evbuffer_drain(src, session->rs.parsed) != 0) {
 				LOG(E1, "evbuffer_drain() failed, dropping session from client %s", session->remote.address);
 				session_drop(session, NULL);
-				continue;
+				return;
 			}
+			session->rs.start -= session->rs.parsed;
 			session->rs.parsed = 0;
 		} else if (session->ss == SESSION_CLIENT_AUTH) {
-			if ((password = resp_get_last_value(&session->rs)) == NULL)
-				continue;
-			session->acl = acl_match_auth(session->proxy->acl, password);
-			free(password);
-			if (session->acl == NULL) {
-				i = bufferevent_write(session->client, session->proxy->frontend.autherr->payload, session->proxy->frontend.autherr->len);
-				LOG(W1, "invalid 'auth' from client %s, not using any acl entry", session->remote.address);
-			} else {
-				i = bufferevent_write(session->client, session->proxy->frontend.authok->payload, session->proxy->frontend.authok->len);
-				LOG(D1, "successful 'auth' from client %s, using acl '%s'", session->remote.address, session->acl->id);
-			}
-			if (i == -1) {
-				LOG(E1, "bufferevent_write() failed, dropping session from client %s", session->remote.address);
-				session_drop(session, NULL);
+			if ((password = resp_get_last_value(&session->rs, value, sizeof(value))) == NULL)
 				continue;
-			}
+			session_acl(session, acl_match_auth(session->proxy->acl, password));
+			if (password != value)
+				free(password);
+			session_audit(session, (session->acl) ? AUDIT_AUTH_OK:AUDIT_AUTH_FAILED);
 			if (evbuffer_drain(src, session->rs.parsed) != 0) {
 				LOG(E1, "evbuffer_drain() failed, dropping session from client %s", session->remote.address);
 				session_drop(session, NULL);
-				continue;
+				return;
 			}
+			session->rs.start -= session->rs.parsed;
 			session->rs.parsed = 0;
 			session->ss = SESSION_CLIENT_CHECK;
+			if (session->acl == NULL) {
+				LOG(W1, "invalid 'auth' from client %s, not using any acl entry", session->remote.address);
+				STATS_ADD(session->proxy->counters->auth_failed, 1);
+				if (session_reply(session, session->proxy->frontend.autherr) == -1)
+					return;
+			} else {
+				LOG(D1, "successful 'auth' from client %s, using acl '%s'", session->remote.address, session->acl->id);
+				STATS_ADD(session->proxy->counters->auth_ok, 1);
+				if (session_reply(session, session->proxy->frontend.authok) == -1)
+					return;
+			}
 		}
 		if (session->rs.pending_parts == 0) {
-			session->rs.cmd = NULL;
-			session->rs.cmdlen = 0;
-			if (session->ss == SESSION_CLIENT_BLOCK) {
-				/* NOTE: sort-of hack for pipelined client commands
-				         when a client command has been blocked, we send non-existing
-				         command to backend to let redis itself generate an error for us
-				         this way, we don't need to inspect every redis response, waiting
-				         for "the right moment" to send our own "not authorized" error
-				*/
-				if (bufferevent_write(session->server, session->proxy->backend.nauth->payload, session->proxy->backend.nauth->len) != 0) {
-					LOG(E1, "got error from server %s, %s", session->proxy->backend.remote.address, strerror(errno));
-					session_drop(session, "got error from a server");
-					continue;
-				}
+			PROBE3(command, session->id, session->rs.cmd, session->rs.parsed - session->rs.start);
+			if (session->ss == SESSION_CLIENT_PASS) {
+				session_audit(session, AUDIT_ALLOWED);
+				if (session->proxy->hotkeys && cmd_key(session->cmd, 1, session->rs.parts) && (session->rs.arglen > 0))
+					hotkeys_sample(session->proxy->hotkeys, session->rs.arg, MIN(session->rs.arglen, RESP_ARG_MAX), session->acl);
+				if (session->shadow)
+					session_shadow(session, 1);
+				if ((i = session_cache(session, &cached)) == -1)
+					return;
+				if (i == 0)
+					session_track(session, 0, cached);
+			} else if (session->ss == SESSION_CLIENT_PUBSUB) {
+				session_audit(session, AUDIT_ALLOWED);
+				if (session_pubsub(session) == -1)
+					return;
+			} else if (session->ss == SESSION_CLIENT_BLOCK) {
+				session_audit(session, AUDIT_BLOCKED);
+				if (session_block(session) == -1)
+					return;
 			}
 			session->ss = SESSION_CLIENT_CHECK;
+			if (session->waiting)
+				break;
+			if (budget && (available - (evbuffer_get_length(src) - session->rs.parsed) >= budget) && (evbuffer_get_length(src) > session->rs.parsed)) {
+				/* NOTE: command just completed is forwarded below along with those before it,
+				         its clock has been started already */
+				session->rs.start = session->rs.parsed;
+				session_yield(session);
+				break;
+			}
 		}
 	}
 
 	if (i == -1) {
 		LOG(E1, "resp_parse_buffer() failed, dropping session from client %s", session->remote.address);
 		session_drop(session, NULL);
+		return;
 	}
+
+	if ((session->ss == SESSION_CLIENT_PASS) && session->shadow && !session_cacheable(session))
+		session_shadow(session, 0);
+
+	/* NOTE: command which might be answered from cache is held back until it's complete */
+	session_forward(session, ((session->ss == SESSION_CLIENT_PASS) && !session_cacheable(session)) ? session->rs.parsed:session->rs.start);
 }
 
-void session_server_read(struct bufferevent *be, void *arg)
+#ifdef LINUX
+void session_splice_stop(session_t *session)
+{
+	event_del(session->splice_read);
+	event_del(session->splice_write);
+
+	bufferevent_enable(session->server, EV_READ);
+}
+
+void session_splice(evutil_socket_t fd, short events, void *arg)
 {
 	session_t *session = (session_t *)arg;
+	ssize_t n;
 
-	if (session->ss > SESSION_SERVER_AUTH) {
-		bufferevent_read_buffer(session->server, bufferevent_get_output(session->client));
-	} else if (session->ss == SESSION_SERVER_AUTH) {
-		struct evbuffer *input = bufferevent_get_input(session->server);
-		char *response = evbuffer_pullup(input, 5);
-		if (response == NULL)
+	if ((events & EV_READ) && (session->splice > 0)) {
+		n = splice(bufferevent_getfd(session->server), NULL, session->pipe[1], NULL, session->splice, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n == 0) {
+			LOG(W1, "server %s has closed connection", session->proxy->backend.remote.address);
+			session_drop(session, "server has closed connection");
+			return;
+		} else if ((n == -1) && (errno != EAGAIN)) {
+			LOG(E1, "got error from server %s, %s", session->proxy->backend.remote.address, strerror(errno));
+			session_drop(session, "got error from a server");
+			return;
+		} else if (n > 0) {
+			/* NOTE: spliced bytes are accounted for as if the reply parser has seen them */
+			session->splice -= n;
+			session->piped += n;
+			session->rr.pending_bytes -= n;
+			session->rr.size += n;
+			STATS_ADD(session->proxy->counters->server_in, n);
+		}
+	}
+
+	while (session->piped > 0) {
+		n = splice(session->pipe[0], NULL, bufferevent_getfd(session->client), NULL, session->piped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if ((n == -1) && (errno == EAGAIN))
+			break;
+		if (n <= 0) {
+			LOG(E1, "got error from client %s, %s", session->remote.address, strerror(errno));
+			session_drop(session, NULL);
+			return;
+		}
+		session->piped -= n;
+		STATS_ADD(session->proxy->counters->client_out, n);
+	}
+
+	/* NOTE: while a pipe is not empty, we wait for a client to become writable, not to read more */
+	if (session->piped > 0) {
+		event_del(session->splice_read);
+		event_add(session->splice_write, NULL);
+	} else if (session->splice > 0) {
+		event_del(session->splice_write);
+		event_add(session->splice_read, NULL);
+	} else {
+		session_splice_stop(session);
+	}
+}
+
+void session_splice_start(session_t *session)
+{
+	if (session->splice || session->piped)
+		return;
+
+	if (session->splice_read == NULL) {
+		if (pipe2(session->pipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+			LOG(W1, "pipe2() failed, not splicing for client %s, %s", session->remote.address, strerror(errno));
 			return;
-		if (strncmp(response, "+OK\r\n", 5)) {
-			response[4] = '\0';
-			LOG(W1, "unexpected auth response from server %s, %s", session->proxy->backend.remote.address, response);
-			session_drop(session, "unexpected auth response from a server");
+		}
+		session->splice_read = event_new(session->proxy->eb, bufferevent_getfd(session->server), EV_READ | EV_PERSIST, session_splice, session);
+		session->splice_write = event_new(session->proxy->eb, bufferevent_getfd(session->client), EV_WRITE | EV_PERSIST, session_splice, session);
+		if ((session->splice_read == NULL) || (session->splice_write == NULL)) {
+			LOG(W1, "event_new() failed, not splicing for client %s", session->remote.address);
+			if (session->splice_read)
+				event_free(session->splice_read);
+			if (session->splice_write)
+				event_free(session->splice_write);
+			session->splice_read = session->splice_write = NULL;
+			close(session->pipe[0]);
+			close(session->pipe[1]);
+			return;
+		}
+	}
+
+	/* NOTE: trailing CRLF is left to the reply parser, so that it completes the reply */
+	session->splice = session->rr.pending_bytes - 2;
+
+	bufferevent_disable(session->server, EV_READ);
+
+	/* NOTE: replies already buffered for a client have to be written first, see session_client_write() */
+	if (evbuffer_get_length(bufferevent_get_output(session->client)) == 0)
+		event_add(session->splice_read, NULL);
+}
+#endif
+
+void session_client_write(struct bufferevent *be, void *arg)
+{
+	session_t *session = (session_t *)arg;
+
+	/* NOTE: session closing (see session_reply_size()) has got everything written */
+	if (session->closing) {
+		session_drop(session, NULL);
+		return;
+	}
+
+#ifdef LINUX
+	if ((session->splice > 0) && (session->piped == 0) && !event_pending(session->splice_read, EV_READ, NULL))
+		event_add(session->splice_read, NULL);
+#endif
+}
+
+/* NOTE: reply is checked against 'max_reply_bytes' of acl its command has been allowed by
+         while it streams through, as soon as its header says it's going to be too large
+         (size parsed so far and the rest of a bulk string); unless some of it has been
+         passed to a client already (the session is just dropped then, as if truncated),
+         the client gets replies preceding it and an error instead, nothing is read from
+         either side anymore and the session is closed once all of it is written */
+int session_reply_size(session_t *session, queue_entry_t *e)
+{
+	struct evbuffer *src = bufferevent_get_input(session->server);
+	struct evbuffer *dst = bufferevent_get_output(session->client);
+	long long size = session->rr.size + session->rr.pending_bytes;
+
+	if ((e->acl == NULL) || (e->acl->max_reply_bytes == 0) || (size <= e->acl->max_reply_bytes))
+		return(0);
+
+	LOG(W1, "reply to '%s' of %l bytes at least exceeds 'max_reply_bytes' of acl '%s', closing session of client %s",
+		cmd_table[e->cmd].name, (long)size, e->acl->id, session->remote.address);
+	STATS_ADD(session->proxy->counters->acl[e->acl->index].oversized, 1);
+
+	if (session->rr.size > session->rr.parsed) {
+		session_drop(session, NULL);
+		return(-1);
+	}
+
+	bufferevent_disable(session->server, EV_READ);
+	bufferevent_disable(session->client, EV_READ);
+	session->closing = 1;
+
+	if ((evbuffer_remove_buffer(src, dst, session->rr.parsed - session->rr.size) == -1) || (evbuffer_add(dst, SESSION_REPLY_TOO_LARGE, strlen(SESSION_REPLY_TOO_LARGE)) == -1))
+		session_drop(session, NULL);
+
+	return(-1);
+}
+
+void session_server_reply(session_t *session)
+{
+	struct evbuffer *src = bufferevent_get_input(session->server);
+	struct evbuffer *dst = bufferevent_get_output(session->client);
+	queue_entry_t *e;
+	uint64_t now = 0;
+	int i, hold = 0;
+
+	while ((i = resp_parse_reply(&session->rr, src)) > 0) {
+		/* NOTE: RESP3 push messages aren't replies to any command */
+		if ((session->rr.type == '>') || ((e = queue_head(&session->rq)) == NULL))
+			continue;
+		if (session_reply_size(session, e) == -1)
+			return;
+		PROBE3(reply, session->id, cmd_table[e->cmd].name, session->rr.size);
+		if ((session->proxy->latency || session->proxy->slowlog) && !(e->flags & QUEUE_BLOCKED)) {
+			if (now == 0)
+				now = stats_clock();
+			if (session->proxy->latency)
+				session_latency(session, e, now);
+			if (session->proxy->slowlog && (now - e->sent >= session->proxy->slowlog->slower_than))
+				slowlog_record(session->proxy->slowlog, now - e->sent, e->cmd, e->args, e->arg, e->arglen, session->remote.address, (e->acl) ? e->acl->id:NULL);
+		}
+		if (e->flags & QUEUE_SELECT) {
+			if (session->rr.type == '-')
+				session->db_pending = -1;
+			if (--session->selecting == 0)
+				session->db = session->db_pending;
+		}
+		if (e->flags & QUEUE_FILL) {
+			cache_fill(session->proxy->cache, e->cached, src, session->rr.parsed - session->rr.size, session->rr.size, (session->rr.type != '-') && (session->rr.type != '!'));
+			cache_release(session->proxy->cache, e->cached);
+		}
+		queue_pop(&session->rq);
+		if ((e = queue_head(&session->rq)) && queue_local(e)) {
+			evbuffer_remove_buffer(src, dst, session->rr.parsed);
+			session->rr.parsed = 0;
+			if (session_flush(session) == -1)
+				return;
+		}
+		if (session->untracked && (queue_length(&session->rq) == 0))
+			break;
+	}
+
+	if (i == -1) {
+		LOG(E1, "resp_parse_reply() failed, dropping session from client %s", session->remote.address);
+		session_drop(session, "failed to parse a server reply");
+		return;
+	}
+
+	if ((session->rr.remaining > 0) && (session->rr.type != '>') && (e = queue_head(&session->rq)) && (session_reply_size(session, e) == -1))
+		return;
+
+	/* NOTE: reply to be cached is kept in a buffer until it's complete, unless it's too large */
+	if ((e = queue_head(&session->rq)) && (e->flags & QUEUE_FILL) && (session->rr.remaining > 0)) {
+		if (session->rr.size + session->rr.pending_bytes <= session->proxy->cache->entry_max) {
+			hold = session->rr.size;
 		} else {
-			evbuffer_drain(input, 5);
-			bufferevent_set_timeouts(session->server, NULL, NULL);
-			session->ss = SESSION_CLIENT_CHECK;
-			bufferevent_enable(session->client, EV_READ | EV_WRITE);
+			cache_abandon(session->proxy->cache, e->cached);
+			e->cached = NULL;
+			e->flags &= ~QUEUE_FILL;
 		}
 	}
+
+	if (session->rr.parsed > hold) {
+		evbuffer_remove_buffer(src, dst, session->rr.parsed - hold);
+		session->rr.parsed = hold;
+	}
+
+	if (session->untracked && (queue_length(&session->rq) == 0)) {
+		evbuffer_add_buffer(dst, src);
+		return;
+	}
+
+#ifdef LINUX
+	/* NOTE: in the middle of a large bulk payload with nothing else buffered, the rest
+	         of it is moved socket to socket through a pipe, without being copied here */
+	if (session->proxy->splice && queue_length(&session->rq) && (session->rr.pending_bytes - 2 >= SESSION_SPLICE_MIN) && (evbuffer_get_length(src) == 0))
+		session_splice_start(session);
+#endif
+}
+
+/* NOTE: returns 1 once server has accepted our 'auth', 0 while its reply is incomplete */
+int session_server_auth(session_t *session)
+{
+	struct evbuffer *input = bufferevent_get_input(session->server);
+	char *response = evbuffer_pullup(input, 5);
+
+	if (response == NULL)
+		return(0);
+
+	if (strncmp(response, "+OK\r\n", 5)) {
+		response[4] = '\0';
+		LOG(W1, "unexpected auth response from server %s, %s", session->proxy->backend.remote.address, response);
+		STATS_ADD(session->proxy->counters->server_auth_failures, 1);
+		session_drop(session, "unexpected auth response from a server");
+		return(-1);
+	}
+
+	PROBE2(backend__auth, session->id, session->proxy->backend.remote.address);
+	evbuffer_drain(input, 5);
+	bufferevent_set_timeouts(session->server, NULL, NULL);
+
+	return(1);
+}
+
+void session_server_read(struct bufferevent *be, void *arg)
+{
+	session_t *session = (session_t *)arg;
+
+	if (session->closing)
+		return;
+
+	/* NOTE: server connected on demand has got commands of a client right after our 'auth' */
+	if (session->deferred == SESSION_DEFERRED_AUTH) {
+		if (session_server_auth(session) != 1)
+			return;
+		session->deferred = 0;
+	}
+
+	if ((session->ss > SESSION_SERVER_AUTH) && (!session->untracked || queue_length(&session->rq))) {
+		session_server_reply(session);
+	} else if (session->ss > SESSION_SERVER_AUTH) {
+		bufferevent_read_buffer(session->server, bufferevent_get_output(session->client));
+	} else if ((session->ss == SESSION_SERVER_AUTH) && (session_server_auth(session) == 1)) {
+		session->ss = SESSION_CLIENT_CHECK;
+		bufferevent_enable(session->client, EV_READ | EV_WRITE);
+	}
+}
+
+void session_connect(session_t *session)
+{
+	bufferevent_enable(session->server, EV_READ | EV_WRITE);
+
+	/* NOTE: bufferevent timeouts have been broken prior to libevent 2.1.2 */
+	bufferevent_set_timeouts(session->server, &session->proxy->backend.timeout, NULL);
+
+	/* NOTE: connections to redis mustn't be inherited by a process of hot upgrade */
+	if (bufferevent_socket_connect(session->server, &session->proxy->backend.remote.sa, sizeof(struct sockaddr)) == -1)
+		LOG(E1, "failed to connect to server %s, %s", session->proxy->backend.remote.address, strerror(errno));
+	else
+		evutil_make_socket_closeonexec(bufferevent_getfd(session->server));
 }
 
 session_t *session_create(proxy_t *proxy, evutil_socket_t fd, struct sockaddr *sa, int salen)
 {
-	session_t *session = (session_t *)malloc(sizeof(session_t));
+	session_t *session = (session_t *)pool_get(proxy->pool);
+	queue_t rq;
 
 	if (session == NULL) {
 		LOG(E1, "failed initialize session, %s", strerror(errno));
 		return(NULL);
 	}
 
+	/* NOTE: recycled session keeps the ring of its request queue */
+	rq = session->rq;
 	memset(session, 0, sizeof(session_t));
+	session->rq = rq;
 
 	session->proxy = proxy;
+	session->wait.wake = session_wake;
+	session->wait.arg = session;
+	session->sub.lost = session_lost;
+	session->sub.arg = session;
 
 	memcpy(&session->remote.sa, sa, salen);
 
 	getnameinfo(sa, salen, session->remote.address, INET6_ADDRSTRLEN, NULL, 0, NI_NUMERICHOST);
 
-	session->acl = acl_match_net(proxy->acl, session->remote.address);
+	session_acl(session, acl_match_net(proxy->acl, session->remote.address));
 
 	if (proxy->frontend.ssl_ctx) {
 		if ((session->ssl = SSL_new(proxy->frontend.ssl_ctx)) == NULL) {
@@ -286,32 +1243,71 @@ session_t *session_create(proxy_t *proxy, evutil_socket_t fd, struct sockaddr *s
 
 	if (session->client == NULL) {
 		LOG(E1, "failed to initialize client bufferevent, %s", strerror(errno));
-		free(session);
+		pool_put(proxy->pool, session);
 		return(NULL);
 	}
 
 	session->rs.eb = bufferevent_get_input(session->client);
+	session->sub.out = bufferevent_get_output(session->client);
 
 	session->server = bufferevent_socket_new(proxy->eb, -1, BEV_OPT_CLOSE_ON_FREE | BEV_OPT_DEFER_CALLBACKS);
 
 	if (session->server == NULL) {
 		LOG(E1, "failed to initialize server bufferevent, %s", strerror(errno));
-		free(session);
+		pool_put(proxy->pool, session);
 		return(NULL);
 	}
 
-	bufferevent_socket_connect(session->server, &proxy->backend.remote.sa, sizeof(struct sockaddr));
+	STATS_ADD(proxy->counters->sessions, 1);
+	STATS_ADD(proxy->counters->sessions_total, 1);
+
+	session->id = STATS_GET(proxy->counters->sessions_total);
+
+	PROBE2(session__accept, session->id, session->remote.address);
+
+	if ((session->next = proxy->sessions) != NULL)
+		session->next->prev = session;
+	proxy->sessions = session;
+
+	if (proxy->wheel) {
+		session->active = wheel_now(proxy->wheel);
+		if (proxy->idle_timeout)
+			wheel_add(proxy->wheel, &session->idle, (uint64_t)proxy->idle_timeout * 1000, session_idle, session);
+		if (proxy->max_lifetime)
+			wheel_add(proxy->wheel, &session->lifetime, (uint64_t)proxy->max_lifetime * 1000, session_expire, session);
+	}
+
+	evbuffer_add_cb(bufferevent_get_input(session->client), session_count_in, &proxy->counters->client_in);
+	evbuffer_add_cb(bufferevent_get_output(session->client), session_count_out, &proxy->counters->client_out);
+	evbuffer_add_cb(bufferevent_get_input(session->server), session_count_in, &proxy->counters->server_in);
+	evbuffer_add_cb(bufferevent_get_output(session->server), session_count_out, &proxy->counters->server_out);
+
+	/* NOTE: libevent reads and writes at most 16 KB per syscall by default */
+	if (proxy->io_chunk > 0) {
+		bufferevent_set_max_single_read(session->client, proxy->io_chunk);
+		bufferevent_set_max_single_write(session->client, proxy->io_chunk);
+		bufferevent_set_max_single_read(session->server, proxy->io_chunk);
+		bufferevent_set_max_single_write(session->server, proxy->io_chunk);
+	}
 
-	bufferevent_setcb(session->client, session_client_read, NULL, session_client_event, session);
+	bufferevent_setcb(session->client, session_client_read, session_client_write, session_client_event, session);
 	bufferevent_setcb(session->server, session_server_read, NULL, session_server_event, session);
 
-	bufferevent_enable(session->client, EV_WRITE); // NOTE: we enable EV_READ on a client side later, when connected to a server
-	bufferevent_enable(session->server, EV_READ | EV_WRITE);
+	/* NOTE: with 'redis_lazy' a client is served (its 'auth' and blocked commands) with
+	         no server, until it sends a command allowed */
+	if (proxy->lazy) {
+		bufferevent_enable(session->client, EV_READ | EV_WRITE);
+		session->ss = SESSION_CLIENT_CHECK;
+		session->deferred = SESSION_DEFERRED;
+		return(session);
+	}
 
-	/* NOTE: bufferevent timeouts have been broken prior to libevent 2.1.2 */
-	bufferevent_set_timeouts(session->server, &proxy->backend.timeout, NULL);
+	bufferevent_enable(session->client, EV_WRITE); // NOTE: we enable EV_READ on a client side later, when connected to a server
 
 	session->ss = SESSION_SERVER_CONNECT;
 
+	/* NOTE: connect may be postponed until there's a free slot (see 'max_connecting') */
+	proxy_connect(proxy, session);
+
 	return(session);
 }
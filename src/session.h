@@ -4,21 +4,59 @@
 #include "acl.h"
 #include "proxy.h"
 #include "resp.h"
+#include "queue.h"
+
+/* NOTE: state of a server connected on demand (see 'redis_lazy'), 0 once it's ready */
+#define SESSION_DEFERRED 1
+#define SESSION_DEFERRED_CONNECT 2
+#define SESSION_DEFERRED_AUTH 3
+
+/* NOTE: bulk payloads at least this long are spliced from server to client (when enabled) */
+#define SESSION_SPLICE_MIN 65536
+
+#define SESSION_REPLY_TOO_LARGE "-ERR reply exceeds 'max_reply_bytes'\r\n"
 
 typedef enum {
-	SESSION_SERVER_CONNECT, SESSION_SERVER_AUTH, SESSION_CLIENT_CHECK, SESSION_CLIENT_PASS, SESSION_CLIENT_BLOCK, SESSION_CLIENT_AUTH
+	SESSION_SERVER_CONNECT, SESSION_SERVER_AUTH, SESSION_CLIENT_CHECK, SESSION_CLIENT_PASS, SESSION_CLIENT_BLOCK, SESSION_CLIENT_AUTH, SESSION_CLIENT_PUBSUB
 } session_state_t;
 
-typedef struct {
+typedef struct session_s {
+	struct session_s *next, *prev;
+	struct session_s *connect_next, *connect_prev;
+	int connecting;
+	int deferred;
 	proxy_t *proxy;
 	proxy_peer_t remote;
+	uint64_t id;
 	acl_t *acl;
 	SSL *ssl;
 	struct bufferevent *client, *server;
 	session_state_t ss;
 	resp_buffer_t rs;
+	resp_reply_t rr;
+	queue_t rq;
+	int cmd;
+	int numkeys, store; // see session_key()
+	int untracked;
+	int multi;
+	int db, db_pending, selecting;
+	int nocache;
+	cache_waiter_t wait;
+	int waiting;
+	wheel_timer_t idle, lifetime;
+	uint64_t active;
+	int pipe[2];
+	long long splice, piped;
+	struct event *splice_read, *splice_write;
+	pubsub_subscriber_t sub;
+	unsigned int shadow;
+	struct evbuffer *staged;
+	int closing;
 } session_t;
 
+void session_release(void *object);
 session_t *session_create(proxy_t *proxy, evutil_socket_t fd, struct sockaddr *address, int socklen);
+void session_connect(session_t *session);
+void session_drain(session_t *session);
 
 #endif
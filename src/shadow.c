@@ -0,0 +1,299 @@
+/*
+   Copyright (c) 2018-2019, Seznam.cz, a.s.
+
+   Author: Daniel Bilik (daniel.bilik@firma.seznam.cz)
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+   PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+   BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+   POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <netdb.h>
+#include <libconfig.h>
+#include <event.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+
+#include "log.h"
+#include "cmd.h"
+#include "resp.h"
+#include "shadow.h"
+
+/* NOTE: shadow is owned by a single proxy, thus used by a single thread (its event loop),
+         only statistics counters are read from elsewhere (hence atomics); nothing here
+         ever waits for shadow redis, commands are just appended to its output */
+
+#define SHADOW_IOV 16
+
+void shadow_connect(evutil_socket_t fd, short events, void *arg);
+
+void shadow_disconnect(shadow_t *shadow)
+{
+	struct timeval tv = { SHADOW_RETRY, 0 };
+
+	if (shadow->be) {
+		bufferevent_free(shadow->be);
+		shadow->be = NULL;
+	}
+
+	__atomic_store_n(&shadow->ready, 0, __ATOMIC_RELAXED);
+
+	evtimer_add(shadow->retry, &tv);
+}
+
+void shadow_read(struct bufferevent *be, void *arg)
+{
+	shadow_t *shadow = (shadow_t *)arg;
+	struct evbuffer *src = bufferevent_get_input(be);
+	int i;
+
+	while ((i = resp_parse_reply(&shadow->rr, src)) > 0) {
+		if ((shadow->rr.type == '-') && (__atomic_fetch_add(&shadow->errors, 1, __ATOMIC_RELAXED) == 0))
+			LOG(W1, "shadow redis %s has replied with an error (more are just counted)", shadow->address);
+		evbuffer_drain(src, shadow->rr.parsed);
+		shadow->rr.parsed = 0;
+	}
+
+	if (i == -1) {
+		LOG(E1, "resp_parse_reply() failed on shadow connection");
+		shadow_disconnect(shadow);
+	}
+}
+
+void shadow_event(struct bufferevent *be, short events, void *arg)
+{
+	shadow_t *shadow = (shadow_t *)arg;
+
+	if (events & BEV_EVENT_CONNECTED) {
+		LOG(I1, "connected to shadow redis %s", shadow->address);
+		return;
+	}
+
+	if (events & BEV_EVENT_ERROR)
+		LOG(W1, "got error on shadow connection to %s, %s", shadow->address, evutil_socket_error_to_string(EVUTIL_SOCKET_ERROR()));
+	else if (events & BEV_EVENT_EOF)
+		LOG(W1, "shadow redis %s has closed connection", shadow->address);
+
+	shadow_disconnect(shadow);
+}
+
+void shadow_connect(evutil_socket_t fd, short events, void *arg)
+{
+	shadow_t *shadow = (shadow_t *)arg;
+	struct timeval tv = { SHADOW_RETRY, 0 };
+
+	if ((shadow->be = bufferevent_socket_new(shadow->eb, -1, BEV_OPT_CLOSE_ON_FREE | BEV_OPT_DEFER_CALLBACKS)) == NULL) {
+		LOG(E1, "failed to initialize shadow bufferevent, %s", strerror(errno));
+		evtimer_add(shadow->retry, &tv);
+		return;
+	}
+
+	memset(&shadow->rr, 0, sizeof(resp_reply_t));
+
+	bufferevent_setcb(shadow->be, shadow_read, NULL, shadow_event, shadow);
+	bufferevent_enable(shadow->be, EV_READ | EV_WRITE);
+
+	/* NOTE: commands are queued before being connected, libevent sends them once it is */
+	if (shadow->auth && (bufferevent_write(shadow->be, shadow->auth->payload, shadow->auth->len) == -1)) {
+		shadow_disconnect(shadow);
+		return;
+	}
+
+	if (bufferevent_socket_connect(shadow->be, &shadow->sa, sizeof(struct sockaddr)) == -1) {
+		LOG(W1, "failed to connect shadow redis %s", shadow->address);
+		shadow_disconnect(shadow);
+		return;
+	}
+
+	evutil_make_socket_closeonexec(bufferevent_getfd(shadow->be));
+
+	shadow->db = 0;
+	shadow->generation++;
+	__atomic_store_n(&shadow->ready, 1, __ATOMIC_RELAXED);
+}
+
+void shadow_start(shadow_t *shadow, struct event_base *eb)
+{
+	if (shadow == NULL)
+		return;
+
+	shadow->eb = eb;
+
+	if ((shadow->retry = evtimer_new(eb, shadow_connect, shadow)) == NULL) {
+		LOG(E1, "evtimer_new() failed, shadow disabled");
+		return;
+	}
+
+	shadow_connect(-1, 0, shadow);
+}
+
+/* NOTE: tells whether (with which generation) a command allowed is going to be mirrored,
+         blocking commands never are, they'd stall everything behind them; neither are
+         those with no key (eg. 'flushall', 'script', 'function') and scripts, keys they
+         work with can't be told by their position */
+unsigned int shadow_begin(shadow_t *shadow, int cmd)
+{
+	int flags = cmd_table[cmd].flags;
+
+	if ((flags & CMD_BLOCKING) || (cmd_table[cmd].first == 0) || !(flags & ((shadow->all) ? (CMD_READ | CMD_WRITE):CMD_WRITE)))
+		return(0);
+
+	if (!shadow->ready || (evbuffer_get_length(bufferevent_get_output(shadow->be)) >= shadow->buffer)) {
+		__atomic_fetch_add(&shadow->dropped, 1, __ATOMIC_RELAXED);
+		return(0);
+	}
+
+	return(shadow->generation);
+}
+
+/* NOTE: (part of) a command is copied aside, before it's forwarded to the server; it's
+         sent to shadow redis only once complete, so that commands of different sessions
+         never interleave there */
+int shadow_stage(shadow_t *shadow, struct evbuffer **stage, struct evbuffer *src, int offset, int len)
+{
+	struct evbuffer_iovec v[SHADOW_IOV];
+	struct evbuffer_ptr p;
+	int i, n, l;
+
+	if (len <= 0)
+		return(0);
+
+	if ((*stage == NULL) && ((*stage = evbuffer_new()) == NULL))
+		return(-1);
+
+	if (evbuffer_get_length(*stage) + len > shadow->buffer)
+		return(-1);
+
+	while (len > 0) {
+		if ((evbuffer_ptr_set(src, &p, offset, EVBUFFER_PTR_SET) == -1) || ((n = evbuffer_peek(src, len, &p, v, SHADOW_IOV)) <= 0))
+			return(-1);
+		for (i = 0; (i < n) && (i < SHADOW_IOV) && (len > 0); i++) {
+			l = (v[i].iov_len < len) ? v[i].iov_len:len;
+			if (evbuffer_add(*stage, v[i].iov_base, l) == -1)
+				return(-1);
+			offset += l;
+			len -= l;
+		}
+	}
+
+	return(0);
+}
+
+void shadow_send(shadow_t *shadow, unsigned int generation, int db, struct evbuffer *stage)
+{
+	struct evbuffer *out;
+	size_t len = evbuffer_get_length(stage);
+	char n[16];
+
+	/* NOTE: database of a session isn't known after a failed 'select' (nor until redis
+	         confirms one), there's nowhere to send its command to */
+	if (!shadow->ready || (generation != shadow->generation) || (db < 0)) {
+		__atomic_fetch_add(&shadow->dropped, 1, __ATOMIC_RELAXED);
+		evbuffer_drain(stage, len);
+		return;
+	}
+
+	out = bufferevent_get_output(shadow->be);
+
+	/* NOTE: sessions with different databases selected share the connection */
+	if (db != shadow->db) {
+		snprintf(n, sizeof(n), "%d", db);
+		evbuffer_add_printf(out, "*2\r\n$6\r\nSELECT\r\n$%d\r\n%s\r\n", (int)strlen(n), n);
+		shadow->db = db;
+	}
+
+	evbuffer_add_buffer(out, stage);
+
+	__atomic_fetch_add(&shadow->mirrored, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&shadow->bytes, len, __ATOMIC_RELAXED);
+}
+
+shadow_t *shadow_create(config_setting_t *config)
+{
+	shadow_t *shadow;
+	const char *value = NULL;
+	long long buffer = SHADOW_BUFFER;
+	int n = sizeof(struct sockaddr);
+
+	if ((shadow = (shadow_t *)malloc(sizeof(shadow_t))) == NULL) {
+		LOG(E1, "malloc() failed, %s", strerror(errno));
+		return(NULL);
+	}
+
+	memset(shadow, 0, sizeof(shadow_t));
+
+	if ((config_setting_lookup_string(config, "redis", &value) == CONFIG_FALSE) || (evutil_parse_sockaddr_port(value, &shadow->sa, &n) == -1)) {
+		LOG(E1, "'shadow' without valid 'redis'");
+		free(shadow);
+		return(NULL);
+	}
+
+	getnameinfo(&shadow->sa, n, shadow->address, INET6_ADDRSTRLEN, NULL, 0, NI_NUMERICHOST);
+
+	value = NULL;
+	config_setting_lookup_string(config, "auth", &value);
+
+	if (value)
+		shadow->auth = resp_command("AUTH", value, NULL);
+
+	value = NULL;
+	config_setting_lookup_string(config, "commands", &value);
+
+	if (value && strcmp(value, "all") && strcmp(value, "write")) {
+		LOG(E1, "invalid 'shadow' 'commands', 'write' or 'all' expected");
+		shadow_destroy(shadow);
+		return(NULL);
+	}
+
+	shadow->all = (value && (strcmp(value, "all") == 0));
+
+	config_setting_lookup_int64(config, "buffer", &buffer);
+
+	if (buffer < 65536) {
+		LOG(E1, "invalid 'shadow' 'buffer'");
+		shadow_destroy(shadow);
+		return(NULL);
+	}
+
+	shadow->buffer = buffer;
+
+	return(shadow);
+}
+
+void shadow_destroy(shadow_t *shadow)
+{
+	if (shadow == NULL)
+		return;
+
+	if (shadow->be)
+		bufferevent_free(shadow->be);
+	if (shadow->retry)
+		event_free(shadow->retry);
+
+	resp_free(shadow->auth);
+	free(shadow);
+}
@@ -0,0 +1,41 @@
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <libconfig.h>
+#include <event.h>
+
+#include "resp.h"
+
+#define SHADOW_BUFFER 16777216 // default limit of commands pending to be sent to shadow redis
+#define SHADOW_RETRY 5 // seconds between attempts to connect shadow redis
+
+/* NOTE: commands allowed are copied to shadow redis over a single connection per proxy,
+         its replies are counted and discarded; command is dropped when it's
+         disconnected or there's more than 'buffer' bytes not sent yet; generation
+         changes with every connection, command begun with another one is dropped */
+typedef struct {
+	int all;
+	long long buffer;
+	int ready, db;
+	unsigned int generation;
+	struct event_base *eb;
+	struct bufferevent *be;
+	struct event *retry;
+	struct sockaddr sa;
+	char address[INET6_ADDRSTRLEN];
+	resp_t *auth;
+	resp_reply_t rr;
+	uint64_t mirrored, dropped, bytes, errors;
+} shadow_t;
+
+shadow_t *shadow_create(config_setting_t *config);
+void shadow_destroy(shadow_t *shadow);
+void shadow_start(shadow_t *shadow, struct event_base *eb);
+unsigned int shadow_begin(shadow_t *shadow, int cmd);
+int shadow_stage(shadow_t *shadow, struct evbuffer **stage, struct evbuffer *src, int offset, int len);
+void shadow_send(shadow_t *shadow, unsigned int generation, int db, struct evbuffer *stage);
+
+#endif
@@ -0,0 +1,138 @@
+/*
+   Copyright (c) 2018-2019, Seznam.cz, a.s.
+
+   Author: Daniel Bilik (daniel.bilik@firma.seznam.cz)
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+   PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+   BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+   POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#include "log.h"
+#include "slowlog.h"
+
+slowlog_t *slowlog_create(long long slower_than, int max_len)
+{
+	slowlog_t *slowlog;
+
+	if ((slowlog = (slowlog_t *)malloc(sizeof(slowlog_t))) == NULL) {
+		LOG(E1, "malloc() failed, %s", strerror(errno));
+		return(NULL);
+	}
+
+	memset(slowlog, 0, sizeof(slowlog_t));
+
+	if ((slowlog->entry = (slowlog_entry_t *)malloc(max_len * sizeof(slowlog_entry_t))) == NULL) {
+		LOG(E1, "malloc() failed, %s", strerror(errno));
+		free(slowlog);
+		return(NULL);
+	}
+
+	memset(slowlog->entry, 0, max_len * sizeof(slowlog_entry_t));
+
+	slowlog->size = max_len;
+	slowlog->slower_than = slower_than;
+
+	return(slowlog);
+}
+
+void slowlog_destroy(slowlog_t *slowlog)
+{
+	if (slowlog == NULL)
+		return;
+
+	free(slowlog->entry);
+	free(slowlog);
+}
+
+/* NOTE: elapsed time is measured by monotonic clock, wall clock is only read
+         for a command that's going to be recorded */
+void slowlog_record(slowlog_t *slowlog, uint64_t elapsed, short cmd, int args, const char *arg, int arglen, const char *client, const char *acl)
+{
+	slowlog_entry_t *e = &slowlog->entry[slowlog->next % slowlog->size];
+	struct timeval tv;
+	uint32_t seq = e->seq;
+
+	gettimeofday(&tv, NULL);
+
+	__atomic_store_n(&e->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	e->id = slowlog->next;
+	e->received = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+	e->sent = e->received - elapsed;
+	e->cmd = cmd;
+	e->args = args;
+	e->arglen = arglen;
+	if (arglen > 0)
+		memcpy(e->arg, arg, (arglen < SLOWLOG_ARG_MAX) ? arglen:SLOWLOG_ARG_MAX);
+	strncpy(e->client, client, INET6_ADDRSTRLEN - 1);
+	e->acl = acl;
+
+	__atomic_store_n(&e->seq, seq + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&slowlog->next, slowlog->next + 1, __ATOMIC_RELEASE);
+}
+
+/* NOTE: copies out up to max entries, the most recent first; entry overwritten
+         while being read is skipped, as are the older ones then */
+int slowlog_read(slowlog_t *slowlog, slowlog_entry_t *dst, int max)
+{
+	uint64_t next = __atomic_load_n(&slowlog->next, __ATOMIC_ACQUIRE);
+	uint64_t reset = __atomic_load_n(&slowlog->reset, __ATOMIC_RELAXED);
+	uint64_t id;
+	uint32_t seq;
+	slowlog_entry_t *e;
+	int n = 0;
+
+	for (id = next; (id > reset) && (next - id < slowlog->size) && (n < max); id--) {
+		e = &slowlog->entry[(id - 1) % slowlog->size];
+		do {
+			while ((seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE)) & 1);
+			memcpy(&dst[n], e, sizeof(slowlog_entry_t));
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		} while (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) != seq);
+		if (dst[n].id != id - 1)
+			break;
+		n++;
+	}
+
+	return(n);
+}
+
+int slowlog_length(slowlog_t *slowlog)
+{
+	uint64_t next = __atomic_load_n(&slowlog->next, __ATOMIC_ACQUIRE);
+	uint64_t reset = __atomic_load_n(&slowlog->reset, __ATOMIC_RELAXED);
+
+	return((next - reset < slowlog->size) ? next - reset:slowlog->size);
+}
+
+void slowlog_reset(slowlog_t *slowlog)
+{
+	__atomic_store_n(&slowlog->reset, __atomic_load_n(&slowlog->next, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+}
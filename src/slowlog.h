@@ -0,0 +1,40 @@
+#ifndef SLOWLOG_H
+#define SLOWLOG_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#define SLOWLOG_ARG_MAX 32 // (prefix of) first argument kept with a command
+#define SLOWLOG_SLOWER_THAN 10000 // default threshold in microseconds
+#define SLOWLOG_MAX_LEN 128
+
+/* NOTE: seq is odd while an entry is being written, reader retries until it gets
+         the same even value before and after copying the entry out */
+typedef struct {
+	uint32_t seq;
+	uint64_t id;
+	uint64_t sent, received;
+	short cmd;
+	int args, arglen;
+	char arg[SLOWLOG_ARG_MAX];
+	char client[INET6_ADDRSTRLEN];
+	const char *acl;
+} slowlog_entry_t;
+
+/* NOTE: ring of commands slower than a threshold, written by a single proxy thread only,
+         read lock-free by anyone else; reset only hides entries written so far */
+typedef struct {
+	slowlog_entry_t *entry;
+	unsigned int size;
+	uint64_t slower_than;
+	uint64_t next, reset;
+} slowlog_t;
+
+slowlog_t *slowlog_create(long long slower_than, int max_len);
+void slowlog_destroy(slowlog_t *slowlog);
+void slowlog_record(slowlog_t *slowlog, uint64_t elapsed, short cmd, int args, const char *arg, int arglen, const char *client, const char *acl);
+int slowlog_read(slowlog_t *slowlog, slowlog_entry_t *dst, int max);
+int slowlog_length(slowlog_t *slowlog);
+void slowlog_reset(slowlog_t *slowlog);
+
+#endif
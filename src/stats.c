@@ -0,0 +1,213 @@
+/*
+   Copyright (c) 2018-2019, Seznam.cz, a.s.
+
+   Author: Daniel Bilik (daniel.bilik@firma.seznam.cz)
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+   PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+   BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+   POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "log.h"
+#include "stats.h"
+
+/* NOTE: histograms are updated lock-free from proxy threads (ACL ones even from several
+         of them at once) and read by whoever dumps them, hence relaxed atomics everywhere */
+
+uint64_t stats_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+void *stats_alloc(size_t size)
+{
+	void *p;
+
+	size = (size + STATS_CACHELINE - 1) & ~(STATS_CACHELINE - 1);
+
+	if (posix_memalign(&p, STATS_CACHELINE, size) != 0) {
+		LOG(E1, "posix_memalign() failed");
+		return(NULL);
+	}
+
+	memset(p, 0, size);
+
+	return(p);
+}
+
+stats_counters_t *stats_counters_create(int commands, int acls)
+{
+	stats_counters_t *counters;
+
+	if ((counters = (stats_counters_t *)stats_alloc(sizeof(stats_counters_t))) == NULL)
+		return(NULL);
+
+	if (((counters->command = (stats_command_t *)stats_alloc(commands * sizeof(stats_command_t))) == NULL) ||
+	    ((counters->acl = (stats_acl_t *)stats_alloc((acls + 1) * sizeof(stats_acl_t))) == NULL)) {
+		stats_counters_destroy(counters);
+		return(NULL);
+	}
+
+	return(counters);
+}
+
+void stats_counters_destroy(stats_counters_t *counters)
+{
+	if (counters == NULL)
+		return;
+
+	free(counters->command);
+	free(counters->acl);
+	free(counters);
+}
+
+stats_histogram_t *stats_histogram_get(stats_histogram_t **slot)
+{
+	stats_histogram_t *histogram = __atomic_load_n(slot, __ATOMIC_ACQUIRE), *expected = NULL;
+
+	if (histogram != NULL)
+		return(histogram);
+
+	if ((histogram = (stats_histogram_t *)malloc(sizeof(stats_histogram_t))) == NULL) {
+		LOG(E1, "malloc() failed, %s", strerror(errno));
+		return(NULL);
+	}
+
+	memset(histogram, 0, sizeof(stats_histogram_t));
+
+	if (!__atomic_compare_exchange_n(slot, &expected, histogram, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		free(histogram);
+		histogram = expected;
+	}
+
+	return(histogram);
+}
+
+void stats_histogram_destroy(stats_histogram_t *histogram)
+{
+	free(histogram);
+}
+
+int stats_histogram_index(uint64_t value)
+{
+	int e, i;
+
+	if (value < STATS_HISTOGRAM_SUB)
+		return(value);
+
+	e = 63 - __builtin_clzll(value);
+	i = (e - STATS_HISTOGRAM_SUB_BITS + 1) * STATS_HISTOGRAM_SUB + (int)((value >> (e - STATS_HISTOGRAM_SUB_BITS)) - STATS_HISTOGRAM_SUB);
+
+	return((i < STATS_HISTOGRAM_BUCKETS) ? i:STATS_HISTOGRAM_BUCKETS - 1);
+}
+
+uint64_t stats_histogram_value(int index)
+{
+	int e;
+	uint64_t top;
+
+	if (index < STATS_HISTOGRAM_SUB)
+		return(index);
+
+	e = index / STATS_HISTOGRAM_SUB + STATS_HISTOGRAM_SUB_BITS - 1;
+	top = STATS_HISTOGRAM_SUB + index % STATS_HISTOGRAM_SUB;
+
+	return(((top + 1) << (e - STATS_HISTOGRAM_SUB_BITS)) - 1);
+}
+
+void stats_histogram_record(stats_histogram_t *histogram, uint64_t value)
+{
+	uint64_t max;
+
+	if (histogram == NULL)
+		return;
+
+	__atomic_fetch_add(&histogram->bucket[stats_histogram_index(value)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&histogram->sum, value, __ATOMIC_RELAXED);
+
+	max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+
+	while ((value > max) && !__atomic_compare_exchange_n(&histogram->max, &max, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+uint64_t stats_histogram_percentile(stats_histogram_t *histogram, double percentile)
+{
+	uint64_t count = 0, total = 0, target, value, max;
+	int i;
+
+	if (histogram == NULL)
+		return(0);
+
+	/* NOTE: buckets are summed up rather than using count, which may be ahead of them */
+	for (i = 0; i < STATS_HISTOGRAM_BUCKETS; i++)
+		total += __atomic_load_n(&histogram->bucket[i], __ATOMIC_RELAXED);
+
+	if (total == 0)
+		return(0);
+
+	target = (uint64_t)(total * percentile / 100.0 + 0.5);
+
+	if (target == 0)
+		target = 1;
+
+	for (i = 0; i < STATS_HISTOGRAM_BUCKETS; i++) {
+		count += __atomic_load_n(&histogram->bucket[i], __ATOMIC_RELAXED);
+		if (count >= target)
+			break;
+	}
+
+	value = stats_histogram_value((i < STATS_HISTOGRAM_BUCKETS) ? i:STATS_HISTOGRAM_BUCKETS - 1);
+	max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+
+	return((value > max) ? max:value);
+}
+
+void stats_histogram_log(stats_histogram_t *histogram, const char *what)
+{
+	char line[256];
+	uint64_t count;
+
+	if ((histogram == NULL) || ((count = __atomic_load_n(&histogram->count, __ATOMIC_RELAXED)) == 0))
+		return;
+
+	snprintf(line, sizeof(line), "count %llu, mean %llu us, p50 %llu us, p99 %llu us, p999 %llu us, max %llu us",
+		(unsigned long long)count,
+		(unsigned long long)(__atomic_load_n(&histogram->sum, __ATOMIC_RELAXED) / count),
+		(unsigned long long)stats_histogram_percentile(histogram, 50),
+		(unsigned long long)stats_histogram_percentile(histogram, 99),
+		(unsigned long long)stats_histogram_percentile(histogram, 99.9),
+		(unsigned long long)__atomic_load_n(&histogram->max, __ATOMIC_RELAXED));
+
+	LOG(I1, "latency of %s: %s", what, line);
+}
@@ -0,0 +1,54 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+#define STATS_HISTOGRAM_SUB_BITS 5
+#define STATS_HISTOGRAM_SUB (1 << STATS_HISTOGRAM_SUB_BITS)
+#define STATS_HISTOGRAM_BUCKETS 1024
+#define STATS_CACHELINE 64
+
+/* NOTE: counters have a single writer (thread of their proxy), so they're bumped without
+         locked instructions, relaxed load/store just keeps readers from seeing torn values */
+#define STATS_ADD(counter, n) __atomic_store_n(&(counter), __atomic_load_n(&(counter), __ATOMIC_RELAXED) + (n), __ATOMIC_RELAXED)
+#define STATS_GET(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+/* NOTE: log-linear (HDR-style) histogram of values in microseconds, each power of two
+         is split into STATS_HISTOGRAM_SUB buckets, giving ~3% precision up to ~19 hours */
+typedef struct {
+	uint64_t count, sum, max;
+	uint64_t bucket[STATS_HISTOGRAM_BUCKETS];
+} stats_histogram_t;
+
+typedef struct {
+	uint64_t allowed, blocked;
+} stats_command_t;
+
+typedef struct {
+	uint64_t sessions, allowed, blocked, yields, oversized;
+} stats_acl_t;
+
+/* NOTE: counters of a single proxy, each block is allocated cache line aligned, so that
+         no two threads ever write to the same line */
+typedef struct {
+	uint64_t sessions, sessions_total;
+	uint64_t client_in, client_out, server_in, server_out;
+	uint64_t connect_failures, server_auth_failures;
+	uint64_t auth_ok, auth_failed;
+	uint64_t idle_timeouts, lifetime_expirations;
+	uint64_t connecting, connect_queued, rejected, accept_pauses;
+	uint64_t read_yields;
+	stats_command_t *command;
+	stats_acl_t *acl;
+} stats_counters_t;
+
+uint64_t stats_clock(void);
+stats_counters_t *stats_counters_create(int commands, int acls);
+void stats_counters_destroy(stats_counters_t *counters);
+stats_histogram_t *stats_histogram_get(stats_histogram_t **slot);
+void stats_histogram_destroy(stats_histogram_t *histogram);
+void stats_histogram_record(stats_histogram_t *histogram, uint64_t value);
+uint64_t stats_histogram_percentile(stats_histogram_t *histogram, double percentile);
+void stats_histogram_log(stats_histogram_t *histogram, const char *what);
+
+#endif
@@ -0,0 +1,292 @@
+/*
+   Copyright (c) 2018-2019, Seznam.cz, a.s.
+
+   Author: Daniel Bilik (daniel.bilik@firma.seznam.cz)
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+   PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+   BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+   POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "log.h"
+#include "upgrade.h"
+
+/* NOTE: hot upgrade; running process execs (a possibly new version of) its binary with
+         the same arguments, passes it listening sockets over a unix socket (SCM_RIGHTS),
+         waits until the new one reports it's accepting, then stops accepting itself and
+         drains its sessions; listening sockets are never closed, so no connection
+         attempt gets refused in the meantime; new process daemonizes again, so it tells
+         its pid (the one left running) first */
+
+char upgrade_path[PATH_MAX];
+char **upgrade_argv = NULL;
+int upgrade_fd = -1;
+upgrade_listener_t upgrade_listeners[UPGRADE_LISTENERS_MAX];
+int upgrade_listeners_count = 0;
+
+/* NOTE: binary is looked up before anything (chroot etc.) might make it unreachable */
+int upgrade_init(const char *path, char **argv)
+{
+	ssize_t n;
+
+	upgrade_argv = argv;
+
+#ifdef LINUX
+	if ((n = readlink("/proc/self/exe", upgrade_path, sizeof(upgrade_path) - 1)) > 0) {
+		upgrade_path[n] = '\0';
+		return(0);
+	}
+#endif
+
+	if (realpath(path, upgrade_path) == NULL) {
+		snprintf(upgrade_path, sizeof(upgrade_path), "%s", path);
+		return(-1);
+	}
+
+	return(0);
+}
+
+/* NOTE: reads exactly len bytes unless deadline passes (or the other side is gone) */
+int upgrade_read(int fd, void *dst, size_t len, time_t deadline)
+{
+	struct pollfd pfd;
+	ssize_t n;
+	time_t now;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	while (len > 0) {
+		if (((now = time(NULL)) >= deadline) || (poll(&pfd, 1, (deadline - now) * 1000) != 1))
+			return(-1);
+		if ((n = read(fd, dst, len)) <= 0)
+			return(-1);
+		dst = (char *)dst + n;
+		len -= n;
+	}
+
+	return(0);
+}
+
+int upgrade_send(int sock, const char *name, int fd)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char control[CMSG_SPACE(sizeof(int))];
+
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+
+	iov.iov_base = (void *)name;
+	iov.iov_len = strlen(name) + 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (fd != -1) {
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+
+	return((sendmsg(sock, &msg, 0) == -1) ? -1:0);
+}
+
+/* NOTE: called by a new process before creating its proxies, listeners are received
+         as messages of their name and a descriptor, an empty name ends the list */
+int upgrade_receive(void)
+{
+	const char *env = getenv(UPGRADE_ENV);
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char control[CMSG_SPACE(sizeof(int))];
+	upgrade_listener_t *l;
+	ssize_t n;
+	pid_t pid;
+
+	if (env == NULL)
+		return(0);
+
+	upgrade_fd = atoi(env);
+	unsetenv(UPGRADE_ENV);
+	fcntl(upgrade_fd, F_SETFD, FD_CLOEXEC);
+
+	pid = getpid();
+
+	if (write(upgrade_fd, &pid, sizeof(pid_t)) != sizeof(pid_t)) {
+		LOG(E1, "failed to notify previous process, %s", strerror(errno));
+		return(-1);
+	}
+
+	while (upgrade_listeners_count < UPGRADE_LISTENERS_MAX) {
+		l = &upgrade_listeners[upgrade_listeners_count];
+		memset(&msg, 0, sizeof(msg));
+		memset(l, 0, sizeof(upgrade_listener_t));
+		iov.iov_base = l->name;
+		iov.iov_len = sizeof(l->name) - 1;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if ((n = recvmsg(upgrade_fd, &msg, 0)) <= 0) {
+			LOG(E1, "failed to receive listeners from previous process, %s", (n == 0) ? "connection closed":strerror(errno));
+			return(-1);
+		}
+		if (l->name[0] == '\0')
+			break;
+		l->fd = -1;
+		if (((cmsg = CMSG_FIRSTHDR(&msg)) != NULL) && (cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS))
+			memcpy(&l->fd, CMSG_DATA(cmsg), sizeof(int));
+		if (l->fd == -1)
+			continue;
+		/* NOTE: daemonized process has its standard descriptors closed, stdout is closed
+		         yet once more later, listener mustn't get one of their numbers */
+		if (l->fd <= 2) {
+			n = fcntl(l->fd, F_DUPFD_CLOEXEC, 3);
+			close(l->fd);
+			if ((l->fd = n) == -1)
+				continue;
+		}
+		fcntl(l->fd, F_SETFD, FD_CLOEXEC);
+		LOG(D1, "inherited listener '%s'", l->name);
+		upgrade_listeners_count++;
+	}
+
+	return(upgrade_listeners_count);
+}
+
+int upgrade_listener(const char *name)
+{
+	int i, fd;
+
+	for (i = 0; i < upgrade_listeners_count; i++)
+		if ((upgrade_listeners[i].fd != -1) && (strcmp(upgrade_listeners[i].name, name) == 0)) {
+			fd = upgrade_listeners[i].fd;
+			upgrade_listeners[i].fd = -1;
+			return(fd);
+		}
+
+	return(-1);
+}
+
+/* NOTE: listeners not claimed by any 'listen' of the new configuration are closed,
+         previous process is told we're accepting */
+void upgrade_ready(void)
+{
+	int i;
+
+	if (upgrade_fd == -1)
+		return;
+
+	for (i = 0; i < upgrade_listeners_count; i++)
+		if (upgrade_listeners[i].fd != -1) {
+			LOG(I1, "listener '%s' isn't configured anymore, closing it", upgrade_listeners[i].name);
+			close(upgrade_listeners[i].fd);
+		}
+
+	if (write(upgrade_fd, "R", 1) != 1)
+		LOG(W1, "failed to notify previous process, %s", strerror(errno));
+
+	close(upgrade_fd);
+	upgrade_fd = -1;
+}
+
+/* NOTE: returns pid of a new process once it's ready, -1 when it has failed (it's killed
+         then, both the one exec'd and the one it has forked, if known) */
+pid_t upgrade_spawn(const char **name, int *fd, int n)
+{
+	int sv[2], i;
+	char env[32], c = 0;
+	time_t deadline;
+	pid_t pid, daemon = -1;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+		LOG(E1, "socketpair() failed, %s", strerror(errno));
+		return(-1);
+	}
+
+	fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+
+	switch (pid = fork()) {
+	case -1:
+		LOG(E1, "fork() failed, %s", strerror(errno));
+		close(sv[0]);
+		close(sv[1]);
+		return(-1);
+	case 0:
+		snprintf(env, sizeof(env), "%d", sv[1]);
+		setenv(UPGRADE_ENV, env, 1);
+		execv(upgrade_path, upgrade_argv);
+		_exit(127);
+	}
+
+	close(sv[1]);
+
+	LOG(I1, "started '%s' as pid %d, passing it %d listeners", upgrade_path, pid, n);
+
+	for (i = 0; i <= n; i++)
+		if (upgrade_send(sv[0], (i < n) ? name[i]:"", (i < n) ? fd[i]:-1) == -1) {
+			LOG(E1, "failed to pass listeners to new process, %s", strerror(errno));
+			break;
+		}
+
+	deadline = time(NULL) + UPGRADE_TIMEOUT;
+
+	if ((i > n) && (upgrade_read(sv[0], &daemon, sizeof(pid_t), deadline) == 0))
+		LOG(I1, "new process is running as pid %d", daemon);
+
+	if ((daemon > 0) && (upgrade_read(sv[0], &c, 1, deadline) == 0) && (c == 'R')) {
+		close(sv[0]);
+		waitpid(pid, NULL, WNOHANG);
+		return(daemon);
+	}
+
+	LOG(E1, "new process %d hasn't got ready, keeping on", (daemon > 0) ? daemon:pid);
+
+	close(sv[0]);
+	if ((daemon > 0) && (daemon != pid))
+		kill(daemon, SIGTERM);
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, WNOHANG);
+
+	return(-1);
+}
@@ -0,0 +1,23 @@
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+#include <sys/types.h>
+
+#define UPGRADE_ENV "PROXIS_UPGRADE_FD"
+#define UPGRADE_TIMEOUT 30 // seconds new process is given to get ready
+#define UPGRADE_LISTENERS_MAX 256
+#define UPGRADE_NAME_MAX 256
+
+/* NOTE: listening socket inherited from a previous process, keyed by its 'listen' address */
+typedef struct {
+	char name[UPGRADE_NAME_MAX];
+	int fd;
+} upgrade_listener_t;
+
+int upgrade_init(const char *path, char **argv);
+int upgrade_receive(void);
+int upgrade_listener(const char *name);
+void upgrade_ready(void);
+pid_t upgrade_spawn(const char **name, int *fd, int n);
+
+#endif
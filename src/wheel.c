@@ -0,0 +1,142 @@
+/*
+   Copyright (c) 2018-2019, Seznam.cz, a.s.
+
+   Author: Daniel Bilik (daniel.bilik@firma.seznam.cz)
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+   PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+   BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+   POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <event.h>
+
+#include "log.h"
+#include "stats.h"
+#include "wheel.h"
+
+void wheel_link(wheel_t *wheel, wheel_timer_t *timer)
+{
+	wheel_timer_t *head = &wheel->slot[timer->expire & (WHEEL_SLOTS - 1)];
+
+	timer->next = head->next;
+	timer->prev = head;
+	head->next->prev = timer;
+	head->next = timer;
+}
+
+void wheel_cancel(wheel_t *wheel, wheel_timer_t *timer)
+{
+	if (timer->next == NULL)
+		return;
+
+	/* NOTE: timer next to be run is being cancelled (by a callback of the current one) */
+	if (wheel->running == timer)
+		wheel->running = timer->next;
+
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->next = timer->prev = NULL;
+}
+
+/* NOTE: current time in ticks is taken from the clock, wheel's tick lags behind it while
+         the event loop is busy (until missed ticks are caught up with) */
+uint64_t wheel_now(wheel_t *wheel)
+{
+	return((stats_clock() / 1000 - wheel->start) / WHEEL_TICK);
+}
+
+/* NOTE: expiration is rounded up to the next tick, timer never fires early */
+void wheel_add(wheel_t *wheel, wheel_timer_t *timer, uint64_t ms, wheel_cb_t cb, void *arg)
+{
+	wheel_cancel(wheel, timer);
+
+	timer->expire = wheel_now(wheel) + (ms + WHEEL_TICK - 1) / WHEEL_TICK + 1;
+	timer->cb = cb;
+	timer->arg = arg;
+
+	wheel_link(wheel, timer);
+}
+
+/* NOTE: ticks missed (when event loop has been busy) are caught up with, callback may
+         cancel or add any timer, including the one being run and the next one in slot */
+void wheel_tick(evutil_socket_t fd, short events, void *arg)
+{
+	wheel_t *wheel = (wheel_t *)arg;
+	wheel_timer_t *head, *timer;
+	uint64_t now = wheel_now(wheel);
+
+	while (wheel->tick < now) {
+		wheel->tick++;
+		head = &wheel->slot[wheel->tick & (WHEEL_SLOTS - 1)];
+		for (timer = head->next; timer != head; timer = wheel->running) {
+			wheel->running = timer->next;
+			if (timer->expire > wheel->tick)
+				continue;
+			wheel_cancel(wheel, timer);
+			timer->cb(timer, timer->arg);
+		}
+	}
+
+	wheel->running = NULL;
+}
+
+wheel_t *wheel_create(struct event_base *eb)
+{
+	struct timeval tv = { WHEEL_TICK / 1000, (WHEEL_TICK % 1000) * 1000 };
+	wheel_t *wheel;
+	int i;
+
+	if ((wheel = (wheel_t *)malloc(sizeof(wheel_t))) == NULL) {
+		LOG(E1, "malloc() failed, %s", strerror(errno));
+		return(NULL);
+	}
+
+	memset(wheel, 0, sizeof(wheel_t));
+
+	for (i = 0; i < WHEEL_SLOTS; i++)
+		wheel->slot[i].next = wheel->slot[i].prev = &wheel->slot[i];
+
+	wheel->start = stats_clock() / 1000;
+
+	if (((wheel->ev = event_new(eb, -1, EV_PERSIST, wheel_tick, wheel)) == NULL) || (event_add(wheel->ev, &tv) == -1)) {
+		LOG(E1, "failed to initialize timer wheel");
+		wheel_destroy(wheel);
+		return(NULL);
+	}
+
+	return(wheel);
+}
+
+void wheel_destroy(wheel_t *wheel)
+{
+	if (wheel == NULL)
+		return;
+
+	if (wheel->ev)
+		event_free(wheel->ev);
+
+	free(wheel);
+}
@@ -0,0 +1,40 @@
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <stdint.h>
+#include <event.h>
+
+#define WHEEL_SLOTS 1024 // power of two
+#define WHEEL_TICK 100 // milliseconds
+
+struct wheel_timer_s;
+
+typedef void (*wheel_cb_t)(struct wheel_timer_s *timer, void *arg);
+
+/* NOTE: timer is embedded in its owner, it's linked into a slot of its expiration tick
+         (modulo number of slots), timers further than a whole round stay in their slot
+         until their round comes */
+typedef struct wheel_timer_s {
+	struct wheel_timer_s *next, *prev;
+	uint64_t expire;
+	wheel_cb_t cb;
+	void *arg;
+} wheel_timer_t;
+
+/* NOTE: hashed timer wheel of a single event loop, driven by one periodic event, so that
+         any number of timers costs a single libevent timer; tick is the current time
+         in WHEEL_TICK units, good enough for timeouts of seconds */
+typedef struct {
+	wheel_timer_t slot[WHEEL_SLOTS];
+	uint64_t tick, start;
+	struct event *ev;
+	wheel_timer_t *running;
+} wheel_t;
+
+wheel_t *wheel_create(struct event_base *eb);
+void wheel_destroy(wheel_t *wheel);
+void wheel_add(wheel_t *wheel, wheel_timer_t *timer, uint64_t ms, wheel_cb_t cb, void *arg);
+void wheel_cancel(wheel_t *wheel, wheel_timer_t *timer);
+uint64_t wheel_now(wheel_t *wheel);
+
+#endif
@@ -6,12 +6,105 @@ set -x
 
 launch_redis redis-nopass.conf
 [ $? -ne 0 ] && echo "failed to launch redis" && exit 1
+launch_redis redis-backlog.conf
+[ $? -ne 0 ] && echo "failed to launch redis" && exit 1
+launch_redis redis-shadow.conf
+[ $? -ne 0 ] && echo "failed to launch redis" && exit 1
 launch_proxis proxis-nopass.conf
 [ $? -ne 0 ] && echo "failed to launch proxis" && exit 1
 
 ./tests.sh && rc=0 || rc=1
 
+echo -n "admin: info ... "
+test_command 16390 "cmdstat_ping:allowed=1" info || rc=1
+
+echo -n "timeouts: session lifetime ... "
+exec 3<>/dev/tcp/127.0.0.1/16381
+printf '*1\r\n$4\r\nPING\r\n' >&3
+sleep 2
+if timeout 1 cat <&3 > /dev/null ; then
+	test_command 16390 "session_lifetime_expirations:1" info proxy || rc=1
+else
+	echo "failed" ; rc=1
+fi
+exec 3<&-
+
+echo -n "deny-net: shared pubsub ... "
+redis-cli -h 127.0.0.1 -p 16379 subscribe news > pubsub-1.out &
+sub1=$!
+redis-cli -h 127.0.0.1 -p 16379 subscribe news > pubsub-2.out &
+sub2=$!
+sleep 1
+output=$(redis-cli -h 127.0.0.1 -p 16390 info proxy 2>&1)
+redis-cli -h 127.0.0.1 -p 16379 publish news hello > /dev/null
+sleep 1
+kill $sub1 $sub2
+wait $sub1 $sub2 2> /dev/null
+[[ $output =~ pubsub_channels:1 ]] && grep -q hello pubsub-1.out && grep -q hello pubsub-2.out && echo "ok" || { echo "failed" ; rc=1 ; }
+rm -f pubsub-1.out pubsub-2.out
+
+echo -n "admin: slowlog ... "
+redis-cli -h 127.0.0.1 -p 16381 get slowlogged > /dev/null
+test_command 16390 "get.slowlogged.127\.0\.0\.1.deny-ip" slowlog get 1 || rc=1
+
+echo -n "deny-ip: max_reply_bytes ... "
+redis-cli -h 127.0.0.1 -p 16379 set large $(head -c 2048 /dev/zero | tr '\0' x) > /dev/null
+test_command 16380 "ERR.*max_reply_bytes" get large || rc=1
+
+echo -n "admin: hotkeys ... "
+redis-cli -h 127.0.0.1 -p 16380 get hotkey > /dev/null
+test_command 16390 "hotkey" hotkeys || rc=1
+
+echo -n "allow-auth: coalesced reads ... "
+redis-cli -h 127.0.0.1 -p 16376 debug sleep 1 > /dev/null &
+sleep 0.3
+for i in 1 2 3 4 ; do
+	redis-cli -h 127.0.0.1 -p 16378 -a AuthorizeMe get user:hot > /dev/null 2>&1 &
+done
+wait
+test_command 16390 "cache_merges:[1-9]" info proxy || rc=1
+
+echo -n "connect queue: listener pause ... "
+kill -STOP $(cat redis-backlog.pid)
+exec 5<>/dev/tcp/127.0.0.1/16386 6<>/dev/tcp/127.0.0.1/16386
+exec 7<>/dev/tcp/127.0.0.1/16382 8<>/dev/tcp/127.0.0.1/16382
+sleep 0.5
+test_command 16390 "Proxy 127.0.0.1:16382[^#]*server_connecting:1[^#]*server_connect_queue:1[^#]*accept_paused:1" info proxy || rc=1
+exec 5<&- 6<&- 7<&- 8<&-
+kill -CONT $(cat redis-backlog.pid)
+
+echo -n "connect queue: listener resume ... "
+sleep 1
+test_command 16390 "Proxy 127.0.0.1:16382[^#]*server_connect_queue:0[^#]*accept_paused:0" info proxy || rc=1
+
+echo -n "deny-net: shadow mirroring ... "
+redis-cli -h 127.0.0.1 -p 16379 -n 2 set shadowed value > /dev/null
+sleep 0.5
+test_command 16375 "^value$" -n 2 get shadowed || rc=1
+
+echo -n "deny-net: shadow after failed select ... "
+exec 3<>/dev/tcp/127.0.0.1/16379
+printf '*2\r\n$6\r\nSELECT\r\n$2\r\n99\r\n' >&3
+read -t 1 reply <&3
+printf '*3\r\n$3\r\nSET\r\n$4\r\nlost\r\n$5\r\nvalue\r\n' >&3
+read -t 1 reply <&3
+exec 3<&-
+test_command 16390 "Proxy 127.0.0.1:16379[^#]*shadow_dropped:1" info proxy || rc=1
+
+echo -n "allow-net: session pool reuse ... "
+for i in $(seq 70) ; do
+	redis-cli -h 127.0.0.1 -p 16377 ping > /dev/null
+done
+sleep 0.5
+test_command 16390 "Proxy 127.0.0.1:16377[^#]*session_pool:slabs=1,used=0,free=[0-9]+,gets=[0-9]{2,}" info proxy || rc=1
+
+echo -n "audit: decode ... "
+../src/proxis-audit proxis-audit-16377.* | grep -q "acl=allow-net cmd=ping allowed" && echo "ok" || { echo "failed" ; rc=1 ; }
+
 stop_proxis
 stop_redis
+kill $(cat redis-backlog.pid) $(cat redis-shadow.pid)
+
+rm -f proxis-audit-16377.*
 
 exit $rc